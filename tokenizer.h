@@ -16,6 +16,37 @@
     to have all functions declared as static.
         #define TOKENIZER_LOG_ERRORS
     to print all errors to stderr.
+        #define TOKENIZER_PARALLEL
+    to enable TokenizeAllParallel, which lexes big buffers on multiple threads, and TokenizeBatch,
+    which lexes many files at once (needs <thread>).
+        #define TOKENIZER_LOOKAHEAD 4
+    to change how many tokens PeekToken can look ahead (must be a power of two, default is 4).
+        #define TOKENIZER_USE_DFA
+    to lex operators with a table-driven state machine instead of the default switch.
+        #define TOKENIZER_KEYWORDS "if", "else", "while"
+    to lex these identifiers as TOKEN_KEYWORD, with Token.Keyword the index in the list. The lookup is
+    a perfect hash found at compile time (needs C++14).
+        #define TOKENIZER_NO_SIMD
+    to disable the SSE2/AVX2 whitespace, comment and string skipping and the 8-digits-at-a-time number
+    parsing, and always use the scalar loops.
+        #define TOKENIZER_STATS
+    to add tokenizer_stats, counters of where the lexing time goes (see below).
+        #define TOKENIZER_RANGES
+    to add TokenRange, which makes the tokens a std::ranges view (needs C++20).
+        #define TOKENIZER_PREPROCESSOR
+    to add tokenizer_preprocessor, which handles #include, #define and #if (see below).
+        #define TOKENIZER_BENCHMARK
+    to add GenerateCorpus and RunTokenizerBenchmarks (see below).
+        #define TOKENIZER_FUZZ
+    to add FuzzTokenizer and the libFuzzer entry point LLVMFuzzerTestOneInput (see below).
+
+    You can also provide alternate definitions of C library functions:
+        #define TOKENIZER_MALLOC(Size)
+        #define TOKENIZER_REALLOC(Ptr, Size)
+        #define TOKENIZER_FREE(Ptr)
+
+    NOTE: the SIMD skipping uses aligned loads, so it may read up to 31 bytes past the terminating '\0'
+    (never crossing a page boundary). It is turned off automatically in AddressSanitizer builds.
 
         
     Example usage:
@@ -46,15 +77,219 @@
        return 0;
     }
 
+    To lex a whole buffer in one go, use TokenizeAll. It fills a token_buffer, which keeps types,
+    offsets, lengths, values and lines in separate arrays. Pass an arena to InitTokenBuffer if the
+    run must not allocate:
+
+       tokenizer_arena Arena;
+       InitArena(&Arena, Memory, MemorySize);
+
+       token_buffer Tokens;
+       InitTokenBuffer(&Tokens, &Arena);
+
+       if (TokenizeAll(&Tokenizer, &Tokens)) {
+           for (int i = 0; i < Tokens.Count; ++i) {
+               ... Tokens.Types[i], Tokens.Offsets[i], ...
+           }
+       }
+
+    When memory matters more than random access to values, TokenizeAllPacked keeps 8 bytes per token
+    (offset, length and type) in a packed_token_buffer. UnpackToken gives back the full token.
+
+    To lex a file without loading it, use InitTokenizerFromFile instead of InitTokenizer. The file is
+    memory-mapped and lexed up to its end, so it doesn't need to be '\0'-terminated.
+
+    Tools that lex the same files on every run can keep the tokens on disk with TokenizeAllCached.
+    The cache file is used when it was written for the same data and the same tokenizer settings, and
+    the file is lexed (and the cache written again) otherwise:
+
+       InitTokenizerFromFile(&Tokenizer, "main.c");
+
+       bool Hit;
+       if (TokenizeAllCached(&Tokenizer, &Tokens, "main.c.tokens", &Hit)) {
+           ... same as after TokenizeAll
+
+    On a hit the cache file is mapped and the arrays of the buffer point into it, so loading costs a
+    hash of the data and interning the identifiers of the file, not a pass of the lexer.
+
+    With TOKENIZER_PARALLEL, TokenizeBatch lexes a whole list of files (or buffers) on a pool of threads:
+
+       tokenizer_batch_file Files[3];
+       Files[0].Path = "a.c"; Files[1].Path = "b.c"; Files[2].Path = "c.c";
+
+       tokenizer_batch Batch;
+       Batch.Files = Files;
+       Batch.FileCount = 3;
+       Batch.Intern = true;
+       Batch.Interner = &Interner;     // Optional, see below
+
+       if (TokenizeBatch(&Batch)) {
+           ... Files[i].Tokens, same as after TokenizeAll
+           ... Batch.Bytes / Batch.Seconds, and per worker in Batch.Workers
+       }
+       FreeBatch(&Batch);
+
+    Workers have their own arena and interner shard, so they never wait for each other while lexing.
+    With 'Batch.Interner' the shards are merged into it at the end and the atoms rewritten, which costs
+    a pass over the identifiers; without it, atoms are only comparable between files of the same shard.
+
+    To compare identifiers as integers, give the tokenizer an interner. Every TOKEN_IDENT then carries
+    an atom, and keywords interned first get known atoms:
+
+       static const char* Keywords[] = { "if", "else", "while" };     // Atoms 1, 2, 3
+
+       tokenizer_interner Interner;
+       InitInterner(&Interner, 0);
+       InternKeywords(&Interner, Keywords, 3);
+       Tokenizer.Interner = &Interner;
+       ...
+       if (Token.Type == TOKEN_IDENT && Token.Atom == 3) { // while
+
+    By default a failed RequireToken or a SetError sets 'Tokenizer.Error', and Parsing returns false from
+    then on. To report every error of a file in one pass, give the tokenizer a diagnostics buffer:
+    RequireToken then records what it expected and what it found, leaves 'Error' alone, and the parser
+    goes on from the next synchronization point:
+
+       tokenizer_diagnostics Diagnostics;
+       InitDiagnostics(&Diagnostics, 0);
+       Tokenizer.Diagnostics = &Diagnostics;
+       ...
+       if (!RequireToken(&Tokenizer, TOKEN_SEMICOLON, 0)) {
+           static const token_type Sync[] = { TOKEN_SEMICOLON, TOKEN_CLOSE_BRACE };
+           if (Synchronize(&Tokenizer, Sync, 2) == TOKEN_SEMICOLON) GetToken(&Tokenizer);
+       }
+       ...
+       for (int i = 0; i < Diagnostics.Count; ++i) {
+           char Message[256];
+           FormatDiagnostic(&Tokenizer, &Diagnostics.Items[i], Message, sizeof(Message));
+       }
+
+    Diagnostics only keep the tokens and codes, the messages are built by FormatDiagnostic.
+
+    Callers that don't need every feature can have a lexer compiled without them. Derive a policy from
+    tokenizer_policy, and read the tokens through a basic_tokenizer of that policy:
+
+       struct config_policy : tokenizer_policy {
+           static constexpr bool LineComments = false;
+           static constexpr bool BlockComments = false;
+           static constexpr bool HashComments = true;
+           static constexpr bool ConvertNumbers = false;
+       };
+
+       basic_tokenizer<config_policy> Tokenizer;
+       InitTokenizer(&Tokenizer, Text, 0);
+       token Token = Tokenizer.GetToken();
+
+    Only the members of basic_tokenizer (GetToken, PeekToken, OptionalToken, RequireToken and
+    TokenizeAll) and TokenRange lex with its policy. tokenizer itself is the plain base struct, and the
+    free functions taking one always lex with tokenizer_policy, which has every feature on, even when
+    given a basic_tokenizer. That includes GetToken(&Tokenizer) and the other functions of the same
+    names, Synchronize, TokenizeAllPacked, TokenizeEdit, TokenizeAllCached, TokenizeAllParallel,
+    TokenizeBatch, the stream and the preprocessor.
+
+    Identifiers can contain letters from any script, written in UTF-8: they start with an ASCII letter,
+    '_' or an XID_Start character and go on with XID_Continue characters. Any other non-ASCII character
+    is one TOKEN_UNKNOWN, malformed UTF-8 one TOKEN_UNKNOWN per byte. Strings and chars take any byte,
+    IsValidUtf8 checks their text. A policy with 'Utf8' off lexes every byte >= 0x80 as TOKEN_UNKNOWN.
+
+    With TOKENIZER_RANGES, the tokens can be read with a range-based for loop or std::ranges. Each
+    token_view has its text as a std::string_view into the data, nothing is copied or allocated:
+
+       for (token_view Token : TokenRange(&Tokenizer)) {
+           if (Token.Type == TOKEN_IDENT && Token.Text == "main") ...
+       }
+
+       auto Idents = TokenRange(&Tokenizer) | std::views::filter([](const token_view& Token) {
+           return Token.Type == TOKEN_IDENT;
+       });
+
+    The range reads the tokens with GetToken (of the policy of a basic_tokenizer), so iterating it
+    consumes them, and it stops at TOKEN_EOS or on an error.
+
+    Dialects with more operators can add them without touching the token types:
+
+       static const tokenizer_operator Extra[] = { { "...", 1 }, { "=>", 2 }, { "<=>", 3 }, { "?", 4 } };
+
+       tokenizer_operators Operators;
+       InitOperators(&Operators, Extra, 4);
+       Tokenizer.Operators = &Operators;
+       ...
+       if (Token.Type == TOKEN_OPERATOR && Token.Operator == 2) { // =>
+
+    To get the tokens of a file after preprocessing, define TOKENIZER_PREPROCESSOR and:
+
+       tokenizer_preprocessor Preprocessor;
+       InitPreprocessor(&Preprocessor);
+       AddIncludePath(&Preprocessor, "include");
+       DefineMacro(&Preprocessor, "NDEBUG");
+
+       if (PreprocessFile(&Preprocessor, "main.c")) {
+           for (;;) {
+               preprocessed_token Token = GetPreprocessedToken(&Preprocessor);
+               if (Token.Token.Type == TOKEN_EOS) break;
+               ... Token.Token, and Token.Location.Source, Token.Location.Line
+           }
+       }
+
+       FreePreprocessor(&Preprocessor);
+
+    Object-like and function-like macros are expanded (with #, ## and __VA_ARGS__), conditionals are
+    evaluated, and dead branches are skipped without producing tokens. Each file is lexed once and kept,
+    so headers included many times, or by several files in a row, are not lexed again. Preprocessor.Error
+    is set on errors, which are printed with TOKENIZER_LOG_ERRORS. Not handled: #line, and a '\'
+    followed by a newline inside a token.
+
+    To find out why some inputs lex slowly, define TOKENIZER_STATS and give the tokenizer counters:
+
+       tokenizer_stats Stats;
+       Tokenizer.Stats = &Stats;
+       ...
+       char Json[4096];
+       FormatTokenizerStats(&Stats, Json, sizeof(Json));
+
+    They count the bytes of whitespace, comments and tokens, the tokens lexed by type, the calls to
+    GetToken and PeekToken, the tokens PeekToken lexed for nothing because 'At' moved, and the time
+    spent on numbers. Without TOKENIZER_STATS none of this is compiled in; with it, a tokenizer
+    without 'Stats' pays one test per token. TokenizeAllParallel doesn't count.
+
+    To measure throughput, build a program with TOKENIZER_BENCHMARK defined and:
+
+       int main(int ArgCount, char** Args) {
+           return RunTokenizerBenchmarks(ArgCount, Args);
+       }
+
+    It lexes generated corpora and prints one JSON object per line (corpus, pattern, bytes, tokens,
+    seconds, MB/s, tokens/s and cycles/byte, null where there is no cycle counter). Options:
+       --size=1,64,1024         corpus sizes in MB (default 1,64)
+       --corpus=ident,number    ident, number, comment, string, operator (default all)
+       --pattern=get            get, peek_get, optional_require, and get with a policy that turns one
+                                feature off: get_no_lines, get_no_comments, get_no_numbers, get_no_escapes,
+                                or all of them: get_lean. With TOKENIZER_RANGES, also range: the get loop
+                                written as a range-based for loop over TokenRange (default all)
+       --repeat=3               the best run is reported (default 3)
+       --seed=1                 the same seed always gives the same corpora
+
+    To fuzz the lexer, build a file that defines TOKENIZER_FUZZ and TOKENIZER_IMPLEMENTATION with
+    clang++ -fsanitize=fuzzer,address,undefined (or afl-clang-fast++ -fsanitize=fuzzer for AFL++).
+    Every input goes through all the backends, which must agree with a simple reference lexer. The
+    SIMD paths are off under AddressSanitizer, so also run a build with -fsanitize=fuzzer alone.
+
  */
 
 
-#include <stdlib.h> // For strtoll and strtof
+#include <stdlib.h> // For strtod
+#include <string.h> // For memset
 
-#ifdef TOKENIZER_LOG_ERRORS
+#if defined(TOKENIZER_LOG_ERRORS) || defined(TOKENIZER_BENCHMARK) || defined(TOKENIZER_FUZZ)
 #include <stdio.h>
 #endif
 
+#ifdef TOKENIZER_RANGES
+#include <iterator>
+#include <ranges>
+#include <string_view>
+#endif
+
 #ifndef TOKENIZER_DEF
 #ifdef TOKENIZER_STATIC
 #define TOKENIZER_DEF static
@@ -66,11 +301,13 @@
 enum token_type {
     TOKEN_UNKNOWN,
     TOKEN_IDENT,
+    TOKEN_KEYWORD,              // One of TOKENIZER_KEYWORDS
     TOKEN_OPEN_PAREN,           // (
     TOKEN_CLOSE_PAREN,          // )
     TOKEN_COLON,                // :
     TOKEN_COLON_COLON,          // ::
     TOKEN_STRING,
+    TOKEN_CHAR,                 // 'a', Token.Int is the value of the (first) character
     TOKEN_INTEGER,
     TOKEN_FLOAT,
     TOKEN_SEMICOLON,            // ;
@@ -117,6 +354,7 @@ enum token_type {
     TOKEN_NOT_EQUAL,            // !=
     TOKEN_LOGIC_NOT,            // ~
     TOKEN_LOGIC_NOT_EQUAL,      // ~=
+    TOKEN_OPERATOR,             // One of the tokenizer's 'Operators'
     TOKEN_EOS,                  // \0
     TOKEN_TYPE_COUNT
 };
@@ -131,25 +369,101 @@ struct token {
     union {
         double Float;
         long long int Int;
+        unsigned int Atom;      // TOKEN_IDENT, if the tokenizer has an interner (0 otherwise)
+        int Keyword;            // TOKEN_KEYWORD, index in TOKENIZER_KEYWORDS
+        int Operator;           // TOKEN_OPERATOR, id given to InitOperators
     };
 };
 
+#ifndef TOKENIZER_LOOKAHEAD
+#define TOKENIZER_LOOKAHEAD 4
+#endif
+
+static_assert((TOKENIZER_LOOKAHEAD & (TOKENIZER_LOOKAHEAD - 1)) == 0, "TOKENIZER_LOOKAHEAD must be a power of two");
+
+struct tokenizer_interner;
+struct tokenizer_operators;
+struct tokenizer_diagnostics;
+struct tokenizer_stats;
+
 struct tokenizer {
 
     char *At = 0;
     const char* File = 0;
 
+    // If set, the data stops here instead of at the first '\0'.
+    char* End = 0;
+
+    // Line of the last token read, where it starts. Every '\n' counts, like for GetTokenLocation.
     int Line = 1;
 
+    // Newlines inside the last token read (a string or char spanning lines), added to 'Line' when
+    // lexing goes on.
+    int TokenNewLines = 0;
+
     bool Error = false;
+
+    // Without it 'Line' isn't updated, which makes skipping whitespaces and comments cheaper.
+    // GetTokenLocation works either way.
     bool CountLines = true;
+
+    // If set, every TOKEN_IDENT gets an atom from here in 'Token.Atom'.
+    tokenizer_interner* Interner = 0;
+
+    // If set, these operators are lexed too (see InitOperators).
+    tokenizer_operators* Operators = 0;
+
+    // If set, errors are recorded here, and a failed RequireToken doesn't set 'Error' (see InitDiagnostics).
+    tokenizer_diagnostics* Diagnostics = 0;
+
+#ifdef TOKENIZER_STATS
+    // If set, the lexer adds up its counters here (see tokenizer_stats).
+    tokenizer_stats* Stats = 0;
+#endif
+
+    // Ring buffer of the tokens lexed by PeekToken and not consumed yet, each with its own line.
+    token Lookahead[TOKENIZER_LOOKAHEAD];
+    int LookaheadLines[TOKENIZER_LOOKAHEAD];
+    int LookaheadFirst = 0;
+    int LookaheadCount = 0;
+
+    char* LookaheadFrom = 0;    // 'At' when the first lookahead token was lexed. If 'At' moves, the ring is stale.
+    char* LookaheadAt = 0;      // Where lexing resumes after the last lookahead token
+    int LookaheadLine = 0;
+
+    // Set by InitTokenizerFromFile
+    void* Mapping = 0;
+    size_t MappingSize = 0;
+
+    // Used by GetTokenLocation: the offsets of the newlines between 'Start' and 'Indexed'.
+    char* Start = 0;
+    char* Indexed = 0;
+    int* NewLines = 0;
+    int NewLineCount = 0;
+    int NewLineCapacity = 0;
+};
+
+struct token_location {
+    int Line;
+    int Column;                 // In bytes, starting at 1
 };
 
 // 'Data' and 'Filename' must remain valid while the tokenizer is in use.
 TOKENIZER_DEF void InitTokenizer(tokenizer* Tokenizer, char* Data, const char* Filename);
 
+// Maps the file read-only, no copy and no '\0' needed: token texts point straight into the mapping,
+// and must not be written to. 'Path' must remain valid while the tokenizer is in use.
+// Call FreeTokenizer once done.
+TOKENIZER_DEF bool InitTokenizerFromFile(tokenizer* Tokenizer, const char* Path);
+
+// Releases the file mapping and the newline index, if any.
+TOKENIZER_DEF void FreeTokenizer(tokenizer* Tokenizer);
+
 TOKENIZER_DEF token GetToken(tokenizer* Tokenizer);
-TOKENIZER_DEF token PeekToken(tokenizer* Tokenizer);
+
+// Returns the token 'Ahead' positions after the next one, without consuming anything.
+// 'Ahead' must be less than TOKENIZER_LOOKAHEAD.
+TOKENIZER_DEF token PeekToken(tokenizer* Tokenizer, int Ahead = 0);
 
 // Get a token of given type optionally, i.e without erroring if not found.
 TOKENIZER_DEF bool OptionalToken(tokenizer* Tokenizer, token_type Type, token* Optional);
@@ -159,411 +473,7904 @@ TOKENIZER_DEF bool RequireToken(tokenizer* Tokenizer, token_type Type, token* Re
 TOKENIZER_DEF void SetError(tokenizer *Tokenizer, const char* Message);
 TOKENIZER_DEF bool Parsing(tokenizer *Tokenizer);
 
+// Error recovery: skips tokens up to the next one of 'Types', which is left to be read. Brackets opened
+// while skipping are skipped with their contents, and a bracket closing one opened before the call stops
+// the skipping too. Returns the type of the token it stopped at, TOKEN_EOS at the end of the data.
+TOKENIZER_DEF token_type Synchronize(tokenizer* Tokenizer, const token_type* Types, int Count);
 
-#ifdef TOKENIZER_IMPLEMENTATION
+// Returns "TOKEN_IDENT" for TOKEN_IDENT, and so on.
+TOKENIZER_DEF const char* GetTokenTypeName(token_type Type);
 
-#ifdef TOKENIZER_LOG_ERRORS
-static const char* TokenTypes[TOKEN_TYPE_COUNT]{
-    "TOKEN_UNKNOWN",
-    "TOKEN_IDENT",
-    "TOKEN_OPEN_PAREN",           // (
-    "TOKEN_CLOSE_PAREN",          // )
-    "TOKEN_COLON",                // :
-    "TOKEN_COLON_COLON",          // ::
-    "TOKEN_STRING",
-    "TOKEN_INTEGER",
-    "TOKEN_FLOAT",
-    "TOKEN_SEMICOLON",            // ;
-    "TOKEN_COMMA",                // ,
-    "TOKEN_ASTERISK",             // *
-    "TOKEN_MUL_EQUAL",            // *=
-    "TOKEN_HASHTAG",              // #
-    "TOKEN_AND",                  // &
-    "TOKEN_AND_AND",              // &&
-    "TOKEN_AND_EQUAL",            // &=
-    "TOKEN_OR",                   // |
-    "TOKEN_OR_OR",                // ||
-    "TOKEN_OR_EQUAL",             // |=
-    "TOKEN_XOR",                  // ^
-    "TOKEN_XOR_EQUAL",            // ^=
-    "TOKEN_OPEN_BRACKET",         // [
-    "TOKEN_CLOSE_BRACKET",        // ]
-    "TOKEN_OPEN_BRACE",           // {
-    "TOKEN_CLOSE_BRACE",          // }
-    "TOKEN_OPEN_ANG_BRACKET",     // <
-    "TOKEN_CLOSE_ANG_BRACKET",    // >
-    "TOKEN_RIGHT_SHIFT",          // >>
-    "TOKEN_RIGHT_SHIFT_EQUAL",    // >>=
-    "TOKEN_LEFT_SHIFT",           // <<
-    "TOKEN_LEFT_SHIFT_EQUAL",     // <<=
-    "TOKEN_GREATER_EQUAL",        // >=
-    "TOKEN_LESS_EQUAL",           // <=
-    "TOKEN_PLUS",                 // +
-    "TOKEN_MINUS",                // -
-    "TOKEN_EQUAL",                // =
-    "TOKEN_EQUAL_EQUAL",          // ==
-    "TOKEN_PLUS_PLUS",            // ++
-    "TOKEN_PLUS_EQUAL",           // +=
-    "TOKEN_MINUS_MINUS",          // --
-    "TOKEN_MINUS_EQUAL",          // -=
-    "TOKEN_ARROW",                // ->
-    "TOKEN_DOLLAR_SIGN",          // $
-    "TOKEN_FORWARD_SLASH",        // /
-    "TOKEN_BACKSLASH",            // '\'
-    "TOKEN_DIV_EQUAL",            // /=
-    "TOKEN_MOD",                  // %
-    "TOKEN_MOD_EQUAL",            // %=
-    "TOKEN_NOT",                  // !
-    "TOKEN_NOT_EQUAL",            // !=
-    "TOKEN_LOGIC_NOT",            // ~
-    "TOKEN_LOGIC_NOT_EQUAL",      // ~=
-    "TOKEN_EOS",                  // \0
+// Line and column of a token, lines counted from 1 at the start of the data. The newlines are indexed
+// up to the token on demand, so this is cheap once the tokenizer went past it. Returns line 0 when out
+// of memory. Doesn't work on stream tokens.
+TOKENIZER_DEF token_location GetTokenLocation(tokenizer* Tokenizer, token Token);
+
+
+// Linear allocator over caller-provided memory. Allocations are never freed individually.
+struct tokenizer_arena {
+    char* Base = 0;
+    size_t Size = 0;
+    size_t Used = 0;
 };
-#endif
 
+TOKENIZER_DEF void InitArena(tokenizer_arena* Arena, void* Memory, size_t Size);
 
-#define IS_WHITE(c)  ( (c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n' || (c) == '\f' )
-#define IS_LETTER(c) ( ((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') )
-#define IS_DIGIT(c)  ( (c) >= '0' && (c) <= '9' )
-#define IS_SUFFIX(c) ( (c) == 'e' || (c) == 'E' || (c) == 'f' || (c) == 'F' || \
-    (c) == 'x' || (c) == 'X' || (c) == 'u' || (c) == 'l' || (c) == 'U' || \
-    (c) == 'L' || (c) == '-' || (c) == '+')
+// Returns 0 when the arena is full. The result is aligned to 8 bytes.
+TOKENIZER_DEF void* PushArena(tokenizer_arena* Arena, size_t Size);
 
-#define IS_HEX(c) ( (c) == 'x' || (c) == 'X' || (c) >= 'a' && (c) <= 'f' || (c) >= 'A' && (c) <= 'F' )
 
+enum tokenizer_diagnostic_code {
+    DIAGNOSTIC_ERROR,                   // SetError, with its message
+    DIAGNOSTIC_UNEXPECTED_TOKEN,        // RequireToken found another type of token
+    DIAGNOSTIC_USER = 100               // Codes from here on are free for AddDiagnostic
+};
 
+struct tokenizer_diagnostic {
+    int Code;
+    int Line;                   // 0 if the tokenizer doesn't count lines, FormatDiagnostic then looks it up
+    token Token;                // Where it happened: for DIAGNOSTIC_UNEXPECTED_TOKEN, the token that was found
+    token_type Expected;        // TOKEN_UNKNOWN if none
+    const char* Message;        // Not copied, 0 if none
+};
 
-TOKENIZER_DEF void InitTokenizer(tokenizer* Tokenizer, char* Data, const char* Filename) {
-    Tokenizer->At = Data;
-    Tokenizer->File = Filename;
-}
+// Errors of a tokenizer, kept as they were found and formatted on demand.
+struct tokenizer_diagnostics {
+    tokenizer_diagnostic* Items = 0;
+    int Count = 0;
+    int Capacity = 0;
 
+    // With an arena, 'Capacity' diagnostics are taken from it once and the ones that don't fit are
+    // counted here. Without one, the buffer grows on the heap.
+    tokenizer_arena* Arena = 0;
+    int Dropped = 0;
+};
 
-static bool FindChar(char* String, int Length, char c) {
+// 'Capacity' is only used with an arena, the default is 256.
+TOKENIZER_DEF bool InitDiagnostics(tokenizer_diagnostics* Diagnostics, tokenizer_arena* Arena, int Capacity = 0);
+TOKENIZER_DEF void FreeDiagnostics(tokenizer_diagnostics* Diagnostics);
 
-    for (int i = 0; i < Length; ++i) {
-        if (String[i] == c) return true;
-    }
+// Forgets the diagnostics, keeping the memory.
+TOKENIZER_DEF void ClearDiagnostics(tokenizer_diagnostics* Diagnostics);
 
-    return false;
-}
+// Records a diagnostic about 'Token' if the tokenizer has a diagnostics buffer. It doesn't set 'Error'.
+TOKENIZER_DEF void AddDiagnostic(tokenizer* Tokenizer, int Code, token Token, token_type Expected = TOKEN_UNKNOWN, const char* Message = 0);
 
+// Writes e.g "Error at main.c:12: expected TOKEN_SEMICOLON, found TOKEN_IDENT 'x'." to 'Buffer'. The
+// tokenizer must be the one that recorded the diagnostic. Returns the length snprintf would give.
+TOKENIZER_DEF int FormatDiagnostic(tokenizer* Tokenizer, tokenizer_diagnostic* Diagnostic, char* Buffer, int Size);
 
-TOKENIZER_DEF void SkipLine(tokenizer *Tokenizer) {
-    while (*Tokenizer->At && *Tokenizer->At++ != '\n');
-    ++Tokenizer->Line;
-}
+#ifdef TOKENIZER_STATS
+// Counters added up by the tokenizers that point here. Assign {} to start over. A token that
+// PeekToken lexed for nothing is lexed again, and counted again in the bytes, types and numbers.
+struct tokenizer_stats {
+    long long WhitespaceBytes = 0;          // In front of the tokens, without the comments
+    long long CommentBytes = 0;             // With their delimiters
+    long long TokenBytes = 0;
+    long long Types[TOKEN_TYPE_COUNT] = {}; // Tokens lexed, by type
 
-static token NextToken(tokenizer *Tokenizer) {
+    long long Numbers = 0;                  // TOKEN_INTEGER, TOKEN_FLOAT and TOKEN_CHAR
+    double NumberSeconds = 0;               // Lexing and converting them
 
-    char *c = Tokenizer->At;
+    long long Gets = 0;                     // GetToken, and OptionalToken and RequireToken when they match
+    long long Peeks = 0;                    // PeekToken, OptionalToken and RequireToken
+    long long PeekHits = 0;                 // Gets that returned a token lexed by PeekToken
+    long long RelexedTokens = 0;            // Lexed by PeekToken and dropped because 'At' moved
+    long long RelexedBytes = 0;             // Their bytes, with the blanks in front of them
+};
 
-    // Clean the string
-    for (;;) {
+// Writes the counters as one JSON object, with the types that occurred by name, to 'Buffer'. Returns
+// the length snprintf would give.
+TOKENIZER_DEF int FormatTokenizerStats(const tokenizer_stats* Stats, char* Buffer, int Size);
+#endif
 
-        // Remove all whitespaces
-        while (*c && IS_WHITE(*c)) {
+// Copies the contents of a TOKEN_STRING or TOKEN_CHAR to 'Arena', without the quotes and with the
+// escapes decoded, followed by a '\0'. \u and \U give UTF-8, \x and octal escapes a single byte. It
+// takes at most 'Token.Length' bytes. Returns 0 for other tokens or if the arena is full.
+TOKENIZER_DEF char* UnescapeString(token Token, tokenizer_arena* Arena, int* Length = 0);
 
-            // Count lines
-            if (Tokenizer->CountLines && *c == '\n') ++Tokenizer->Line;
-            ++c;
-        }
+// Returns true if the text is well-formed UTF-8: no overlong forms, surrogates or truncated sequences.
+// The lexer takes any byte in strings and chars, use it to check their contents.
+TOKENIZER_DEF bool IsValidUtf8(const char* Text, int Length);
 
-        // C++ Style Comment
-        if (*c && *c == '/' && c[1] == '/') {
-            while (*c && *c != '\r' && *c != '\n')
-                ++c;
-        }
 
-        // C Style Comment
-        else if (*c && *c == '/' && c[1] == '*') {
-            c += 2;
-            while (*c && (*c != '*' || c[1] != '/')) {
-                if (Tokenizer->CountLines && *c == '\n') ++Tokenizer->Line;
-                ++c;
-            }
+struct tokenizer_atom {
+    char* Text = 0;             // A '\0'-terminated copy, owned by the interner
+    int Length = 0;
+    unsigned int Hash = 0;
+};
 
-            if (*c == '*') {
-                c += 2;
-            }
-        }
-        else break;
-    }
+struct tokenizer_interner_slot {
+    unsigned int Hash;
+    unsigned int Atom;          // 0 if the slot is empty
+};
 
+// Maps identifiers to small integer ids (atoms), so comparing two identifiers is comparing two ints.
+// The same text always gets the same atom, atoms are handed out in order starting from 1.
+struct tokenizer_interner {
+    // Open addressing with linear probing, at most half full. Slots keep the hash next to the atom,
+    // so most collisions are rejected without looking at the text.
+    tokenizer_interner_slot* Slots = 0;
+    int SlotCount = 0;
 
-    token Token;
-    Token.Type = TOKEN_UNKNOWN;
-    Token.Length = 1;
-    Token.Text = c;
+    // Indexed by atom. Atom 0 is never handed out.
+    tokenizer_atom* Atoms = 0;
+    int AtomCount = 0;
+    int AtomCapacity = 0;
 
-    switch(*c) {
-
-        case '\0': { Token.Type = TOKEN_EOS; }           break;
-        case '(':  { Token.Type = TOKEN_OPEN_PAREN; }    break;
-        case ')':  { Token.Type = TOKEN_CLOSE_PAREN; }   break;
-        case ';':  { Token.Type = TOKEN_SEMICOLON; }     break;
-        case '[':  { Token.Type = TOKEN_OPEN_BRACKET; }  break;
-        case ']':  { Token.Type = TOKEN_CLOSE_BRACKET; } break;
-        case '{':  { Token.Type = TOKEN_OPEN_BRACE; }    break;
-        case '}':  { Token.Type = TOKEN_CLOSE_BRACE; }   break;
-        case ',':  { Token.Type = TOKEN_COMMA; }         break;
-        case '$':  { Token.Type = TOKEN_DOLLAR_SIGN; }   break;
-        case '#':  { Token.Type = TOKEN_HASHTAG; }       break;
-        case '\\': { Token.Type = TOKEN_BACKSLASH; }     break;
+    // If set, the tables and the texts come from here and the interner never calls TOKENIZER_MALLOC.
+    tokenizer_arena* Arena = 0;
 
-        case ':':
-        {
-            ++Token.Length;
-            if (c[1] && c[1] == ':') Token.Type = TOKEN_COLON_COLON;
-            else { Token.Type = TOKEN_COLON; Token.Length = 1; }
+    // Without an arena, texts are copied to blocks chained through their first bytes.
+    tokenizer_arena Store;
+    char* Blocks = 0;
+};
 
-        } break;
-        case '=':
-        {
-            ++Token.Length;
-            if (c[1] && c[1] == '=') Token.Type = TOKEN_EQUAL_EQUAL;
-            else { Token.Type = TOKEN_EQUAL; Token.Length = 1; }
+TOKENIZER_DEF void InitInterner(tokenizer_interner* Interner, tokenizer_arena* Arena);
+TOKENIZER_DEF void FreeInterner(tokenizer_interner* Interner);
 
-        } break;
-        case '>':
-        {
-            ++Token.Length;
-            if (c[1] && c[1] == '=') Token.Type = TOKEN_GREATER_EQUAL;
-            else if (c[1] && c[1] == '>') {
-                Token.Type = TOKEN_RIGHT_SHIFT;
-
-                if (c[2] && c[2] == '=') {
-                    Token.Type = TOKEN_RIGHT_SHIFT_EQUAL;
-                    Token.Length = 3;
-                }
-            }
-            else { Token.Type = TOKEN_CLOSE_ANG_BRACKET; Token.Length = 1; }
+// Returns the atom of the given text, adding it if needed. Returns 0 when out of memory.
+TOKENIZER_DEF unsigned int Intern(tokenizer_interner* Interner, const char* Text, int Length);
 
-        } break;
-        case '<':
-        {
-            ++Token.Length;
-            if (c[1] && c[1] == '=') Token.Type = TOKEN_LESS_EQUAL;
-            else if (c[1] && c[1] == '<') {
-                Token.Type = TOKEN_LEFT_SHIFT;
-
-                if (c[2] && c[2] == '=') {
-                    Token.Type = TOKEN_LEFT_SHIFT_EQUAL;
-                    Token.Length = 3;
-                }
-            }
-            else { Token.Type = TOKEN_OPEN_ANG_BRACKET; Token.Length = 1; }
+// Interns 'Count' '\0'-terminated words in order and returns the atom of the first one (0 when out of
+// memory). On an empty interner Words[i] gets atom i + 1, so keywords can be checked with a switch
+// on 'Token.Atom' instead of string compares.
+TOKENIZER_DEF unsigned int InternKeywords(tokenizer_interner* Interner, const char* const* Words, int Count);
 
-        } break;
-        case '/': {
+// Returns the '\0'-terminated text of an atom, 0 if there is no such atom.
+TOKENIZER_DEF const char* GetAtomText(tokenizer_interner* Interner, unsigned int Atom, int* Length = 0);
 
-            ++Token.Length;
-            if (c[1] && c[1] == '=') Token.Type = TOKEN_DIV_EQUAL;
-            else { Token.Type = TOKEN_FORWARD_SLASH; Token.Length = 1; }
 
-        } break;
-        case '+':
-        {
-            ++Token.Length;
-            if (c[1] && c[1] == '=') Token.Type = TOKEN_PLUS_EQUAL;
-            else if (c[1] && c[1] == '+') Token.Type = TOKEN_PLUS_PLUS;
-            else { Token.Type = TOKEN_PLUS; Token.Length = 1; }
+// An operator for InitOperators. It's made of punctuation: no letters, digits, '_', quotes, whitespaces,
+// and no "//" or "/*".
+struct tokenizer_operator {
+    const char* Text;
+    int Id;                     // Goes to 'Token.Operator'
+};
 
-        } break;
-        case '-':
-        {
-            ++Token.Length;
-            if (c[1] && c[1] == '=') Token.Type = TOKEN_MINUS_EQUAL;
-            else if (c[1] && c[1] == '-') Token.Type = TOKEN_MINUS_MINUS;
-            else if (c[1] && c[1] == '>') Token.Type = TOKEN_ARROW;
-            else { Token.Type = TOKEN_MINUS; Token.Length = 1; }
+// Extra operators, lexed as TOKEN_OPERATOR. The longest operator wins, built-in or not, and one with
+// the text of a built-in operator replaces it. A '.' followed by a digit still starts a number.
+// Operators and built-in ones are compiled into one state machine, but only the characters that start
+// an extra operator go through it, the others are lexed as usual.
+struct tokenizer_operators {
+    unsigned int First[8];          // Bit set for the bytes that start an extra operator
+    unsigned char Class[256];       // 0 for the bytes that are in no operator
+    int ClassCount;
+    int StateCount;
+    int MaxLength;
 
-        } break;
-        case '*':
-        {
-            ++Token.Length;
-            if (c[1] && c[1] == '=') Token.Type = TOKEN_MUL_EQUAL;
-            else { Token.Type = TOKEN_ASTERISK; Token.Length = 1; }
+    unsigned short* Next;           // [State * ClassCount + Class], 0 means no transition
+    unsigned char* Types;           // token_type accepted in each state, TOKEN_UNKNOWN if none
+    int* Ids;                       // For TOKEN_OPERATOR
+};
 
-        } break;
-        case '^':
-        {
-            ++Token.Length;
-            if (c[1] && c[1] == '=') Token.Type = TOKEN_XOR_EQUAL;
-            else { Token.Type = TOKEN_XOR; Token.Length = 1; }
+// Returns false if an operator is invalid or when out of memory. The set can be shared by tokenizers.
+TOKENIZER_DEF bool InitOperators(tokenizer_operators* Operators, const tokenizer_operator* List, int Count);
+TOKENIZER_DEF void FreeOperators(tokenizer_operators* Operators);
 
-        } break;
-        case '&':
-        {
-            ++Token.Length;
-            if (c[1] && c[1] == '=') Token.Type = TOKEN_AND_EQUAL;
-            else if (c[1] && c[1] == '&') Token.Type = TOKEN_AND_AND;
-            else { Token.Type = TOKEN_AND; Token.Length = 1; }
 
-        } break;
-        case '|':
-        {
-            ++Token.Length;
-            if (c[1] && c[1] == '=') Token.Type = TOKEN_OR_EQUAL;
-            else if (c[1] && c[1] == '|') Token.Type = TOKEN_OR_OR;
-            else { Token.Type = TOKEN_OR; Token.Length = 1; }
+union token_value {
+    double Float;
+    long long int Int;
+    unsigned int Atom;
+    int Keyword;
+    int Operator;
+};
 
-        } break;
-        case '~':
-        {
-            ++Token.Length;
-            if (c[1] && c[1] == '=') Token.Type = TOKEN_LOGIC_NOT_EQUAL;
-            else { Token.Type = TOKEN_LOGIC_NOT; Token.Length = 1; }
+// Tokens stored as a structure of arrays. Offsets are relative to 'Base', i.e the position of the
+// tokenizer when TokenizeAll was called. The last token is always TOKEN_EOS.
+struct token_buffer {
+    int Count = 0;
+    int Capacity = 0;
 
-        } break;
-        case '%':
-        {
-            ++Token.Length;
-            if (c[1] && c[1] == '=') Token.Type = TOKEN_MOD_EQUAL;
-            else { Token.Type = TOKEN_MOD; Token.Length = 1; }
+    unsigned char* Types = 0;       // token_type
+    int* Offsets = 0;
+    int* Lengths = 0;
+    token_value* Values = 0;        // Only set for numbers, chars, identifiers, keywords and operators, 0 otherwise
+    int* Lines = 0;
 
-        } break;
-        case '!':
-        {
-            ++Token.Length;
-            if (c[1] && c[1] == '=') Token.Type = TOKEN_NOT_EQUAL;
-            else { Token.Type = TOKEN_NOT; Token.Length = 1; }
+    char* Base = 0;
 
-        } break;
+    // If set, the arrays come from here and TokenizeAll never calls TOKENIZER_MALLOC.
+    tokenizer_arena* Arena = 0;
 
+    // Set when the arrays point into a cache file loaded by TokenizeAllCached. They are copy-on-write,
+    // and copied to the heap if the buffer has to grow.
+    void* Mapping = 0;
+    size_t MappingSize = 0;
 
-        case '"':
-        {
-            char* Start = c;
-            ++c;
+    // Left by TokenizeEdit: the last 'Tail' tokens are kept at the end of the arrays, past the free
+    // capacity, and 'TailOffset' and 'TailLine' are still to be added to their offsets and lines.
+    int Tail = 0;
+    int TailOffset = 0;
+    int TailLine = 0;
 
-            Token.Type = TOKEN_STRING;
-            Token.Text = Start;
+    // Statistics of the last TokenizeAll call.
+    double Seconds = 0;
+    long long int Bytes = 0;
+};
 
-            while (*c && *c != '"') {
-                if (c[1] && c[1] == '\\') {
-                    ++c;
-                }
-                ++c;
-            }
+TOKENIZER_DEF void InitTokenBuffer(token_buffer* Buffer, tokenizer_arena* Arena);
+TOKENIZER_DEF void FreeTokenBuffer(token_buffer* Buffer);
 
-            if (*c && *c == '"') {
-                ++c;
-            }
+// Lexes everything from the current position to the end of the data. Returns false on error,
+// or if the arena ran out of memory (the buffer then contains the tokens lexed so far).
+TOKENIZER_DEF bool TokenizeAll(tokenizer* Tokenizer, token_buffer* Buffer);
 
-            Token.Length = c - Start;
+// Updates 'Buffer', filled by TokenizeAll, after 'RemovedLength' bytes at 'Offset' were replaced by
+// 'InsertedLength' new ones. The tokenizer must be set up as it was for TokenizeAll, but on the edited
+// data. Only the tokens around the edit are lexed again. The ones after it don't move: they stay at
+// the end of the arrays, and their shift is kept aside (see token_buffer::Tail), so an edit costs the
+// tokens lexed again plus the ones between it and the previous edit.
+// 'FirstChanged' and 'ChangedCount' receive the range of tokens that were replaced.
+// Arena-backed buffers can't grow: the call fails if the edit needs more tokens than their capacity.
+TOKENIZER_DEF bool TokenizeEdit(tokenizer* Tokenizer, token_buffer* Buffer, int Offset, int RemovedLength, int InsertedLength,
+                                int* FirstChanged = 0, int* ChangedCount = 0);
 
-        } break;
-        case '.':
-        {
-            // Fallthrough as we could parse either a number or a string
-            ++c;
-        }
+// After TokenizeEdit, the arrays of the buffer are only right through GetBufferToken and GetBufferLine.
+// This puts the tokens back in order, with their offsets and lines up to date, for reading the arrays.
+TOKENIZER_DEF void FlushTokenEdits(token_buffer* Buffer);
 
-        default:
-        {
-            if (IS_LETTER(*c) || *c == '_') {
+// Like TokenizeAll, but the tokens are loaded from the file at 'CachePath' if it was written for the
+// same data, starting line and settings (interner or not, operators, TOKENIZER_KEYWORDS). Otherwise
+// the data is lexed and the cache file written, through a temporary file that is then renamed, so
+// concurrent runs never see half a file. Identifiers get their atoms from the tokenizer's interner, the
+// same ones lexing would have given them. 'Hit' tells whether the cache file was used.
+TOKENIZER_DEF bool TokenizeAllCached(tokenizer* Tokenizer, token_buffer* Buffer, const char* CachePath, bool* Hit = 0);
 
-                Token.Type = TOKEN_IDENT;
+// 8 bytes per token instead of sizeof(token), for keeping millions of tokens around. The value of
+// numbers, chars, keywords, operators and interned identifiers, and lengths that don't fit in 16 bits, are kept in a
+// side table ordered by token index.
+struct packed_token {
+    unsigned int Offset;        // From the buffer's 'Base'
+    unsigned short Length;      // TK_PACKED_LONG: in the side table
+    unsigned short Type;        // token_type
+};
 
-                while (IS_LETTER(*c) || IS_DIGIT(*c) || *c == '_') {
-                    ++c;
-                }
-                Token.Length = c - Token.Text;
+static_assert(sizeof(packed_token) == 8, "packed_token must stay 8 bytes");
 
-            } else if (IS_DIGIT(*c) || *c == '.') {
+struct packed_token_extra {
+    int Token;                  // Index of the token
+    int Length;
+    token_value Value;
+};
 
-                while (IS_DIGIT(*c) || *c == '.' || IS_SUFFIX(*c)) {
-                    ++c;
-                }
+struct packed_token_buffer {
+    int Count = 0;
+    int Capacity = 0;
+    packed_token* Tokens = 0;
 
-                Token.Length = c - Token.Text;
+    int ExtraCount = 0;
+    int ExtraCapacity = 0;
+    packed_token_extra* Extras = 0;
 
-                if (FindChar(Token.Text, Token.Length, '.') ||
-                    FindChar(Token.Text, Token.Length, 'f'))
-                {
-                    Token.Type = TOKEN_FLOAT;
-                    Token.Float = strtod(Token.Text, &c);
-                }
-                else {
+    char* Base = 0;
+};
 
-                    bool IsHex = false;
+TOKENIZER_DEF void InitPackedTokenBuffer(packed_token_buffer* Buffer, char* Base);
+TOKENIZER_DEF void FreePackedTokenBuffer(packed_token_buffer* Buffer);
 
-                    for (int i = 0; i < Token.Length; ++i) {
-                        if (IS_HEX(Token.Text[i])) {
-                            IsHex = true;
-                            break;
-                        }
-                    }
+// Appends a token, which must lie within 4GB after 'Base'. Returns false when out of memory.
+TOKENIZER_DEF bool PackToken(packed_token_buffer* Buffer, token* Token);
+TOKENIZER_DEF token UnpackToken(packed_token_buffer* Buffer, int Index);
 
-                    Token.Type = TOKEN_INTEGER;
-                    Token.Int = strtoll(Token.Text, &c, IsHex ? 16 : 10);
+// Like TokenizeAll, into packed tokens. Use GetTokenLocation for lines.
+TOKENIZER_DEF bool TokenizeAllPacked(tokenizer* Tokenizer, packed_token_buffer* Buffer);
+
+#ifdef TOKENIZER_PARALLEL
+// Same result as TokenizeAll, but the data is split in chunks of about 'ChunkSize' bytes (default 1MB)
+// that are lexed on 'ThreadCount' threads (default: one per core). Each chunk is lexed assuming it
+// doesn't start inside a string or a comment, the chunks that guessed wrong are then fixed up.
+TOKENIZER_DEF bool TokenizeAllParallel(tokenizer* Tokenizer, token_buffer* Buffer, int ThreadCount = 0, int ChunkSize = 0);
+
+// A file for TokenizeBatch: 'Data', '\0'-terminated or 'Size' bytes long, or if there is none, the
+// file at 'Path', which is mapped. 'Path' is also the filename of the tokenizer.
+struct tokenizer_batch_file {
+    const char* Path = 0;
+    char* Data = 0;
+    size_t Size = 0;
+
+    // Set by TokenizeBatch. The tokens point into the tokenizer's data, and their arrays belong to
+    // the batch: they are released by FreeBatch, not FreeTokenBuffer.
+    tokenizer Tokenizer;
+    token_buffer Tokens;
+    int Shard = -1;             // With 'Intern' and no 'Interner', the atoms are from Workers[Shard].Shard
+    bool Error = false;         // The file couldn't be mapped, or memory ran out
+};
+
+// A thread of TokenizeBatch, with the memory it keeps for the results and what it did.
+struct tokenizer_batch_worker {
+    tokenizer_interner Shard;
+
+    // The token arrays of the files it finished, in blocks chained through their first bytes.
+    tokenizer_arena Arena;
+    char* Blocks = 0;
+
+    int Files = 0;
+    int Chunks = 0;             // Of files split between workers
+    int Steals = 0;             // Tasks taken from other workers
+    long long int Bytes = 0;
+    double Seconds = 0;         // Busy, waiting for work excluded
+};
+
+struct tokenizer_batch {
+    tokenizer_batch_file* Files = 0;
+    int FileCount = 0;
+
+    tokenizer_operators* Operators = 0;
+
+    // Give identifiers atoms. Each worker interns into its own shard, so atoms are only comparable
+    // within a shard, unless there is an interner: the shards are then merged into it at the end.
+    bool Intern = false;
+    tokenizer_interner* Interner = 0;
+
+    int ThreadCount = 0;        // Default: one per core
+    int ChunkSize = 0;          // Files of two chunks or more are split like in TokenizeAllParallel (default 1MB)
+    size_t BlockSize = 0;       // Of the worker arenas (default 64MB, bigger for bigger files)
+
+    // Set by TokenizeBatch.
+    tokenizer_batch_worker* Workers = 0;
+    int WorkerCount = 0;
+    int FailedCount = 0;
+    long long int Bytes = 0;
+    long long int TokenCount = 0;
+    double Seconds = 0;
+};
+
+// Lexes all the files on a pool of 'ThreadCount' threads. Files are dealt out to the workers, which
+// take work from each other once they run out, and big files are split in chunks so that they don't
+// end up being lexed by one thread while the others wait. Returns false if a file failed.
+TOKENIZER_DEF bool TokenizeBatch(tokenizer_batch* Batch);
+
+// Releases the tokens, the shards and the tokenizers (and their mappings) of the files.
+TOKENIZER_DEF void FreeBatch(tokenizer_batch* Batch);
+#endif
+
+TOKENIZER_DEF token GetBufferToken(token_buffer* Buffer, int Index);
+TOKENIZER_DEF int GetBufferLine(token_buffer* Buffer, int Index);
+
+
+// Lexer features that can be turned off at compile time, see basic_tokenizer. The free functions lex
+// with this one: derive from it and hide the members to change.
+struct tokenizer_policy {
+    static constexpr bool CountLines = true;        // Off: 'Line' is never updated, whatever 'Tokenizer.CountLines' says
+    static constexpr bool LineComments = true;      // // ...
+    static constexpr bool BlockComments = true;     // /* ... */
+    static constexpr bool HashComments = false;     // # ... up to the end of the line, instead of TOKEN_HASHTAG
+    static constexpr bool ConvertNumbers = true;    // Off: numbers and chars are only delimited, their value is 0
+    static constexpr bool Escapes = true;           // Off: a '\' in a string or a char is a character like the others
+    static constexpr bool Utf8 = true;              // Identifiers can have non-ASCII letters. Off: bytes >= 0x80 are TOKEN_UNKNOWN
+
+    // Returns the TOKEN_KEYWORD index of an identifier, -1 if it's not a keyword. This one looks in
+    // TOKENIZER_KEYWORDS, if defined.
+    static int FindKeyword(const char* Text, int Length);
+};
+
+// A tokenizer with a lexer compiled for 'Policy', so the features turned off cost nothing. It is a
+// tokenizer and the other functions take it, but only these members and TokenRange use 'Policy':
+// GetToken(&Tokenizer), Synchronize and every other free function lex with tokenizer_policy. The
+// members are defined with the implementation, so use them in the file that defines
+// TOKENIZER_IMPLEMENTATION, or instantiate them there with 'template struct basic_tokenizer<my_policy>;'.
+template <typename Policy = tokenizer_policy>
+struct basic_tokenizer : tokenizer {
+    token GetToken();
+    token PeekToken(int Ahead = 0);
+    bool OptionalToken(token_type Type, token* Optional = 0);
+    bool RequireToken(token_type Type, token* Required = 0);
+    bool TokenizeAll(token_buffer* Buffer);
+};
+
+#ifdef TOKENIZER_RANGES
+// A token as yielded by TokenRange: the same, with the text as a string_view.
+struct token_view {
+    token_type Type = TOKEN_UNKNOWN;
+    std::string_view Text;
+
+    union {
+        double Float;
+        long long int Int;
+        unsigned int Atom;
+        int Keyword;
+        int Operator;
+    };
+};
+
+// Reads the tokens with GetToken. A token is only lexed when the iterator is dereferenced or compared,
+// so views that stop early (std::views::take) don't consume one more. Equal to the sentinel at
+// TOKEN_EOS, or if the tokenizer has an error before a token.
+template <typename Policy = tokenizer_policy>
+struct basic_token_iterator {
+    using iterator_concept = std::input_iterator_tag;
+    using value_type = token_view;
+    using difference_type = std::ptrdiff_t;
+
+    tokenizer* Tokenizer = 0;
+    mutable token_view Token;
+    mutable bool Lexed = false;
+
+    const token_view& operator*() const { return Lex(); }
+    const token_view* operator->() const { return &Lex(); }
+
+    basic_token_iterator& operator++() { Lex(); Lexed = false; return *this; }
+    void operator++(int) { ++*this; }
+
+    bool operator==(std::default_sentinel_t) const { return Lex().Type == TOKEN_EOS; }
+
+    const token_view& Lex() const;
+};
+
+// A single-pass view of the tokens left in a tokenizer. Its members are defined with the
+// implementation, like those of basic_tokenizer.
+template <typename Policy = tokenizer_policy>
+struct basic_token_range : std::ranges::view_interface<basic_token_range<Policy>> {
+    tokenizer* Tokenizer = 0;
+
+    basic_token_iterator<Policy> begin() const;
+    std::default_sentinel_t end() const { return std::default_sentinel; }
+};
+
+// The iterators only point to the tokenizer, so they stay valid after the range is gone: algorithms
+// called on a TokenRange(...) temporary return them instead of std::ranges::dangling.
+template <typename Policy>
+inline constexpr bool std::ranges::enable_borrowed_range<basic_token_range<Policy>> = true;
+
+typedef basic_token_range<tokenizer_policy> token_range;
+
+inline token_range TokenRange(tokenizer* Tokenizer) {
+    token_range Range;
+    Range.Tokenizer = Tokenizer;
+    return Range;
+}
+
+template <typename Policy>
+inline basic_token_range<Policy> TokenRange(basic_tokenizer<Policy>* Tokenizer) {
+    basic_token_range<Policy> Range;
+    Range.Tokenizer = Tokenizer;
+    return Range;
+}
+#endif
+
+TOKENIZER_DEF double GetTokensPerSecond(token_buffer* Buffer);
+TOKENIZER_DEF double GetBytesPerToken(token_buffer* Buffer);
+
+
+// Fills 'Buffer' with up to 'Size' bytes of input. Returns the number of bytes read, 0 at the end.
+typedef int tokenizer_read_func(void* User, char* Buffer, int Size);
+
+// Lexes an input of any size through a fixed window, refilled by a read callback. Comments may be
+// longer than the window, a single token may not (the stream fails with an error).
+struct tokenizer_stream {
+    tokenizer Tokenizer;
+
+    tokenizer_read_func* Read = 0;
+    void* User = 0;
+
+    char* Window = 0;
+    int WindowSize = 0;
+    bool OwnsWindow = false;
+
+    char* End = 0;              // End of the data in the window, always followed by a '\0'
+    bool Eof = false;
+
+    long long int Base = 0;     // Offset in the input of the first byte of the window
+    int Comment = 0;            // The comment the window ended in, if any
+};
+
+// Uses 'Window' as the buffer if provided (it needs 'WindowSize' + 1 bytes), allocates one otherwise.
+// The default window size is 64KB.
+TOKENIZER_DEF bool InitTokenizerStream(tokenizer_stream* Stream, tokenizer_read_func* Read, void* User,
+                                       int WindowSize = 0, char* Window = 0, const char* Filename = 0);
+
+// The token text is only valid until the next call. Its offset in the input is
+// Stream->Base + (Token.Text - Stream->Window).
+TOKENIZER_DEF token GetStreamToken(tokenizer_stream* Stream);
+
+TOKENIZER_DEF void FreeTokenizerStream(tokenizer_stream* Stream);
+
+#ifdef TOKENIZER_PREPROCESSOR
+struct preprocessor_location {
+    int Source;                 // Index in the preprocessor's 'Sources', -1 for the text given to DefineMacro
+    int Line;
+};
+
+struct preprocessed_token {
+    token Token;
+
+    preprocessor_location Location;     // Where the token is written: in a file, a macro body or a macro argument
+    preprocessor_location Expansion;    // Where the outermost macro it comes from is used, 'Location' if none
+
+    bool Space;                 // Preceded by whitespace or a comment, or first in its file
+    bool NoExpand;              // Names a macro that was being expanded, it won't ever be expanded
+};
+
+// A line starting with '#'.
+struct preprocessor_directive {
+    int Token;                  // Index of the '#'
+    int End;                    // Index of the first token after the line (and its continuations)
+    int Kind;
+    int Next;                   // For conditionals, the directive of the next #elif, #else or #endif of the same #if
+};
+
+// A file as lexed by the preprocessor, once for all the times it is included.
+struct preprocessor_source {
+    const char* Path = 0;
+    tokenizer Tokenizer;        // Owns the data. GetTokenLocation(&Source->Tokenizer, Token) gives columns.
+    token_buffer Tokens;
+
+    preprocessor_directive* Directives = 0;
+    int DirectiveCount = 0;
+
+    unsigned int Guard = 0;     // Atom of the include guard, if the whole file is inside #ifndef Guard ... #endif
+    bool Once = false;          // Has #pragma once
+    bool Entered = false;       // Already included by the current file
+};
+
+struct preprocessor_macro {
+    unsigned int Name;
+    int ParameterCount;         // -1 for object-like macros
+    bool Variadic;              // The last parameter is __VA_ARGS__
+    bool Disabled;              // Being expanded
+    int Builtin;                // __LINE__ or __FILE__, 0 otherwise
+    int First;                  // Body, in the preprocessor's 'Bodies'
+    int Count;
+};
+
+struct preprocessor_macro_token {
+    preprocessed_token Token;
+    int Parameter;              // -1 if the token isn't a parameter
+    bool Stringize;             // #Parameter
+    bool Paste;                 // Followed by ##
+    bool Expand;                // A parameter replaced by its expanded argument
+};
+
+// Tokens being read back: a macro expansion, an argument, or a token that was looked at too early.
+struct preprocessor_context {
+    preprocessed_token* Tokens;
+    int Count;
+    int Capacity;
+    int At;
+    int Macro;                  // Enabled again once the context is done, -1 if none
+};
+
+struct preprocessor_file {
+    int Source;
+    int At;                     // Next token
+    int Directive;              // Next directive
+    int IncludePath;            // The include path it was found in, -1 if none (for #include_next)
+};
+
+// Expands macros, skips the dead branches of conditionals and follows includes. Every file is lexed
+// once with TokenizeAll, and its directives are indexed: skipping a branch jumps from one directive of
+// its #if to the next without looking at the tokens in between. A header whose contents are all inside
+// an include guard, or that has #pragma once, is skipped at the #include when it would be empty.
+struct tokenizer_preprocessor {
+    // Identifiers, macro names and paths all get their atom from here, so finding the macro of a
+    // TOKEN_IDENT is indexing an array with its atom.
+    tokenizer_interner Interner;
+
+    // If set, sources are lexed with these operators.
+    tokenizer_operators* Operators = 0;
+
+    // Every file read so far, in the order they were first included.
+    preprocessor_source* Sources = 0;
+    int SourceCount = 0;
+    int SourceCapacity = 0;
+
+    const char** IncludePaths = 0;
+    int IncludePathCount = 0;
+    int IncludePathCapacity = 0;
+
+    bool Error = false;
+
+    preprocessor_macro* Macros = 0;
+    int MacroCount = 0;
+    int MacroCapacity = 0;
+
+    preprocessor_macro_token* Bodies = 0;
+    int BodyCount = 0;
+    int BodyCapacity = 0;
+
+    // Indexed by atom: the macro and the source with that name, -1 if none (-2 for files known to be missing).
+    int* AtomMacros = 0;
+    int* AtomSources = 0;
+    int AtomCapacity = 0;
+
+    unsigned int* KeywordAtoms = 0;     // Indexed by 'Token.Keyword', 0 until a keyword is looked up as a macro
+    int KeywordCapacity = 0;
+
+    preprocessor_file* Files = 0;       // Include stack, the file given to PreprocessFile first
+    int FileCount = 0;
+    int FileCapacity = 0;
+
+    preprocessor_context* Contexts = 0;
+    int Depth = 0;
+    int ContextCapacity = 0;
+
+    // Scratch space for macro arguments and directive lines, used as stacks.
+    preprocessed_token* Stack = 0;
+    int StackCount = 0;
+    int StackCapacity = 0;
+
+    int* Bounds = 0;
+    int BoundCount = 0;
+    int BoundCapacity = 0;
+
+    char* Text = 0;                     // For building paths, stringized and pasted tokens
+    int TextCapacity = 0;
+};
+
+TOKENIZER_DEF void InitPreprocessor(tokenizer_preprocessor* Preprocessor);
+TOKENIZER_DEF void FreePreprocessor(tokenizer_preprocessor* Preprocessor);
+
+// Directories searched by #include, in order, after the directory of the including file for "file".
+TOKENIZER_DEF bool AddIncludePath(tokenizer_preprocessor* Preprocessor, const char* Path);
+
+// Gives the contents of a file that isn't on disk, or whose unsaved contents should be used instead.
+// 'Data' must remain valid while the preprocessor is in use. Returns false if 'Path' was read already.
+TOKENIZER_DEF bool AddPreprocessorFile(tokenizer_preprocessor* Preprocessor, const char* Path, char* Data);
+
+// Defines a macro like #define does, e.g "MAX(a, b) ((a) > (b) ? (a) : (b))" or "NDEBUG".
+TOKENIZER_DEF bool DefineMacro(tokenizer_preprocessor* Preprocessor, const char* Definition);
+TOKENIZER_DEF void UndefineMacro(tokenizer_preprocessor* Preprocessor, const char* Name);
+
+// Undefines all macros. The lexed files are kept.
+TOKENIZER_DEF void ClearMacros(tokenizer_preprocessor* Preprocessor);
+
+// Starts preprocessing the given file. The preprocessor can be used for several files in a row: macros
+// stay defined (see ClearMacros) and files already lexed aren't lexed again.
+TOKENIZER_DEF bool PreprocessFile(tokenizer_preprocessor* Preprocessor, const char* Path);
+
+// Returns TOKEN_EOS at the end of the file, or after an error.
+TOKENIZER_DEF preprocessed_token GetPreprocessedToken(tokenizer_preprocessor* Preprocessor);
+#endif
+
+#ifdef TOKENIZER_BENCHMARK
+// Mixes of generated C-like text, each dominated by one kind of token.
+enum tokenizer_corpus {
+    CORPUS_IDENT,
+    CORPUS_NUMBER,
+    CORPUS_COMMENT,
+    CORPUS_STRING,
+    CORPUS_OPERATOR,
+    CORPUS_COUNT
+};
+
+// Fills 'Data' with 'Size' - 1 bytes of text followed by a '\0'. The same kind, size and seed always
+// give the same text. The text lexes without errors.
+TOKENIZER_DEF void GenerateCorpus(char* Data, size_t Size, tokenizer_corpus Kind, unsigned long long Seed = 1);
+
+// Runs the benchmarks selected by the command line (see the top of this file). Returns 0 on success.
+TOKENIZER_DEF int RunTokenizerBenchmarks(int ArgCount, char** Args);
+#endif
+
+#ifdef TOKENIZER_FUZZ
+// Lexes 'Data' with every backend: the switch and DFA engines, bounded and '\0'-terminated data, with
+// and without line counting, interning and extra operators, PeekToken, TokenizeAll, TokenizeAllPacked, TokenizeEdit,
+// the stream and the parallel tokenizer. All of them must give the same tokens, values and lines as a
+// byte-at-a-time reference lexer. The bytes are also used as a recipe for C-like text, checked the
+// same way. Prints the first difference to stderr and returns false.
+TOKENIZER_DEF bool FuzzTokenizer(const unsigned char* Data, size_t Size);
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char* Data, size_t Size);
+#endif
+
+
+#ifdef TOKENIZER_IMPLEMENTATION
+
+#include <assert.h>
+#include <chrono>
+#include <locale.h> // For strtod_l
+#include <math.h> // For NAN
+#include <stdio.h> // For the token cache files
+
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef TOKENIZER_PARALLEL
+#include <atomic>
+#include <mutex>
+#include <thread>
+#endif
+
+#ifndef TOKENIZER_MALLOC
+#define TOKENIZER_MALLOC(Size) malloc(Size)
+#endif
+
+#ifndef TOKENIZER_REALLOC
+#define TOKENIZER_REALLOC(Ptr, Size) realloc(Ptr, Size)
+#endif
+
+#ifndef TOKENIZER_FREE
+#define TOKENIZER_FREE(Ptr) free(Ptr)
+#endif
+
+static const char* TokenTypes[TOKEN_TYPE_COUNT]{
+    "TOKEN_UNKNOWN",
+    "TOKEN_IDENT",
+    "TOKEN_KEYWORD",
+    "TOKEN_OPEN_PAREN",           // (
+    "TOKEN_CLOSE_PAREN",          // )
+    "TOKEN_COLON",                // :
+    "TOKEN_COLON_COLON",          // ::
+    "TOKEN_STRING",
+    "TOKEN_CHAR",
+    "TOKEN_INTEGER",
+    "TOKEN_FLOAT",
+    "TOKEN_SEMICOLON",            // ;
+    "TOKEN_COMMA",                // ,
+    "TOKEN_ASTERISK",             // *
+    "TOKEN_MUL_EQUAL",            // *=
+    "TOKEN_HASHTAG",              // #
+    "TOKEN_AND",                  // &
+    "TOKEN_AND_AND",              // &&
+    "TOKEN_AND_EQUAL",            // &=
+    "TOKEN_OR",                   // |
+    "TOKEN_OR_OR",                // ||
+    "TOKEN_OR_EQUAL",             // |=
+    "TOKEN_XOR",                  // ^
+    "TOKEN_XOR_EQUAL",            // ^=
+    "TOKEN_OPEN_BRACKET",         // [
+    "TOKEN_CLOSE_BRACKET",        // ]
+    "TOKEN_OPEN_BRACE",           // {
+    "TOKEN_CLOSE_BRACE",          // }
+    "TOKEN_OPEN_ANG_BRACKET",     // <
+    "TOKEN_CLOSE_ANG_BRACKET",    // >
+    "TOKEN_RIGHT_SHIFT",          // >>
+    "TOKEN_RIGHT_SHIFT_EQUAL",    // >>=
+    "TOKEN_LEFT_SHIFT",           // <<
+    "TOKEN_LEFT_SHIFT_EQUAL",     // <<=
+    "TOKEN_GREATER_EQUAL",        // >=
+    "TOKEN_LESS_EQUAL",           // <=
+    "TOKEN_PLUS",                 // +
+    "TOKEN_MINUS",                // -
+    "TOKEN_EQUAL",                // =
+    "TOKEN_EQUAL_EQUAL",          // ==
+    "TOKEN_PLUS_PLUS",            // ++
+    "TOKEN_PLUS_EQUAL",           // +=
+    "TOKEN_MINUS_MINUS",          // --
+    "TOKEN_MINUS_EQUAL",          // -=
+    "TOKEN_ARROW",                // ->
+    "TOKEN_DOLLAR_SIGN",          // $
+    "TOKEN_FORWARD_SLASH",        // /
+    "TOKEN_BACKSLASH",            // '\'
+    "TOKEN_DIV_EQUAL",            // /=
+    "TOKEN_MOD",                  // %
+    "TOKEN_MOD_EQUAL",            // %=
+    "TOKEN_NOT",                  // !
+    "TOKEN_NOT_EQUAL",            // !=
+    "TOKEN_LOGIC_NOT",            // ~
+    "TOKEN_LOGIC_NOT_EQUAL",      // ~=
+    "TOKEN_OPERATOR",
+    "TOKEN_EOS",                  // \0
+};
+
+
+#define IS_WHITE(c)  ( (c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n' || (c) == '\f' )
+#define IS_LETTER(c) ( ((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') )
+#define IS_DIGIT(c)  ( (c) >= '0' && (c) <= '9' )
+#define IS_HEX(c)    ( IS_DIGIT(c) || ((c) >= 'a' && (c) <= 'f') || ((c) >= 'A' && (c) <= 'F') )
+
+
+// The SIMD path is picked at compile time: AVX2 if the compiler targets it, SSE2 otherwise (always there on x64).
+#if defined(__SANITIZE_ADDRESS__)
+#define TOKENIZER_NO_SIMD
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define TOKENIZER_NO_SIMD
+#endif
+#endif
+
+#ifndef TOKENIZER_NO_SIMD
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TOKENIZER_SIMD_WIDTH 32
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TOKENIZER_SIMD_WIDTH 16
+#endif
+#endif
+
+#ifdef TOKENIZER_SIMD_WIDTH
+
+#if TOKENIZER_SIMD_WIDTH == 32
+typedef __m256i tk_vec;
+#define TK_LOAD(p)       _mm256_load_si256((const __m256i*)(p))
+#define TK_SPLAT(c)      _mm256_set1_epi8(c)
+#define TK_MATCH(v, s)   ((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8((v), (s))))
+#define TK_HIGH_BITS(v)  ((unsigned int)_mm256_movemask_epi8(v))
+#define TK_FULL_MASK     0xFFFFFFFFu
+#else
+typedef __m128i tk_vec;
+#define TK_LOAD(p)       _mm_load_si128((const __m128i*)(p))
+#define TK_SPLAT(c)      _mm_set1_epi8(c)
+#define TK_MATCH(v, s)   ((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8((v), (s))))
+#define TK_HIGH_BITS(v)  ((unsigned int)_mm_movemask_epi8(v))
+#define TK_FULL_MASK     0xFFFFu
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline int TkCountBits(unsigned int Mask) { return (int)__popcnt(Mask); }
+static inline int TkFirstBit(unsigned int Mask) { unsigned long Index; _BitScanForward(&Index, Mask); return (int)Index; }
+#else
+static inline int TkCountBits(unsigned int Mask) { return __builtin_popcount(Mask); }
+static inline int TkFirstBit(unsigned int Mask) { return __builtin_ctz(Mask); }
+#endif
+
+// Returns the aligned block containing 'c', and in 'Valid' the mask of the bytes at or after 'c'.
+static inline char* TkAlignBlock(char* c, unsigned int* Valid) {
+    char* Block = (char*)((size_t)c & ~(size_t)(TOKENIZER_SIMD_WIDTH - 1));
+    *Valid = (TK_FULL_MASK << (c - Block)) & TK_FULL_MASK;
+    return Block;
+}
+
+#endif // TOKENIZER_SIMD_WIDTH
+
+// Most newlines IndexNewLines can find in one step.
+#ifdef TOKENIZER_SIMD_WIDTH
+#define TK_NEWLINES_PER_STEP (64 * TOKENIZER_SIMD_WIDTH)
+#else
+#define TK_NEWLINES_PER_STEP 1
+#endif
+
+// Number literals are converted 8 digits at a time with plain 64-bit arithmetic (little-endian only).
+#if !defined(TOKENIZER_NO_SIMD) && (defined(_WIN32) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__))
+#define TOKENIZER_SWAR
+#endif
+
+
+// The lexer reads the data through TkChar. With 'Bounded' set the data stops at 'End' (or at the first
+// '\0'), everything past it reads as the terminator. Otherwise only the '\0' counts and 'End' is ignored.
+template <bool Bounded>
+static inline char TkChar(const char* c, const char* End) {
+    return (!Bounded || c < End) ? *c : '\0';
+}
+
+#define TK_PEEK(i) TkChar<Bounded>(c + (i), End)
+
+// Length of the UTF-8 sequence at 'c', with its code point in 'CodePoint'. 0 if it's malformed: not a
+// lead byte, overlong, a surrogate, past 0x10FFFF, or cut short by the end of the data.
+template <bool Bounded>
+static inline int TkDecodeUtf8(const char* c, const char* End, unsigned int* CodePoint) {
+    unsigned char Lead = (unsigned char)TK_PEEK(0);
+    unsigned int Min;
+    int Length;
+
+    if (Lead < 0xC2 || Lead > 0xF4) return 0;
+    else if (Lead < 0xE0) { Length = 2; Min = 0x80;    *CodePoint = Lead & 0x1F; }
+    else if (Lead < 0xF0) { Length = 3; Min = 0x800;   *CodePoint = Lead & 0x0F; }
+    else                  { Length = 4; Min = 0x10000; *CodePoint = Lead & 0x07; }
+
+    for (int i = 1; i < Length; ++i) {
+        unsigned char Ch = (unsigned char)TK_PEEK(i);
+        if ((Ch & 0xC0) != 0x80) return 0;
+        *CodePoint = (*CodePoint << 6) | (Ch & 0x3F);
+    }
+
+    if (*CodePoint < Min || *CodePoint > 0x10FFFF || (*CodePoint >= 0xD800 && *CodePoint <= 0xDFFF)) {
+        return 0;
+    }
+
+    return Length;
+}
+
+#define TK_XID_CONTINUE 1
+#define TK_XID_START 3
+
+// The code points from 0x80 on where XID_Start and XID_Continue change (Unicode 14.0), each stored as
+// (CodePoint << 2) | Class: 0 for neither, TK_XID_CONTINUE, or TK_XID_START (which implies continue).
+static const unsigned int TkXidRanges[] = {
+    0x0000200, 0x00002AB, 0x00002AC, 0x00002D7, 0x00002D8, 0x00002DD, 0x00002E0, 0x00002EB, 0x00002EC,
+    0x0000303, 0x000035C, 0x0000363, 0x00003DC, 0x00003E3, 0x0000B08, 0x0000B1B, 0x0000B48, 0x0000B83,
+    0x0000B94, 0x0000BB3, 0x0000BB4, 0x0000BBB, 0x0000BBC, 0x0000C01, 0x0000DC3, 0x0000DD4, 0x0000DDB,
+    0x0000DE0, 0x0000DEF, 0x0000DF8, 0x0000DFF, 0x0000E00, 0x0000E1B, 0x0000E1D, 0x0000E23, 0x0000E2C,
+    0x0000E33, 0x0000E34, 0x0000E3B, 0x0000E88, 0x0000E8F, 0x0000FD8, 0x0000FDF, 0x0001208, 0x000120D,
+    0x0001220, 0x000122B, 0x00014C0, 0x00014C7, 0x000155C, 0x0001567, 0x0001568, 0x0001583, 0x0001624,
+    0x0001645, 0x00016F8, 0x00016FD, 0x0001700, 0x0001705, 0x000170C, 0x0001711, 0x0001718, 0x000171D,
+    0x0001720, 0x0001743, 0x00017AC, 0x00017BF, 0x00017CC, 0x0001841, 0x000186C, 0x0001883, 0x000192D,
+    0x00019A8, 0x00019BB, 0x00019C1, 0x00019C7, 0x0001B50, 0x0001B57, 0x0001B59, 0x0001B74, 0x0001B7D,
+    0x0001B97, 0x0001B9D, 0x0001BA4, 0x0001BA9, 0x0001BBB, 0x0001BC1, 0x0001BEB, 0x0001BF4, 0x0001BFF,
+    0x0001C00, 0x0001C43, 0x0001C45, 0x0001C4B, 0x0001CC1, 0x0001D2C, 0x0001D37, 0x0001E99, 0x0001EC7,
+    0x0001EC8, 0x0001F01, 0x0001F2B, 0x0001FAD, 0x0001FD3, 0x0001FD8, 0x0001FEB, 0x0001FEC, 0x0001FF5,
+    0x0001FF8, 0x0002003, 0x0002059, 0x000206B, 0x000206D, 0x0002093, 0x0002095, 0x00020A3, 0x00020A5,
+    0x00020B8, 0x0002103, 0x0002165, 0x0002170, 0x0002183, 0x00021AC, 0x00021C3, 0x0002220, 0x0002227,
+    0x000223C, 0x0002261, 0x0002283, 0x0002329, 0x0002388, 0x000238D, 0x0002413, 0x00024E9, 0x00024F7,
+    0x00024F9, 0x0002543, 0x0002545, 0x0002563, 0x0002589, 0x0002590, 0x0002599, 0x00025C0, 0x00025C7,
+    0x0002605, 0x0002610, 0x0002617, 0x0002634, 0x000263F, 0x0002644, 0x000264F, 0x00026A4, 0x00026AB,
+    0x00026C4, 0x00026CB, 0x00026CC, 0x00026DB, 0x00026E8, 0x00026F1, 0x00026F7, 0x00026F9, 0x0002714,
+    0x000271D, 0x0002724, 0x000272D, 0x000273B, 0x000273C, 0x000275D, 0x0002760, 0x0002773, 0x0002778,
+    0x000277F, 0x0002789, 0x0002790, 0x0002799, 0x00027C3, 0x00027C8, 0x00027F3, 0x00027F4, 0x00027F9,
+    0x00027FC, 0x0002805, 0x0002810, 0x0002817, 0x000282C, 0x000283F, 0x0002844, 0x000284F, 0x00028A4,
+    0x00028AB, 0x00028C4, 0x00028CB, 0x00028D0, 0x00028D7, 0x00028DC, 0x00028E3, 0x00028E8, 0x00028F1,
+    0x00028F4, 0x00028F9, 0x000290C, 0x000291D, 0x0002924, 0x000292D, 0x0002938, 0x0002945, 0x0002948,
+    0x0002967, 0x0002974, 0x000297B, 0x000297C, 0x0002999, 0x00029CB, 0x00029D5, 0x00029D8, 0x0002A05,
+    0x0002A10, 0x0002A17, 0x0002A38, 0x0002A3F, 0x0002A48, 0x0002A4F, 0x0002AA4, 0x0002AAB, 0x0002AC4,
+    0x0002ACB, 0x0002AD0, 0x0002AD7, 0x0002AE8, 0x0002AF1, 0x0002AF7, 0x0002AF9, 0x0002B18, 0x0002B1D,
+    0x0002B28, 0x0002B2D, 0x0002B38, 0x0002B43, 0x0002B44, 0x0002B83, 0x0002B89, 0x0002B90, 0x0002B99,
+    0x0002BC0, 0x0002BE7, 0x0002BE9, 0x0002C00, 0x0002C05, 0x0002C10, 0x0002C17, 0x0002C34, 0x0002C3F,
+    0x0002C44, 0x0002C4F, 0x0002CA4, 0x0002CAB, 0x0002CC4, 0x0002CCB, 0x0002CD0, 0x0002CD7, 0x0002CE8,
+    0x0002CF1, 0x0002CF7, 0x0002CF9, 0x0002D14, 0x0002D1D, 0x0002D24, 0x0002D2D, 0x0002D38, 0x0002D55,
+    0x0002D60, 0x0002D73, 0x0002D78, 0x0002D7F, 0x0002D89, 0x0002D90, 0x0002D99, 0x0002DC0, 0x0002DC7,
+    0x0002DC8, 0x0002E09, 0x0002E0F, 0x0002E10, 0x0002E17, 0x0002E2C, 0x0002E3B, 0x0002E44, 0x0002E4B,
+    0x0002E58, 0x0002E67, 0x0002E6C, 0x0002E73, 0x0002E74, 0x0002E7B, 0x0002E80, 0x0002E8F, 0x0002E94,
+    0x0002EA3, 0x0002EAC, 0x0002EBB, 0x0002EE8, 0x0002EF9, 0x0002F0C, 0x0002F19, 0x0002F24, 0x0002F29,
+    0x0002F38, 0x0002F43, 0x0002F44, 0x0002F5D, 0x0002F60, 0x0002F99, 0x0002FC0, 0x0003001, 0x0003017,
+    0x0003034, 0x000303B, 0x0003044, 0x000304B, 0x00030A4, 0x00030AB, 0x00030E8, 0x00030F1, 0x00030F7,
+    0x00030F9, 0x0003114, 0x0003119, 0x0003124, 0x0003129, 0x0003138, 0x0003155, 0x000315C, 0x0003163,
+    0x000316C, 0x0003177, 0x0003178, 0x0003183, 0x0003189, 0x0003190, 0x0003199, 0x00031C0, 0x0003203,
+    0x0003205, 0x0003210, 0x0003217, 0x0003234, 0x000323B, 0x0003244, 0x000324B, 0x00032A4, 0x00032AB,
+    0x00032D0, 0x00032D7, 0x00032E8, 0x00032F1, 0x00032F7, 0x00032F9, 0x0003314, 0x0003319, 0x0003324,
+    0x0003329, 0x0003338, 0x0003355, 0x000335C, 0x0003377, 0x000337C, 0x0003383, 0x0003389, 0x0003390,
+    0x0003399, 0x00033C0, 0x00033C7, 0x00033CC, 0x0003401, 0x0003413, 0x0003434, 0x000343B, 0x0003444,
+    0x000344B, 0x00034ED, 0x00034F7, 0x00034F9, 0x0003514, 0x0003519, 0x0003524, 0x0003529, 0x000353B,
+    0x000353C, 0x0003553, 0x000355D, 0x0003560, 0x000357F, 0x0003589, 0x0003590, 0x0003599, 0x00035C0,
+    0x00035EB, 0x0003600, 0x0003605, 0x0003610, 0x0003617, 0x000365C, 0x000366B, 0x00036C8, 0x00036CF,
+    0x00036F0, 0x00036F7, 0x00036F8, 0x0003703, 0x000371C, 0x0003729, 0x000372C, 0x000373D, 0x0003754,
+    0x0003759, 0x000375C, 0x0003761, 0x0003780, 0x0003799, 0x00037C0, 0x00037C9, 0x00037D0, 0x0003807,
+    0x00038C5, 0x00038CB, 0x00038CD, 0x00038EC, 0x0003903, 0x000391D, 0x000393C, 0x0003941, 0x0003968,
+    0x0003A07, 0x0003A0C, 0x0003A13, 0x0003A14, 0x0003A1B, 0x0003A2C, 0x0003A33, 0x0003A90, 0x0003A97,
+    0x0003A98, 0x0003A9F, 0x0003AC5, 0x0003ACB, 0x0003ACD, 0x0003AF7, 0x0003AF8, 0x0003B03, 0x0003B14,
+    0x0003B1B, 0x0003B1C, 0x0003B21, 0x0003B38, 0x0003B41, 0x0003B68, 0x0003B73, 0x0003B80, 0x0003C03,
+    0x0003C04, 0x0003C61, 0x0003C68, 0x0003C81, 0x0003CA8, 0x0003CD5, 0x0003CD8, 0x0003CDD, 0x0003CE0,
+    0x0003CE5, 0x0003CE8, 0x0003CF9, 0x0003D03, 0x0003D20, 0x0003D27, 0x0003DB4, 0x0003DC5, 0x0003E14,
+    0x0003E19, 0x0003E23, 0x0003E35, 0x0003E60, 0x0003E65, 0x0003EF4, 0x0003F19, 0x0003F1C, 0x0004003,
+    0x00040AD, 0x00040FF, 0x0004101, 0x0004128, 0x0004143, 0x0004159, 0x000416B, 0x0004179, 0x0004187,
+    0x0004189, 0x0004197, 0x000419D, 0x00041BB, 0x00041C5, 0x00041D7, 0x0004209, 0x000423B, 0x000423D,
+    0x0004278, 0x0004283, 0x0004318, 0x000431F, 0x0004320, 0x0004337, 0x0004338, 0x0004343, 0x00043EC,
+    0x00043F3, 0x0004924, 0x000492B, 0x0004938, 0x0004943, 0x000495C, 0x0004963, 0x0004964, 0x000496B,
+    0x0004978, 0x0004983, 0x0004A24, 0x0004A2B, 0x0004A38, 0x0004A43, 0x0004AC4, 0x0004ACB, 0x0004AD8,
+    0x0004AE3, 0x0004AFC, 0x0004B03, 0x0004B04, 0x0004B0B, 0x0004B18, 0x0004B23, 0x0004B5C, 0x0004B63,
+    0x0004C44, 0x0004C4B, 0x0004C58, 0x0004C63, 0x0004D6C, 0x0004D75, 0x0004D80, 0x0004DA5, 0x0004DC8,
+    0x0004E03, 0x0004E40, 0x0004E83, 0x0004FD8, 0x0004FE3, 0x0004FF8, 0x0005007, 0x00059B4, 0x00059BF,
+    0x0005A00, 0x0005A07, 0x0005A6C, 0x0005A83, 0x0005BAC, 0x0005BBB, 0x0005BE4, 0x0005C03, 0x0005C49,
+    0x0005C58, 0x0005C7F, 0x0005CC9, 0x0005CD4, 0x0005D03, 0x0005D49, 0x0005D50, 0x0005D83, 0x0005DB4,
+    0x0005DBB, 0x0005DC4, 0x0005DC9, 0x0005DD0, 0x0005E03, 0x0005ED1, 0x0005F50, 0x0005F5F, 0x0005F60,
+    0x0005F73, 0x0005F75, 0x0005F78, 0x0005F81, 0x0005FA8, 0x000602D, 0x0006038, 0x000603D, 0x0006068,
+    0x0006083, 0x00061E4, 0x0006203, 0x00062A5, 0x00062AB, 0x00062AC, 0x00062C3, 0x00063D8, 0x0006403,
+    0x000647C, 0x0006481, 0x00064B0, 0x00064C1, 0x00064F0, 0x0006519, 0x0006543, 0x00065B8, 0x00065C3,
+    0x00065D4, 0x0006603, 0x00066B0, 0x00066C3, 0x0006728, 0x0006741, 0x000676C, 0x0006803, 0x000685D,
+    0x0006870, 0x0006883, 0x0006955, 0x000697C, 0x0006981, 0x00069F4, 0x00069FD, 0x0006A28, 0x0006A41,
+    0x0006A68, 0x0006A9F, 0x0006AA0, 0x0006AC1, 0x0006AF8, 0x0006AFD, 0x0006B3C, 0x0006C01, 0x0006C17,
+    0x0006CD1, 0x0006D17, 0x0006D34, 0x0006D41, 0x0006D68, 0x0006DAD, 0x0006DD0, 0x0006E01, 0x0006E0F,
+    0x0006E85, 0x0006EBB, 0x0006EC1, 0x0006EEB, 0x0006F99, 0x0006FD0, 0x0007003, 0x0007091, 0x00070E0,
+    0x0007101, 0x0007128, 0x0007137, 0x0007141, 0x000716B, 0x00071F8, 0x0007203, 0x0007224, 0x0007243,
+    0x00072EC, 0x00072F7, 0x0007300, 0x0007341, 0x000734C, 0x0007351, 0x00073A7, 0x00073B5, 0x00073BB,
+    0x00073D1, 0x00073D7, 0x00073DD, 0x00073EB, 0x00073EC, 0x0007403, 0x0007701, 0x0007803, 0x0007C58,
+    0x0007C63, 0x0007C78, 0x0007C83, 0x0007D18, 0x0007D23, 0x0007D38, 0x0007D43, 0x0007D60, 0x0007D67,
+    0x0007D68, 0x0007D6F, 0x0007D70, 0x0007D77, 0x0007D78, 0x0007D7F, 0x0007DF8, 0x0007E03, 0x0007ED4,
+    0x0007EDB, 0x0007EF4, 0x0007EFB, 0x0007EFC, 0x0007F0B, 0x0007F14, 0x0007F1B, 0x0007F34, 0x0007F43,
+    0x0007F50, 0x0007F5B, 0x0007F70, 0x0007F83, 0x0007FB4, 0x0007FCB, 0x0007FD4, 0x0007FDB, 0x0007FF4,
+    0x00080FD, 0x0008104, 0x0008151, 0x0008154, 0x00081C7, 0x00081C8, 0x00081FF, 0x0008200, 0x0008243,
+    0x0008274, 0x0008341, 0x0008374, 0x0008385, 0x0008388, 0x0008395, 0x00083C4, 0x000840B, 0x000840C,
+    0x000841F, 0x0008420, 0x000842B, 0x0008450, 0x0008457, 0x0008458, 0x0008463, 0x0008478, 0x0008493,
+    0x0008494, 0x000849B, 0x000849C, 0x00084A3, 0x00084A4, 0x00084AB, 0x00084E8, 0x00084F3, 0x0008500,
+    0x0008517, 0x0008528, 0x000853B, 0x000853C, 0x0008583, 0x0008624, 0x000B003, 0x000B394, 0x000B3AF,
+    0x000B3BD, 0x000B3CB, 0x000B3D0, 0x000B403, 0x000B498, 0x000B49F, 0x000B4A0, 0x000B4B7, 0x000B4B8,
+    0x000B4C3, 0x000B5A0, 0x000B5BF, 0x000B5C0, 0x000B5FD, 0x000B603, 0x000B65C, 0x000B683, 0x000B69C,
+    0x000B6A3, 0x000B6BC, 0x000B6C3, 0x000B6DC, 0x000B6E3, 0x000B6FC, 0x000B703, 0x000B71C, 0x000B723,
+    0x000B73C, 0x000B743, 0x000B75C, 0x000B763, 0x000B77C, 0x000B781, 0x000B800, 0x000C017, 0x000C020,
+    0x000C087, 0x000C0A9, 0x000C0C0, 0x000C0C7, 0x000C0D8, 0x000C0E3, 0x000C0F4, 0x000C107, 0x000C25C,
+    0x000C265, 0x000C26C, 0x000C277, 0x000C280, 0x000C287, 0x000C3EC, 0x000C3F3, 0x000C400, 0x000C417,
+    0x000C4C0, 0x000C4C7, 0x000C63C, 0x000C683, 0x000C700, 0x000C7C3, 0x000C800, 0x000D003, 0x0013700,
+    0x0013803, 0x0029234, 0x0029343, 0x00293F8, 0x0029403, 0x0029834, 0x0029843, 0x0029881, 0x00298AB,
+    0x00298B0, 0x0029903, 0x00299BD, 0x00299C0, 0x00299D1, 0x00299F8, 0x00299FF, 0x0029A79, 0x0029A83,
+    0x0029BC1, 0x0029BC8, 0x0029C5F, 0x0029C80, 0x0029C8B, 0x0029E24, 0x0029E2F, 0x0029F2C, 0x0029F43,
+    0x0029F48, 0x0029F4F, 0x0029F50, 0x0029F57, 0x0029F68, 0x0029FCB, 0x002A009, 0x002A00F, 0x002A019,
+    0x002A01F, 0x002A02D, 0x002A033, 0x002A08D, 0x002A0A0, 0x002A0B1, 0x002A0B4, 0x002A103, 0x002A1D0,
+    0x002A201, 0x002A20B, 0x002A2D1, 0x002A318, 0x002A341, 0x002A368, 0x002A381, 0x002A3CB, 0x002A3E0,
+    0x002A3EF, 0x002A3F0, 0x002A3F7, 0x002A3FD, 0x002A42B, 0x002A499, 0x002A4B8, 0x002A4C3, 0x002A51D,
+    0x002A550, 0x002A583, 0x002A5F4, 0x002A601, 0x002A613, 0x002A6CD, 0x002A704, 0x002A73F, 0x002A741,
+    0x002A768, 0x002A783, 0x002A795, 0x002A79B, 0x002A7C1, 0x002A7EB, 0x002A7FC, 0x002A803, 0x002A8A5,
+    0x002A8DC, 0x002A903, 0x002A90D, 0x002A913, 0x002A931, 0x002A938, 0x002A941, 0x002A968, 0x002A983,
+    0x002A9DC, 0x002A9EB, 0x002A9ED, 0x002A9FB, 0x002AAC1, 0x002AAC7, 0x002AAC9, 0x002AAD7, 0x002AADD,
+    0x002AAE7, 0x002AAF9, 0x002AB03, 0x002AB05, 0x002AB0B, 0x002AB0C, 0x002AB6F, 0x002AB78, 0x002AB83,
+    0x002ABAD, 0x002ABC0, 0x002ABCB, 0x002ABD5, 0x002ABDC, 0x002AC07, 0x002AC1C, 0x002AC27, 0x002AC3C,
+    0x002AC47, 0x002AC5C, 0x002AC83, 0x002AC9C, 0x002ACA3, 0x002ACBC, 0x002ACC3, 0x002AD6C, 0x002AD73,
+    0x002ADA8, 0x002ADC3, 0x002AF8D, 0x002AFAC, 0x002AFB1, 0x002AFB8, 0x002AFC1, 0x002AFE8, 0x002B003,
+    0x0035E90, 0x0035EC3, 0x0035F1C, 0x0035F2F, 0x0035FF0, 0x003E403, 0x003E9B8, 0x003E9C3, 0x003EB68,
+    0x003EC03, 0x003EC1C, 0x003EC4F, 0x003EC60, 0x003EC77, 0x003EC79, 0x003EC7F, 0x003ECA4, 0x003ECAB,
+    0x003ECDC, 0x003ECE3, 0x003ECF4, 0x003ECFB, 0x003ECFC, 0x003ED03, 0x003ED08, 0x003ED0F, 0x003ED14,
+    0x003ED1B, 0x003EEC8, 0x003EF4F, 0x003F178, 0x003F193, 0x003F4F8, 0x003F543, 0x003F640, 0x003F64B,
+    0x003F720, 0x003F7C3, 0x003F7E8, 0x003F801, 0x003F840, 0x003F881, 0x003F8C0, 0x003F8CD, 0x003F8D4,
+    0x003F935, 0x003F940, 0x003F9C7, 0x003F9C8, 0x003F9CF, 0x003F9D0, 0x003F9DF, 0x003F9E0, 0x003F9E7,
+    0x003F9E8, 0x003F9EF, 0x003F9F0, 0x003F9F7, 0x003F9F8, 0x003F9FF, 0x003FBF4, 0x003FC41, 0x003FC68,
+    0x003FC87, 0x003FCEC, 0x003FCFD, 0x003FD00, 0x003FD07, 0x003FD6C, 0x003FD9B, 0x003FE79, 0x003FE83,
+    0x003FEFC, 0x003FF0B, 0x003FF20, 0x003FF2B, 0x003FF40, 0x003FF4B, 0x003FF60, 0x003FF6B, 0x003FF74,
+    0x0040003, 0x0040030, 0x0040037, 0x004009C, 0x00400A3, 0x00400EC, 0x00400F3, 0x00400F8, 0x00400FF,
+    0x0040138, 0x0040143, 0x0040178, 0x0040203, 0x00403EC, 0x0040503, 0x00405D4, 0x00407F5, 0x00407F8,
+    0x0040A03, 0x0040A74, 0x0040A83, 0x0040B44, 0x0040B81, 0x0040B84, 0x0040C03, 0x0040C80, 0x0040CB7,
+    0x0040D2C, 0x0040D43, 0x0040DD9, 0x0040DEC, 0x0040E03, 0x0040E78, 0x0040E83, 0x0040F10, 0x0040F23,
+    0x0040F40, 0x0040F47, 0x0040F58, 0x0041003, 0x0041278, 0x0041281, 0x00412A8, 0x00412C3, 0x0041350,
+    0x0041363, 0x00413F0, 0x0041403, 0x00414A0, 0x00414C3, 0x0041590, 0x00415C3, 0x00415EC, 0x00415F3,
+    0x004162C, 0x0041633, 0x004164C, 0x0041653, 0x0041658, 0x004165F, 0x0041688, 0x004168F, 0x00416C8,
+    0x00416CF, 0x00416E8, 0x00416EF, 0x00416F4, 0x0041803, 0x0041CDC, 0x0041D03, 0x0041D58, 0x0041D83,
+    0x0041DA0, 0x0041E03, 0x0041E18, 0x0041E1F, 0x0041EC4, 0x0041ECB, 0x0041EEC, 0x0042003, 0x0042018,
+    0x0042023, 0x0042024, 0x004202B, 0x00420D8, 0x00420DF, 0x00420E4, 0x00420F3, 0x00420F4, 0x00420FF,
+    0x0042158, 0x0042183, 0x00421DC, 0x0042203, 0x004227C, 0x0042383, 0x00423CC, 0x00423D3, 0x00423D8,
+    0x0042403, 0x0042458, 0x0042483, 0x00424E8, 0x0042603, 0x00426E0, 0x00426FB, 0x0042700, 0x0042803,
+    0x0042805, 0x0042810, 0x0042815, 0x004281C, 0x0042831, 0x0042843, 0x0042850, 0x0042857, 0x0042860,
+    0x0042867, 0x00428D8, 0x00428E1, 0x00428EC, 0x00428FD, 0x0042900, 0x0042983, 0x00429F4, 0x0042A03,
+    0x0042A74, 0x0042B03, 0x0042B20, 0x0042B27, 0x0042B95, 0x0042B9C, 0x0042C03, 0x0042CD8, 0x0042D03,
+    0x0042D58, 0x0042D83, 0x0042DCC, 0x0042E03, 0x0042E48, 0x0043003, 0x0043124, 0x0043203, 0x00432CC,
+    0x0043303, 0x00433CC, 0x0043403, 0x0043491, 0x00434A0, 0x00434C1, 0x00434E8, 0x0043A03, 0x0043AA8,
+    0x0043AAD, 0x0043AB4, 0x0043AC3, 0x0043AC8, 0x0043C03, 0x0043C74, 0x0043C9F, 0x0043CA0, 0x0043CC3,
+    0x0043D19, 0x0043D44, 0x0043DC3, 0x0043E09, 0x0043E18, 0x0043EC3, 0x0043F14, 0x0043F83, 0x0043FDC,
+    0x0044001, 0x004400F, 0x00440E1, 0x004411C, 0x0044199, 0x00441C7, 0x00441CD, 0x00441D7, 0x00441D8,
+    0x00441FD, 0x004420F, 0x00442C1, 0x00442EC, 0x0044309, 0x004430C, 0x0044343, 0x00443A4, 0x00443C1,
+    0x00443E8, 0x0044401, 0x004440F, 0x004449D, 0x00444D4, 0x00444D9, 0x0044500, 0x0044513, 0x0044515,
+    0x004451F, 0x0044520, 0x0044543, 0x00445CD, 0x00445D0, 0x00445DB, 0x00445DC, 0x0044601, 0x004460F,
+    0x00446CD, 0x0044707, 0x0044714, 0x0044725, 0x0044734, 0x0044739, 0x004476B, 0x004476C, 0x0044773,
+    0x0044774, 0x0044803, 0x0044848, 0x004484F, 0x00448B1, 0x00448E0, 0x00448F9, 0x00448FC, 0x0044A03,
+    0x0044A1C, 0x0044A23, 0x0044A24, 0x0044A2B, 0x0044A38, 0x0044A3F, 0x0044A78, 0x0044A7F, 0x0044AA4,
+    0x0044AC3, 0x0044B7D, 0x0044BAC, 0x0044BC1, 0x0044BE8, 0x0044C01, 0x0044C10, 0x0044C17, 0x0044C34,
+    0x0044C3F, 0x0044C44, 0x0044C4F, 0x0044CA4, 0x0044CAB, 0x0044CC4, 0x0044CCB, 0x0044CD0, 0x0044CD7,
+    0x0044CE8, 0x0044CED, 0x0044CF7, 0x0044CF9, 0x0044D14, 0x0044D1D, 0x0044D24, 0x0044D2D, 0x0044D38,
+    0x0044D43, 0x0044D44, 0x0044D5D, 0x0044D60, 0x0044D77, 0x0044D89, 0x0044D90, 0x0044D99, 0x0044DB4,
+    0x0044DC1, 0x0044DD4, 0x0045003, 0x00450D5, 0x004511F, 0x004512C, 0x0045141, 0x0045168, 0x0045179,
+    0x004517F, 0x0045188, 0x0045203, 0x00452C1, 0x0045313, 0x0045318, 0x004531F, 0x0045320, 0x0045341,
+    0x0045368, 0x0045603, 0x00456BD, 0x00456D8, 0x00456E1, 0x0045704, 0x0045763, 0x0045771, 0x0045778,
+    0x0045803, 0x00458C1, 0x0045904, 0x0045913, 0x0045914, 0x0045941, 0x0045968, 0x0045A03, 0x0045AAD,
+    0x0045AE3, 0x0045AE4, 0x0045B01, 0x0045B28, 0x0045C03, 0x0045C6C, 0x0045C75, 0x0045CB0, 0x0045CC1,
+    0x0045CE8, 0x0045D03, 0x0045D1C, 0x0046003, 0x00460B1, 0x00460EC, 0x0046283, 0x0046381, 0x00463A8,
+    0x00463FF, 0x004641C, 0x0046427, 0x0046428, 0x0046433, 0x0046450, 0x0046457, 0x004645C, 0x0046463,
+    0x00464C1, 0x00464D8, 0x00464DD, 0x00464E4, 0x00464ED, 0x00464FF, 0x0046501, 0x0046507, 0x0046509,
+    0x0046510, 0x0046541, 0x0046568, 0x0046683, 0x00466A0, 0x00466AB, 0x0046745, 0x0046760, 0x0046769,
+    0x0046787, 0x0046788, 0x004678F, 0x0046791, 0x0046794, 0x0046803, 0x0046805, 0x004682F, 0x00468CD,
+    0x00468EB, 0x00468ED, 0x00468FC, 0x004691D, 0x0046920, 0x0046943, 0x0046945, 0x0046973, 0x0046A29,
+    0x0046A68, 0x0046A77, 0x0046A78, 0x0046AC3, 0x0046BE4, 0x0047003, 0x0047024, 0x004702B, 0x00470BD,
+    0x00470DC, 0x00470E1, 0x0047103, 0x0047104, 0x0047141, 0x0047168, 0x00471CB, 0x0047240, 0x0047249,
+    0x00472A0, 0x00472A5, 0x00472DC, 0x0047403, 0x004741C, 0x0047423, 0x0047428, 0x004742F, 0x00474C5,
+    0x00474DC, 0x00474E9, 0x00474EC, 0x00474F1, 0x00474F8, 0x00474FD, 0x004751B, 0x004751D, 0x0047520,
+    0x0047541, 0x0047568, 0x0047583, 0x0047598, 0x004759F, 0x00475A4, 0x00475AB, 0x0047629, 0x004763C,
+    0x0047641, 0x0047648, 0x004764D, 0x0047663, 0x0047664, 0x0047681, 0x00476A8, 0x0047B83, 0x0047BCD,
+    0x0047BDC, 0x0047EC3, 0x0047EC4, 0x0048003, 0x0048E68, 0x0049003, 0x00491BC, 0x0049203, 0x0049510,
+    0x004BE43, 0x004BFC4, 0x004C003, 0x004D0BC, 0x0051003, 0x005191C, 0x005A003, 0x005A8E4, 0x005A903,
+    0x005A97C, 0x005A981, 0x005A9A8, 0x005A9C3, 0x005AAFC, 0x005AB01, 0x005AB28, 0x005AB43, 0x005ABB8,
+    0x005ABC1, 0x005ABD4, 0x005AC03, 0x005ACC1, 0x005ACDC, 0x005AD03, 0x005AD10, 0x005AD41, 0x005AD68,
+    0x005AD8F, 0x005ADE0, 0x005ADF7, 0x005AE40, 0x005B903, 0x005BA00, 0x005BC03, 0x005BD2C, 0x005BD3D,
+    0x005BD43, 0x005BD45, 0x005BE20, 0x005BE3D, 0x005BE4F, 0x005BE80, 0x005BF83, 0x005BF88, 0x005BF8F,
+    0x005BF91, 0x005BF94, 0x005BFC1, 0x005BFC8, 0x005C003, 0x0061FE0, 0x0062003, 0x0063358, 0x0063403,
+    0x0063424, 0x006BFC3, 0x006BFD0, 0x006BFD7, 0x006BFF0, 0x006BFF7, 0x006BFFC, 0x006C003, 0x006C48C,
+    0x006C543, 0x006C54C, 0x006C593, 0x006C5A0, 0x006C5C3, 0x006CBF0, 0x006F003, 0x006F1AC, 0x006F1C3,
+    0x006F1F4, 0x006F203, 0x006F224, 0x006F243, 0x006F268, 0x006F275, 0x006F27C, 0x0073C01, 0x0073CB8,
+    0x0073CC1, 0x0073D1C, 0x0074595, 0x00745A8, 0x00745B5, 0x00745CC, 0x00745ED, 0x007460C, 0x0074615,
+    0x0074630, 0x00746A9, 0x00746B8, 0x0074909, 0x0074914, 0x0075003, 0x0075154, 0x007515B, 0x0075274,
+    0x007527B, 0x0075280, 0x007528B, 0x007528C, 0x0075297, 0x007529C, 0x00752A7, 0x00752B4, 0x00752BB,
+    0x00752E8, 0x00752EF, 0x00752F0, 0x00752F7, 0x0075310, 0x0075317, 0x0075418, 0x007541F, 0x007542C,
+    0x0075437, 0x0075454, 0x007545B, 0x0075474, 0x007547B, 0x00754E8, 0x00754EF, 0x00754FC, 0x0075503,
+    0x0075514, 0x007551B, 0x007551C, 0x007552B, 0x0075544, 0x007554B, 0x0075A98, 0x0075AA3, 0x0075B04,
+    0x0075B0B, 0x0075B6C, 0x0075B73, 0x0075BEC, 0x0075BF3, 0x0075C54, 0x0075C5B, 0x0075CD4, 0x0075CDB,
+    0x0075D3C, 0x0075D43, 0x0075DBC, 0x0075DC3, 0x0075E24, 0x0075E2B, 0x0075EA4, 0x0075EAB, 0x0075F0C,
+    0x0075F13, 0x0075F30, 0x0075F39, 0x0076000, 0x0076801, 0x00768DC, 0x00768ED, 0x00769B4, 0x00769D5,
+    0x00769D8, 0x0076A11, 0x0076A14, 0x0076A6D, 0x0076A80, 0x0076A85, 0x0076AC0, 0x0077C03, 0x0077C7C,
+    0x0078001, 0x007801C, 0x0078021, 0x0078064, 0x007806D, 0x0078088, 0x007808D, 0x0078094, 0x0078099,
+    0x00780AC, 0x0078403, 0x00784B4, 0x00784C1, 0x00784DF, 0x00784F8, 0x0078501, 0x0078528, 0x007853B,
+    0x007853C, 0x0078A43, 0x0078AB9, 0x0078ABC, 0x0078B03, 0x0078BB1, 0x0078BE8, 0x0079F83, 0x0079F9C,
+    0x0079FA3, 0x0079FB0, 0x0079FB7, 0x0079FBC, 0x0079FC3, 0x0079FFC, 0x007A003, 0x007A314, 0x007A341,
+    0x007A35C, 0x007A403, 0x007A511, 0x007A52F, 0x007A530, 0x007A541, 0x007A568, 0x007B803, 0x007B810,
+    0x007B817, 0x007B880, 0x007B887, 0x007B88C, 0x007B893, 0x007B894, 0x007B89F, 0x007B8A0, 0x007B8A7,
+    0x007B8CC, 0x007B8D3, 0x007B8E0, 0x007B8E7, 0x007B8E8, 0x007B8EF, 0x007B8F0, 0x007B90B, 0x007B90C,
+    0x007B91F, 0x007B920, 0x007B927, 0x007B928, 0x007B92F, 0x007B930, 0x007B937, 0x007B940, 0x007B947,
+    0x007B94C, 0x007B953, 0x007B954, 0x007B95F, 0x007B960, 0x007B967, 0x007B968, 0x007B96F, 0x007B970,
+    0x007B977, 0x007B978, 0x007B97F, 0x007B980, 0x007B987, 0x007B98C, 0x007B993, 0x007B994, 0x007B99F,
+    0x007B9AC, 0x007B9B3, 0x007B9CC, 0x007B9D3, 0x007B9E0, 0x007B9E7, 0x007B9F4, 0x007B9FB, 0x007B9FC,
+    0x007BA03, 0x007BA28, 0x007BA2F, 0x007BA70, 0x007BA87, 0x007BA90, 0x007BA97, 0x007BAA8, 0x007BAAF,
+    0x007BAF0, 0x007EFC1, 0x007EFE8, 0x0080003, 0x00A9B80, 0x00A9C03, 0x00ADCE4, 0x00ADD03, 0x00AE078,
+    0x00AE083, 0x00B3A88, 0x00B3AC3, 0x00BAF84, 0x00BE003, 0x00BE878, 0x00C0003, 0x00C4D2C, 0x0380401,
+    0x03807C0
+};
+
+static int TkXidClass(unsigned int CodePoint) {
+    int Low = 0, High = (int)(sizeof(TkXidRanges) / sizeof(TkXidRanges[0]));
+
+    // Last change at or before the code point. The first one is at 0x80.
+    while (High - Low > 1) {
+        int Mid = (Low + High) / 2;
+        if ((TkXidRanges[Mid] >> 2) <= CodePoint) Low = Mid;
+        else High = Mid;
+    }
+
+    return (int)(TkXidRanges[Low] & 3);
+}
+
+// Length of the non-ASCII identifier character at 'c', XID_Start if 'Start' and XID_Continue otherwise,
+// 0 if there is none. 'Sequence' gets the length of the UTF-8 sequence, 0 if it's malformed. Kept out
+// of the lexer loops, which only call it on a byte >= 0x80.
+template <bool Bounded>
+static int TkUnicodeIdentChar(const char* c, const char* End, bool Start, int* Sequence) {
+    unsigned int CodePoint;
+    *Sequence = TkDecodeUtf8<Bounded>(c, End, &CodePoint);
+    if (!*Sequence) return 0;
+
+    int Class = TkXidClass(CodePoint);
+    return (Start ? Class == TK_XID_START : Class != 0) ? *Sequence : 0;
+}
+
+
+#ifdef TOKENIZER_SIMD_WIDTH
+// Clears the bits of the bytes at or after 'End'.
+template <bool Bounded>
+static inline unsigned int TkLimitBlock(char* Block, char* End, unsigned int Valid) {
+    if (Bounded && End - Block < TOKENIZER_SIMD_WIDTH) Valid &= (1u << (End - Block)) - 1;
+    return Valid;
+}
+#endif
+
+// The three routines below return the first byte that stops the scan and add the newlines they
+// have stepped over to 'Lines'. The SIMD versions produce exactly the same result as the scalar loops.
+// In the bounded versions the vectors never load a block starting at or after 'End'.
+
+template <bool Bounded, bool CountLines>
+static inline char* SkipWhitespace(char* c, char* End, int* Lines) {
+
+    // Most tokens are separated by a single space or none at all, don't bother with the vectors then.
+    if (!IS_WHITE(TK_PEEK(0))) return c;
+    if (!IS_WHITE(TK_PEEK(1))) {
+        if (CountLines && *c == '\n') ++*Lines;
+        return c + 1;
+    }
+
+#ifdef TOKENIZER_SIMD_WIDTH
+    unsigned int Valid;
+    char* Block = TkAlignBlock(c, &Valid);
+
+    const tk_vec NewLine = TK_SPLAT('\n'), Space = TK_SPLAT(' '), Tab = TK_SPLAT('\t');
+    const tk_vec Return = TK_SPLAT('\r'), Feed = TK_SPLAT('\f');
+
+    for (;;) {
+        if (Bounded && Block >= End) return End;
+
+        tk_vec Bytes = TK_LOAD(Block);
+        Valid = TkLimitBlock<Bounded>(Block, End, Valid);
+
+        unsigned int Lf = TK_MATCH(Bytes, NewLine);
+        unsigned int White = Lf | TK_MATCH(Bytes, Space) | TK_MATCH(Bytes, Tab) |
+                             TK_MATCH(Bytes, Return) | TK_MATCH(Bytes, Feed);
+
+        // '\0' is not a whitespace, so the scan always stops at the end of the string.
+        unsigned int Stop = ~White & Valid;
+        if (Stop) {
+            if (CountLines) *Lines += TkCountBits(Lf & Valid & ((Stop & (0u - Stop)) - 1));
+            return Block + TkFirstBit(Stop);
+        }
+
+        if (CountLines) *Lines += TkCountBits(Lf & Valid);
+        Block += TOKENIZER_SIMD_WIDTH;
+        Valid = TK_FULL_MASK;
+    }
+#else
+    while (TK_PEEK(0) && IS_WHITE(*c)) {
+        if (CountLines && *c == '\n') ++*Lines;
+        ++c;
+    }
+    return c;
+#endif
+}
+
+// Stops at the '\r' or '\n' that ends the comment (or at the end of the string).
+template <bool Bounded>
+static inline char* SkipLineComment(char* c, char* End) {
+
+#ifdef TOKENIZER_SIMD_WIDTH
+    unsigned int Valid;
+    char* Block = TkAlignBlock(c, &Valid);
+
+    const tk_vec NewLine = TK_SPLAT('\n'), Return = TK_SPLAT('\r'), Zero = TK_SPLAT(0);
+
+    for (;;) {
+        if (Bounded && Block >= End) return End;
+
+        tk_vec Bytes = TK_LOAD(Block);
+        Valid = TkLimitBlock<Bounded>(Block, End, Valid);
+
+        unsigned int Stop = (TK_MATCH(Bytes, NewLine) | TK_MATCH(Bytes, Return) | TK_MATCH(Bytes, Zero)) & Valid;
+        if (Stop) return Block + TkFirstBit(Stop);
+
+        Block += TOKENIZER_SIMD_WIDTH;
+        Valid = TK_FULL_MASK;
+    }
+#else
+    while (TK_PEEK(0) && *c != '\r' && *c != '\n')
+        ++c;
+    return c;
+#endif
+}
+
+// 'c' points right after the opening '/*'. Stops at the closing '*/' (or at the end of the string).
+template <bool Bounded, bool CountLines>
+static inline char* SkipBlockComment(char* c, char* End, int* Lines) {
+
+#ifdef TOKENIZER_SIMD_WIDTH
+    unsigned int Valid;
+    char* Block = TkAlignBlock(c, &Valid);
+
+    const tk_vec NewLine = TK_SPLAT('\n'), Star = TK_SPLAT('*'), Zero = TK_SPLAT(0);
+
+    for (;;) {
+        if (Bounded && Block >= End) return End;
+
+        tk_vec Bytes = TK_LOAD(Block);
+        Valid = TkLimitBlock<Bounded>(Block, End, Valid);
+
+        unsigned int Lf = CountLines ? TK_MATCH(Bytes, NewLine) & Valid : 0;
+        unsigned int Candidates = (TK_MATCH(Bytes, Star) | TK_MATCH(Bytes, Zero)) & Valid;
+
+        while (Candidates) {
+            int Index = TkFirstBit(Candidates);
+
+            // A '*' right before the end of the block is fine: c[1] is at most the terminating '\0'.
+            if (!Block[Index] || TkChar<Bounded>(Block + Index + 1, End) == '/') {
+                if (CountLines) *Lines += TkCountBits(Lf & ((1u << Index) - 1));
+                return Block + Index;
+            }
+
+            Candidates &= Candidates - 1;
+        }
+
+        if (CountLines) *Lines += TkCountBits(Lf);
+        Block += TOKENIZER_SIMD_WIDTH;
+        Valid = TK_FULL_MASK;
+    }
+#else
+    while (TK_PEEK(0) && (*c != '*' || TK_PEEK(1) != '/')) {
+        if (CountLines && *c == '\n') ++*Lines;
+        ++c;
+    }
+    return c;
+#endif
+}
+
+
+
+TOKENIZER_DEF void InitTokenizer(tokenizer* Tokenizer, char* Data, const char* Filename) {
+    Tokenizer->At = Data;
+    Tokenizer->File = Filename;
+    Tokenizer->End = 0;
+    Tokenizer->LookaheadCount = 0;
+    Tokenizer->TokenNewLines = 0;
+
+    // The newline index memory is kept for the new data.
+    Tokenizer->Start = Data;
+    Tokenizer->Indexed = Data;
+    Tokenizer->NewLineCount = 0;
+}
+
+#ifdef _WIN32
+
+TOKENIZER_DEF bool InitTokenizerFromFile(tokenizer* Tokenizer, const char* Path) {
+    HANDLE File = CreateFileA(Path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if (File == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER Size;
+    Size.QuadPart = 0;
+    void* Mapping = 0;
+
+    if (GetFileSizeEx(File, &Size) && Size.QuadPart > 0) {
+        HANDLE Map = CreateFileMappingA(File, 0, PAGE_READONLY, 0, 0, 0);
+
+        if (Map) {
+            Mapping = MapViewOfFile(Map, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(Map);
+        }
+    }
+
+    CloseHandle(File);
+
+    if (!Mapping && Size.QuadPart > 0) {
+        return false;
+    }
+
+    static char Empty[1] = { 0 };
+
+    InitTokenizer(Tokenizer, Mapping ? (char*)Mapping : Empty, Path);
+    Tokenizer->End = Tokenizer->At + Size.QuadPart;
+    Tokenizer->Mapping = Mapping;
+    Tokenizer->MappingSize = (size_t)Size.QuadPart;
+
+    return true;
+}
+
+TOKENIZER_DEF void FreeTokenizer(tokenizer* Tokenizer) {
+    if (Tokenizer->Mapping) {
+        UnmapViewOfFile(Tokenizer->Mapping);
+    }
+
+    Tokenizer->Mapping = 0;
+    Tokenizer->MappingSize = 0;
+
+    TOKENIZER_FREE(Tokenizer->NewLines);
+    Tokenizer->NewLines = 0;
+    Tokenizer->NewLineCount = 0;
+    Tokenizer->NewLineCapacity = 0;
+}
+
+// Cache files are mapped copy-on-write, so loaded buffers can be edited in place.
+static void* TkMapCacheFile(const char* Path, size_t* Size) {
+    HANDLE File = CreateFileA(Path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, 0, OPEN_EXISTING, 0, 0);
+    if (File == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+
+    LARGE_INTEGER FileSize;
+    FileSize.QuadPart = 0;
+    void* Mapping = 0;
+
+    if (GetFileSizeEx(File, &FileSize) && FileSize.QuadPart > 0) {
+        HANDLE Map = CreateFileMappingA(File, 0, PAGE_WRITECOPY, 0, 0, 0);
+
+        if (Map) {
+            Mapping = MapViewOfFile(Map, FILE_MAP_COPY, 0, 0, 0);
+            CloseHandle(Map);
+        }
+    }
+
+    CloseHandle(File);
+
+    *Size = (size_t)FileSize.QuadPart;
+    return Mapping;
+}
+
+static void TkUnmapFile(void* Mapping, size_t) {
+    UnmapViewOfFile(Mapping);
+}
+
+static bool TkReplaceFile(const char* From, const char* To) {
+    return MoveFileExA(From, To, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+static unsigned long TkProcessId() {
+    return GetCurrentProcessId();
+}
+
+#else
+
+TOKENIZER_DEF bool InitTokenizerFromFile(tokenizer* Tokenizer, const char* Path) {
+    int File = open(Path, O_RDONLY);
+    if (File < 0) {
+        return false;
+    }
+
+    struct stat Info;
+    Info.st_size = 0;
+    void* Mapping = 0;
+
+    if (fstat(File, &Info) == 0 && Info.st_size > 0) {
+        Mapping = mmap(0, (size_t)Info.st_size, PROT_READ, MAP_PRIVATE, File, 0);
+
+        if (Mapping == MAP_FAILED) {
+            Mapping = 0;
+        }
+        else {
+            madvise(Mapping, (size_t)Info.st_size, MADV_SEQUENTIAL);
+        }
+    }
+
+    close(File);
+
+    if (!Mapping && Info.st_size > 0) {
+        return false;
+    }
+
+    static char Empty[1] = { 0 };
+
+    InitTokenizer(Tokenizer, Mapping ? (char*)Mapping : Empty, Path);
+    Tokenizer->End = Tokenizer->At + Info.st_size;
+    Tokenizer->Mapping = Mapping;
+    Tokenizer->MappingSize = (size_t)Info.st_size;
+
+    return true;
+}
+
+TOKENIZER_DEF void FreeTokenizer(tokenizer* Tokenizer) {
+    if (Tokenizer->Mapping) {
+        munmap(Tokenizer->Mapping, Tokenizer->MappingSize);
+    }
+
+    Tokenizer->Mapping = 0;
+    Tokenizer->MappingSize = 0;
+
+    TOKENIZER_FREE(Tokenizer->NewLines);
+    Tokenizer->NewLines = 0;
+    Tokenizer->NewLineCount = 0;
+    Tokenizer->NewLineCapacity = 0;
+}
+
+// Cache files are mapped copy-on-write, so loaded buffers can be edited in place.
+static void* TkMapCacheFile(const char* Path, size_t* Size) {
+    int File = open(Path, O_RDONLY);
+    if (File < 0) {
+        return 0;
+    }
+
+    struct stat Info;
+    Info.st_size = 0;
+    void* Mapping = 0;
+
+    if (fstat(File, &Info) == 0 && Info.st_size > 0) {
+        Mapping = mmap(0, (size_t)Info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, File, 0);
+
+        if (Mapping == MAP_FAILED) {
+            Mapping = 0;
+        }
+    }
+
+    close(File);
+
+    *Size = (size_t)Info.st_size;
+    return Mapping;
+}
+
+static void TkUnmapFile(void* Mapping, size_t Size) {
+    munmap(Mapping, Size);
+}
+
+static bool TkReplaceFile(const char* From, const char* To) {
+    return rename(From, To) == 0;
+}
+
+static unsigned long TkProcessId() {
+    return (unsigned long)getpid();
+}
+
+#endif
+
+
+TOKENIZER_DEF void SkipLine(tokenizer *Tokenizer) {
+    char* End = Tokenizer->End;
+    while ((!End || Tokenizer->At < End) && *Tokenizer->At && *Tokenizer->At++ != '\n');
+    Tokenizer->Line += Tokenizer->TokenNewLines + 1;
+    Tokenizer->TokenNewLines = 0;
+}
+
+// Skips all the whitespaces and comments in front of the next token. The bytes of the comments are
+// added to 'CommentBytes', if given.
+template <bool Bounded, bool CountLines, typename Policy = tokenizer_policy>
+static inline char* SkipBlanks(char* c, char* End, int* Line, long long* CommentBytes = 0) {
+
+    int Lines = 0;
+    for (;;) {
+
+        // Remove all whitespaces
+        c = SkipWhitespace<Bounded, CountLines>(c, End, &Lines);
+        char* Comment = c;
+
+        // C++ Style Comment
+        if (Policy::LineComments && TK_PEEK(0) == '/' && TK_PEEK(1) == '/') {
+            c = SkipLineComment<Bounded>(c + 2, End);
+        }
+
+        // Shell Style Comment
+        else if (Policy::HashComments && TK_PEEK(0) == '#') {
+            c = SkipLineComment<Bounded>(c + 1, End);
+        }
+
+        // C Style Comment
+        else if (Policy::BlockComments && TK_PEEK(0) == '/' && TK_PEEK(1) == '*') {
+            c = SkipBlockComment<Bounded, CountLines>(c + 2, End, &Lines);
+
+            if (TK_PEEK(0) == '*') {
+                c += 2;
+            }
+        }
+        else break;
+
+        if (CommentBytes) *CommentBytes += c - Comment;
+    }
+
+    // Count lines
+    if (CountLines) *Line += Lines;
+
+    return c;
+}
+
+// Stops at the first 'Quote', backslash (with 'Escapes') or terminator.
+template <bool Bounded, char Quote, bool Escapes>
+static inline char* FindStringStop(char* c, char* End) {
+
+#ifdef TOKENIZER_SIMD_WIDTH
+    unsigned int Valid;
+    char* Block = TkAlignBlock(c, &Valid);
+
+    const tk_vec Quotes = TK_SPLAT(Quote), Backslash = TK_SPLAT('\\'), Zero = TK_SPLAT(0);
+
+    for (;;) {
+        if (Bounded && Block >= End) return End;
+
+        tk_vec Bytes = TK_LOAD(Block);
+        Valid = TkLimitBlock<Bounded>(Block, End, Valid);
+
+        unsigned int Stop = (TK_MATCH(Bytes, Quotes) | (Escapes ? TK_MATCH(Bytes, Backslash) : 0) | TK_MATCH(Bytes, Zero)) & Valid;
+        if (Stop) return Block + TkFirstBit(Stop);
+
+        Block += TOKENIZER_SIMD_WIDTH;
+        Valid = TK_FULL_MASK;
+    }
+#else
+    while (TK_PEEK(0) && *c != Quote && (!Escapes || *c != '\\'))
+        ++c;
+    return c;
+#endif
+}
+
+// Decodes the character or escape sequence at 'At', before 'End', and moves past it. 'Unicode' tells
+// if the value is a code point (\u, \U) rather than a byte.
+static unsigned int DecodeChar(const char** At, const char* End, bool* Unicode) {
+    const char* c = *At;
+    unsigned int Value = (unsigned char)*c++;
+    *Unicode = false;
+
+    if (Value == '\\' && c < End) {
+        char Escape = *c++;
+
+        switch (Escape) {
+            case 'n': Value = '\n'; break;
+            case 't': Value = '\t'; break;
+            case 'r': Value = '\r'; break;
+            case 'a': Value = '\a'; break;
+            case 'b': Value = '\b'; break;
+            case 'f': Value = '\f'; break;
+            case 'v': Value = '\v'; break;
+
+            case 'x':
+            case 'u':
+            case 'U':
+            {
+                // \x takes any number of digits, like in C, only the last two count.
+                int MaxDigits = Escape == 'u' ? 4 : Escape == 'U' ? 8 : 0x7FFFFFFF;
+                int Digits = 0;
+                Value = 0;
+
+                for (; Digits < MaxDigits && c < End && IS_HEX(*c); ++Digits, ++c) {
+                    Value = (Value << 4) | (unsigned int)(*c <= '9' ? *c - '0' : (*c | 0x20) - 'a' + 10);
+                }
+
+                if (!Digits) Value = (unsigned char)Escape;
+                else if (Escape == 'x') Value &= 0xFF;
+                else *Unicode = true;
+
+            } break;
+
+            default:
+            {
+                if (Escape >= '0' && Escape <= '7') {
+                    Value = Escape - '0';
+                    for (int i = 1; i < 3 && c < End && *c >= '0' && *c <= '7'; ++i) Value = Value * 8 + (*c++ - '0');
+                    Value &= 0xFF;
+                }
+                else {
+                    Value = (unsigned char)Escape;      // \\, \', \", \? and unknown escapes
+                }
+            } break;
+        }
+    }
+
+    *At = c;
+    return Value;
+}
+
+// Strings and char literals. An escaped character never ends them.
+template <bool Bounded, char Quote, typename Policy>
+static inline void LexString(token* Token, char* c, char* End) {
+    char* Start = c;
+    ++c;
+
+    for (;;) {
+        c = FindStringStop<Bounded, Quote, Policy::Escapes>(c, End);
+        if (!Policy::Escapes || TK_PEEK(0) != '\\') break;
+
+        c += TK_PEEK(1) ? 2 : 1;
+    }
+
+    Token->Text = Start;
+
+    if (Quote == '"') {
+        Token->Type = TOKEN_STRING;
+    }
+    else {
+        const char* Body = Start + 1;
+        bool Unicode;
+
+        Token->Type = TOKEN_CHAR;
+
+        if (Policy::ConvertNumbers && Body < c) {
+            Token->Int = Policy::Escapes ? DecodeChar(&Body, c, &Unicode) : (unsigned char)*Body;
+        }
+    }
+
+    if (TK_PEEK(0) == Quote) {
+        ++c;
+    }
+
+    Token->Length = c - Start;
+}
+
+// Newlines inside a string or char literal, the only tokens that can span lines. The lexer counts
+// them, so past the token the line is this much higher than the one the token starts on.
+static inline int CountTokenNewLines(const token* Token) {
+    if (Token->Type != TOKEN_STRING && Token->Type != TOKEN_CHAR) return 0;
+
+    int Count = 0;
+    const char* c = Token->Text;
+    const char* End = c + Token->Length;
+
+    while ((c = (const char*)memchr(c, '\n', End - c)) != 0) {
+        ++Count;
+        ++c;
+    }
+
+    return Count;
+}
+
+// FNV-1a, one byte at a time so identifiers can be hashed in the loop that finds their end.
+#define TK_HASH_SEED 2166136261u
+#define TK_HASH_BYTE(Hash, Ch) (((Hash) ^ (unsigned char)(Ch)) * 16777619u)
+
+static inline unsigned int TkHash(const char* Text, int Length) {
+    unsigned int Hash = TK_HASH_SEED;
+    for (int i = 0; i < Length; ++i) Hash = TK_HASH_BYTE(Hash, Text[i]);
+    return Hash;
+}
+
+// Up to 19 digits fit in the mantissa. Leading zeros aren't counted, the digits that don't fit are
+// counted in 'Dropped'.
+template <bool Bounded>
+static inline char* ScanDigits(char* c, char* End, unsigned long long* Mantissa, int* Digits, int* Dropped) {
+
+    char Ch = TK_PEEK(0);
+
+    for (; IS_DIGIT(Ch); Ch = TK_PEEK(1), ++c) {
+
+#ifdef TOKENIZER_SWAR
+        // Once the leading zeros are gone, take 8 digits at once while they fit. The load must not
+        // cross the end of the data, or a page when the data is '\0'-terminated.
+        while (*Mantissa && *Digits <= 19 - 8 && (Bounded ? End - c >= 8 : ((size_t)c & 4095) <= 4096 - 8)) {
+            unsigned long long Chunk;
+            memcpy(&Chunk, c, 8);
+
+            // Digits are 0x30..0x39: the high nibble is 3, and adding 6 doesn't carry into it.
+            if ((((Chunk & 0xF0F0F0F0F0F0F0F0ull) | (((Chunk + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) != 0x3333333333333333ull)) {
+                break;
+            }
+
+            Chunk -= 0x3030303030303030ull;
+            Chunk = (Chunk * 10) + (Chunk >> 8);
+            Chunk = (((Chunk & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+                     (((Chunk >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+
+            *Mantissa = *Mantissa * 100000000 + (unsigned int)Chunk;
+            *Digits += 8;
+            c += 8;
+        }
+
+        Ch = TK_PEEK(0);
+        if (!IS_DIGIT(Ch)) break;
+#endif
+
+        if (*Digits < 19) {
+            *Mantissa = *Mantissa * 10 + (Ch - '0');
+            if (*Mantissa) ++*Digits;
+        }
+        else {
+            ++*Dropped;
+        }
+    }
+
+    return c;
+}
+
+template <bool Bounded>
+static inline char* SkipDigits(char* c, char* End) {
+    while (IS_DIGIT(TK_PEEK(0))) ++c;
+    return c;
+}
+
+// Powers of ten that are exact in a double.
+static const double TkPowersOf10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// strtod in the C locale: with another one set by setlocale, the '.' might not be the decimal point.
+static double TkStrtod(const char* Text) {
+#ifdef _WIN32
+    static _locale_t Locale = _create_locale(LC_NUMERIC, "C");
+    return Locale ? _strtod_l(Text, 0, Locale) : strtod(Text, 0);
+#else
+    static locale_t Locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0);
+    return Locale ? strtod_l(Text, 0, Locale) : strtod(Text, 0);
+#endif
+}
+
+// strtod would go on past the end of the literal, so it only gets to see the literal itself. Returns
+// NaN, which no literal gives, if there's no memory for a copy of a long one.
+static double ParseFloat(char* Text, int Length) {
+    char Literal[128];
+    char* Number = Length < (int)sizeof(Literal) ? Literal : (char*)TOKENIZER_MALLOC(Length + 1);
+    if (!Number) {
+        return NAN;
+    }
+
+    memcpy(Number, Text, Length);
+    Number[Length] = 0;
+
+    double Value = TkStrtod(Number);
+
+    if (Number != Literal) {
+        TOKENIZER_FREE(Number);
+    }
+
+    return Value;
+}
+
+// Decimal and hex integers, decimal floats, with C suffixes. 'c' is on the first digit, 'Token->Text'
+// on the '.' before it, if any. Integers too big for a long long saturate to its maximum.
+template <bool Bounded, typename Policy>
+static inline void LexNumber(token* Token, char* c, char* End) {
+
+    unsigned long long Mantissa = 0;
+    const unsigned long long MaxInt = ~0ull >> 1;
+
+    if (c == Token->Text && TK_PEEK(0) == '0' && (TK_PEEK(1) == 'x' || TK_PEEK(1) == 'X') && IS_HEX(TK_PEEK(2))) {
+
+        bool Overflow = false;
+        c += 2;
+
+        for (char Ch = TK_PEEK(0); IS_HEX(Ch); Ch = TK_PEEK(1), ++c) {
+            Overflow |= (Mantissa >> 59) != 0;
+            Mantissa = (Mantissa << 4) | (unsigned int)(Ch <= '9' ? Ch - '0' : (Ch | 0x20) - 'a' + 10);
+        }
+
+        while (TK_PEEK(0) == 'u' || TK_PEEK(0) == 'U' || TK_PEEK(0) == 'l' || TK_PEEK(0) == 'L') ++c;
+
+        Token->Type = TOKEN_INTEGER;
+        if (Policy::ConvertNumbers) Token->Int = (Overflow || Mantissa > MaxInt) ? (long long int)MaxInt : (long long int)Mantissa;
+        Token->Length = c - Token->Text;
+        return;
+    }
+
+    // The value is Mantissa * 10^Exponent.
+    int Digits = 0;
+    int Dropped = 0;
+    int Exponent = 0;
+    bool IsFloat = c != Token->Text;
+
+    if (!IsFloat) {
+        c = Policy::ConvertNumbers ? ScanDigits<Bounded>(c, End, &Mantissa, &Digits, &Dropped) : SkipDigits<Bounded>(c, End);
+        Exponent = Dropped;
+
+        if (TK_PEEK(0) == '.') {
+            IsFloat = true;
+            ++c;
+        }
+    }
+
+    if (IsFloat) {
+        char* Fraction = c;
+        int IntegerDropped = Dropped;
+
+        c = Policy::ConvertNumbers ? ScanDigits<Bounded>(c, End, &Mantissa, &Digits, &Dropped) : SkipDigits<Bounded>(c, End);
+        Exponent -= (int)(c - Fraction) - (Dropped - IntegerDropped);
+    }
+
+    if (TK_PEEK(0) == 'e' || TK_PEEK(0) == 'E') {
+        char Sign = TK_PEEK(1);
+        int Skip = (Sign == '-' || Sign == '+') ? 2 : 1;
+
+        // Without digits the 'e' isn't part of the number.
+        if (IS_DIGIT(TK_PEEK(Skip))) {
+            int Value = 0;
+            IsFloat = true;
+            c += Skip;
+
+            for (char Ch = TK_PEEK(0); IS_DIGIT(Ch); Ch = TK_PEEK(1), ++c) {
+                if (Value < 100000) Value = Value * 10 + (Ch - '0');
+            }
+
+            Exponent += Sign == '-' ? -Value : Value;
+        }
+    }
+
+    if (TK_PEEK(0) == 'f' || TK_PEEK(0) == 'F') {
+        IsFloat = true;
+        ++c;
+    }
+    else if (IsFloat) {
+        if (TK_PEEK(0) == 'l' || TK_PEEK(0) == 'L') ++c;
+    }
+    else {
+        while (TK_PEEK(0) == 'u' || TK_PEEK(0) == 'U' || TK_PEEK(0) == 'l' || TK_PEEK(0) == 'L') ++c;
+    }
+
+    Token->Length = c - Token->Text;
+
+    if (!Policy::ConvertNumbers) {
+        Token->Type = IsFloat ? TOKEN_FLOAT : TOKEN_INTEGER;
+        return;
+    }
+
+    if (!IsFloat) {
+        Token->Type = TOKEN_INTEGER;
+        Token->Int = (Dropped || Mantissa > MaxInt) ? (long long int)MaxInt : (long long int)Mantissa;
+        return;
+    }
+
+    Token->Type = TOKEN_FLOAT;
+
+    // Both the mantissa and the power of ten are exact, so one multiplication or division rounds
+    // correctly. Everything else goes to strtod, in the C locale.
+    if (!Dropped && Mantissa <= (1ull << 53) && Exponent >= -22 && Exponent <= 22) {
+        double Value = (double)Mantissa;
+        Token->Float = Exponent < 0 ? Value / TkPowersOf10[-Exponent] : Value * TkPowersOf10[Exponent];
+    }
+    else {
+        Token->Float = ParseFloat(Token->Text, Token->Length);
+    }
+}
+
+#ifdef TOKENIZER_KEYWORDS
+
+// Keywords are found with a perfect hash of the length and four characters (first, second, middle and
+// last), so an identifier is compared to at most one keyword and never hashed in full.
+static constexpr const char* TkKeywords[] = { TOKENIZER_KEYWORDS };
+static constexpr int TkKeywordCount = sizeof(TkKeywords) / sizeof(TkKeywords[0]);
+
+static constexpr int TkKeywordLength(const char* Keyword) {
+    int Length = 0;
+    while (Keyword[Length]) ++Length;
+    return Length;
+}
+
+static constexpr unsigned int TkKeywordHash(unsigned int Seed, const char* Text, int Length) {
+    unsigned int Chars = (unsigned char)Text[0] | (unsigned char)Text[Length / 2] << 8 | (unsigned char)Text[Length - 1] << 16;
+    if (Length > 1) Chars |= (unsigned int)(unsigned char)Text[1] << 24;
+
+    unsigned int Hash = (Seed ^ ((unsigned int)Length * 0x9E3779B9u) ^ Chars) * 0x85EBCA6Bu;
+    Hash = (Hash ^ (Hash >> 15)) * 0xC2B2AE35u;
+    return Hash ^ (Hash >> 16);
+}
+
+static constexpr unsigned int TkHashKeyword(unsigned int Seed, const char* Keyword) {
+    return TkKeywordHash(Seed, Keyword, TkKeywordLength(Keyword));
+}
+
+struct tk_keyword_hash {
+    unsigned int Seed;
+    unsigned int Size;      // Power of two, 0 if no perfect hash was found
+};
+
+static constexpr bool TkIsPerfectHash(unsigned int Seed, unsigned int Size) {
+    unsigned int Slots[TkKeywordCount] = {};
+
+    for (int i = 0; i < TkKeywordCount; ++i) {
+        Slots[i] = TkHashKeyword(Seed, TkKeywords[i]) & (Size - 1);
+
+        for (int j = 0; j < i; ++j) {
+            if (Slots[j] == Slots[i]) return false;
+        }
+    }
+
+    return true;
+}
+
+// The smallest table (at least twice the keyword count) for which one of the first seeds has no collisions.
+static constexpr tk_keyword_hash TkFindKeywordHash() {
+    unsigned int Size = 1;
+    while (Size < 2 * TkKeywordCount) Size *= 2;
+
+    for (; Size <= 65536; Size *= 2) {
+        for (unsigned int Seed = 1; Seed <= 1024; ++Seed) {
+            if (TkIsPerfectHash(Seed, Size)) return { Seed, Size };
+        }
+    }
+
+    return { 0, 0 };
+}
+
+static constexpr tk_keyword_hash TkKeywordHashParams = TkFindKeywordHash();
+
+static_assert(TkKeywordHashParams.Size != 0, "TOKENIZER_KEYWORDS: no perfect hash found, look for duplicate keywords or "
+                                             "keywords with the same length and first, second, middle and last characters");
+
+template <unsigned int Size>
+struct tk_keyword_table {
+    unsigned short Slots[Size];             // Keyword index + 1, 0 if empty
+    int Lengths[TkKeywordCount];
+    int MinLength;
+    int MaxLength;
+
+    constexpr tk_keyword_table() : Slots(), Lengths(), MinLength(0), MaxLength(0) {
+        MinLength = TkKeywordLength(TkKeywords[0]);
+
+        for (int i = 0; i < TkKeywordCount; ++i) {
+            Slots[TkHashKeyword(TkKeywordHashParams.Seed, TkKeywords[i]) & (Size - 1)] = (unsigned short)(i + 1);
+            Lengths[i] = TkKeywordLength(TkKeywords[i]);
+
+            if (Lengths[i] < MinLength) MinLength = Lengths[i];
+            if (Lengths[i] > MaxLength) MaxLength = Lengths[i];
+        }
+    }
+};
+
+static_assert(TkKeywordCount < 65536, "TOKENIZER_KEYWORDS: too many keywords");
+
+static constexpr tk_keyword_table<TkKeywordHashParams.Size> TkKeywordTable{};
+
+// Returns the index of the keyword, -1 if 'Text' isn't one.
+static inline int FindKeyword(const char* Text, int Length) {
+
+    if (Length < TkKeywordTable.MinLength || Length > TkKeywordTable.MaxLength) {
+        return -1;
+    }
+
+    unsigned int Slot = TkKeywordHash(TkKeywordHashParams.Seed, Text, Length) & (TkKeywordHashParams.Size - 1);
+    int Keyword = TkKeywordTable.Slots[Slot] - 1;
+
+    if (Keyword < 0 || TkKeywordTable.Lengths[Keyword] != Length || memcmp(TkKeywords[Keyword], Text, Length) != 0) {
+        return -1;
+    }
+
+    return Keyword;
+}
+
+#endif // TOKENIZER_KEYWORDS
+
+#ifdef TOKENIZER_KEYWORDS
+inline int tokenizer_policy::FindKeyword(const char* Text, int Length) {
+    return ::FindKeyword(Text, Length);
+}
+#else
+inline int tokenizer_policy::FindKeyword(const char*, int) {
+    return -1;
+}
+#endif
+
+// The rest of an identifier, from a non-ASCII character on, continuing 'Hash' if 'Intern'. Returns
+// where it ends.
+template <bool Bounded, bool Intern>
+static char* TkSkipUnicodeIdent(char* c, char* End, unsigned int* Hash) {
+    unsigned int H = *Hash;
+
+    for (;;) {
+        char Ch = TK_PEEK(0);
+        int Length = 1, Sequence;
+
+        if (!IS_LETTER(Ch) && !IS_DIGIT(Ch) && Ch != '_') {
+            if ((unsigned char)Ch < 0x80) break;
+
+            Length = TkUnicodeIdentChar<Bounded>(c, End, false, &Sequence);
+            if (!Length) break;
+        }
+
+        for (int i = 0; Intern && i < Length; ++i) H = TK_HASH_BYTE(H, c[i]);
+        c += Length;
+    }
+
+    *Hash = H;
+    return c;
+}
+
+// Identifiers, numbers and unknown characters. 'c' is already past the leading '.', if any.
+// With 'Intern', the hash of identifiers is stored in 'Hash'.
+template <bool Bounded, bool Intern, typename Policy>
+static inline void LexWord(token* Token, char* c, char* End, unsigned int* Hash) {
+
+    char Ch = TK_PEEK(0);
+    int Sequence = 0;
+
+    if (IS_LETTER(Ch) || Ch == '_' || (Policy::Utf8 && (unsigned char)Ch >= 0x80 && TkUnicodeIdentChar<Bounded>(c, End, true, &Sequence))) {
+
+        Token->Type = TOKEN_IDENT;
+
+        if (Intern) {
+            unsigned int H = TkHash(Token->Text, (int)(c - Token->Text));
+
+            while (IS_LETTER(Ch) || IS_DIGIT(Ch) || Ch == '_') {
+                H = TK_HASH_BYTE(H, Ch);
+                Ch = TK_PEEK(1);
+                ++c;
+            }
+            *Hash = H;
+        }
+        else {
+            while (IS_LETTER(Ch) || IS_DIGIT(Ch) || Ch == '_') {
+                Ch = TK_PEEK(1);
+                ++c;
+            }
+        }
+
+        // ASCII identifiers end on an ASCII character, the rest is only looked at after a byte >= 0x80.
+        if (Policy::Utf8 && (unsigned char)Ch >= 0x80) {
+            c = TkSkipUnicodeIdent<Bounded, Intern>(c, End, Hash);
+        }
+
+        Token->Length = c - Token->Text;
+
+        int Keyword = Policy::FindKeyword(Token->Text, Token->Length);
+        if (Keyword >= 0) {
+            Token->Type = TOKEN_KEYWORD;
+            Token->Keyword = Keyword;
+        }
+
+    } else if (IS_DIGIT(Ch)) {
+
+        LexNumber<Bounded, Policy>(Token, c, End);
+
+    } else {
+
+        // A whole character that can't start an identifier, or a single byte of malformed UTF-8.
+        Token->Type = TOKEN_UNKNOWN;
+        if (Sequence && c == Token->Text) Token->Length = Sequence;
+    }
+}
+
+template <bool Bounded, bool Intern, typename Policy = tokenizer_policy>
+static inline void LexTokenSwitch(token* Token, char* c, char* End, unsigned int* Hash) {
+
+    switch(TK_PEEK(0)) {
+
+        case '\0': { Token->Type = TOKEN_EOS; }           break;
+        case '(':  { Token->Type = TOKEN_OPEN_PAREN; }    break;
+        case ')':  { Token->Type = TOKEN_CLOSE_PAREN; }   break;
+        case ';':  { Token->Type = TOKEN_SEMICOLON; }     break;
+        case '[':  { Token->Type = TOKEN_OPEN_BRACKET; }  break;
+        case ']':  { Token->Type = TOKEN_CLOSE_BRACKET; } break;
+        case '{':  { Token->Type = TOKEN_OPEN_BRACE; }    break;
+        case '}':  { Token->Type = TOKEN_CLOSE_BRACE; }   break;
+        case ',':  { Token->Type = TOKEN_COMMA; }         break;
+        case '$':  { Token->Type = TOKEN_DOLLAR_SIGN; }   break;
+        case '#':  { Token->Type = TOKEN_HASHTAG; }       break;
+        case '\\': { Token->Type = TOKEN_BACKSLASH; }     break;
+
+        case ':':
+        {
+            ++Token->Length;
+            if (TK_PEEK(1) && TK_PEEK(1) == ':') Token->Type = TOKEN_COLON_COLON;
+            else { Token->Type = TOKEN_COLON; Token->Length = 1; }
+
+        } break;
+        case '=':
+        {
+            ++Token->Length;
+            if (TK_PEEK(1) && TK_PEEK(1) == '=') Token->Type = TOKEN_EQUAL_EQUAL;
+            else { Token->Type = TOKEN_EQUAL; Token->Length = 1; }
+
+        } break;
+        case '>':
+        {
+            ++Token->Length;
+            if (TK_PEEK(1) && TK_PEEK(1) == '=') Token->Type = TOKEN_GREATER_EQUAL;
+            else if (TK_PEEK(1) && TK_PEEK(1) == '>') {
+                Token->Type = TOKEN_RIGHT_SHIFT;
+
+                if (TK_PEEK(2) && TK_PEEK(2) == '=') {
+                    Token->Type = TOKEN_RIGHT_SHIFT_EQUAL;
+                    Token->Length = 3;
+                }
+            }
+            else { Token->Type = TOKEN_CLOSE_ANG_BRACKET; Token->Length = 1; }
+
+        } break;
+        case '<':
+        {
+            ++Token->Length;
+            if (TK_PEEK(1) && TK_PEEK(1) == '=') Token->Type = TOKEN_LESS_EQUAL;
+            else if (TK_PEEK(1) && TK_PEEK(1) == '<') {
+                Token->Type = TOKEN_LEFT_SHIFT;
+
+                if (TK_PEEK(2) && TK_PEEK(2) == '=') {
+                    Token->Type = TOKEN_LEFT_SHIFT_EQUAL;
+                    Token->Length = 3;
+                }
+            }
+            else { Token->Type = TOKEN_OPEN_ANG_BRACKET; Token->Length = 1; }
+
+        } break;
+        case '/': {
+
+            ++Token->Length;
+            if (TK_PEEK(1) && TK_PEEK(1) == '=') Token->Type = TOKEN_DIV_EQUAL;
+            else { Token->Type = TOKEN_FORWARD_SLASH; Token->Length = 1; }
+
+        } break;
+        case '+':
+        {
+            ++Token->Length;
+            if (TK_PEEK(1) && TK_PEEK(1) == '=') Token->Type = TOKEN_PLUS_EQUAL;
+            else if (TK_PEEK(1) && TK_PEEK(1) == '+') Token->Type = TOKEN_PLUS_PLUS;
+            else { Token->Type = TOKEN_PLUS; Token->Length = 1; }
+
+        } break;
+        case '-':
+        {
+            ++Token->Length;
+            if (TK_PEEK(1) && TK_PEEK(1) == '=') Token->Type = TOKEN_MINUS_EQUAL;
+            else if (TK_PEEK(1) && TK_PEEK(1) == '-') Token->Type = TOKEN_MINUS_MINUS;
+            else if (TK_PEEK(1) && TK_PEEK(1) == '>') Token->Type = TOKEN_ARROW;
+            else { Token->Type = TOKEN_MINUS; Token->Length = 1; }
+
+        } break;
+        case '*':
+        {
+            ++Token->Length;
+            if (TK_PEEK(1) && TK_PEEK(1) == '=') Token->Type = TOKEN_MUL_EQUAL;
+            else { Token->Type = TOKEN_ASTERISK; Token->Length = 1; }
+
+        } break;
+        case '^':
+        {
+            ++Token->Length;
+            if (TK_PEEK(1) && TK_PEEK(1) == '=') Token->Type = TOKEN_XOR_EQUAL;
+            else { Token->Type = TOKEN_XOR; Token->Length = 1; }
+
+        } break;
+        case '&':
+        {
+            ++Token->Length;
+            if (TK_PEEK(1) && TK_PEEK(1) == '=') Token->Type = TOKEN_AND_EQUAL;
+            else if (TK_PEEK(1) && TK_PEEK(1) == '&') Token->Type = TOKEN_AND_AND;
+            else { Token->Type = TOKEN_AND; Token->Length = 1; }
+
+        } break;
+        case '|':
+        {
+            ++Token->Length;
+            if (TK_PEEK(1) && TK_PEEK(1) == '=') Token->Type = TOKEN_OR_EQUAL;
+            else if (TK_PEEK(1) && TK_PEEK(1) == '|') Token->Type = TOKEN_OR_OR;
+            else { Token->Type = TOKEN_OR; Token->Length = 1; }
+
+        } break;
+        case '~':
+        {
+            ++Token->Length;
+            if (TK_PEEK(1) && TK_PEEK(1) == '=') Token->Type = TOKEN_LOGIC_NOT_EQUAL;
+            else { Token->Type = TOKEN_LOGIC_NOT; Token->Length = 1; }
+
+        } break;
+        case '%':
+        {
+            ++Token->Length;
+            if (TK_PEEK(1) && TK_PEEK(1) == '=') Token->Type = TOKEN_MOD_EQUAL;
+            else { Token->Type = TOKEN_MOD; Token->Length = 1; }
+
+        } break;
+        case '!':
+        {
+            ++Token->Length;
+            if (TK_PEEK(1) && TK_PEEK(1) == '=') Token->Type = TOKEN_NOT_EQUAL;
+            else { Token->Type = TOKEN_NOT; Token->Length = 1; }
+
+        } break;
+
+        case '"':
+        {
+            LexString<Bounded, '"', Policy>(Token, c, End);
+
+        } break;
+        case '\'':
+        {
+            LexString<Bounded, '\'', Policy>(Token, c, End);
+
+        } break;
+        case '.':
+        {
+            // Fallthrough as we could parse either a number or a string
+            ++c;
+        }
+        // fallthrough
+
+        default:
+        {
+            LexWord<Bounded, Intern, Policy>(Token, c, End, Hash);
+
+        } break;
+    }
+}
+
+
+// Table-driven alternative to the switch above (#define TOKENIZER_USE_DFA). Every byte is first mapped
+// to a character class, then operators are matched by walking a small state-transition table built from
+// 'TkOperators', so two- and three-character operators don't need nested branches.
+// Both engines produce exactly the same tokens.
+
+static const struct {
+    const char* Text;
+    token_type Type;
+} TkOperators[] = {
+    { "(", TOKEN_OPEN_PAREN },   { ")", TOKEN_CLOSE_PAREN },     { ";", TOKEN_SEMICOLON },
+    { "[", TOKEN_OPEN_BRACKET }, { "]", TOKEN_CLOSE_BRACKET },   { "{", TOKEN_OPEN_BRACE },
+    { "}", TOKEN_CLOSE_BRACE },  { ",", TOKEN_COMMA },           { "$", TOKEN_DOLLAR_SIGN },
+    { "#", TOKEN_HASHTAG },      { "\\", TOKEN_BACKSLASH },
+    { ":", TOKEN_COLON },        { "::", TOKEN_COLON_COLON },
+    { "=", TOKEN_EQUAL },        { "==", TOKEN_EQUAL_EQUAL },
+    { ">", TOKEN_CLOSE_ANG_BRACKET }, { ">=", TOKEN_GREATER_EQUAL },
+    { ">>", TOKEN_RIGHT_SHIFT }, { ">>=", TOKEN_RIGHT_SHIFT_EQUAL },
+    { "<", TOKEN_OPEN_ANG_BRACKET },  { "<=", TOKEN_LESS_EQUAL },
+    { "<<", TOKEN_LEFT_SHIFT },  { "<<=", TOKEN_LEFT_SHIFT_EQUAL },
+    { "/", TOKEN_FORWARD_SLASH }, { "/=", TOKEN_DIV_EQUAL },
+    { "+", TOKEN_PLUS },         { "+=", TOKEN_PLUS_EQUAL },     { "++", TOKEN_PLUS_PLUS },
+    { "-", TOKEN_MINUS },        { "-=", TOKEN_MINUS_EQUAL },    { "--", TOKEN_MINUS_MINUS },
+    { "->", TOKEN_ARROW },
+    { "*", TOKEN_ASTERISK },     { "*=", TOKEN_MUL_EQUAL },
+    { "^", TOKEN_XOR },          { "^=", TOKEN_XOR_EQUAL },
+    { "&", TOKEN_AND },          { "&=", TOKEN_AND_EQUAL },      { "&&", TOKEN_AND_AND },
+    { "|", TOKEN_OR },           { "|=", TOKEN_OR_EQUAL },       { "||", TOKEN_OR_OR },
+    { "~", TOKEN_LOGIC_NOT },    { "~=", TOKEN_LOGIC_NOT_EQUAL },
+    { "%", TOKEN_MOD },          { "%=", TOKEN_MOD_EQUAL },
+    { "!", TOKEN_NOT },          { "!=", TOKEN_NOT_EQUAL },
+};
+
+#define TOKENIZER_OPERATOR_COUNT (sizeof(TkOperators) / sizeof(TkOperators[0]))
+
+enum {
+    TK_CLASS_OTHER,
+    TK_CLASS_EOS,
+    TK_CLASS_LETTER,
+    TK_CLASS_DIGIT,
+    TK_CLASS_DOT,
+    TK_CLASS_QUOTE,
+    TK_CLASS_OPERATOR,  // First class given to operator characters
+
+    TK_MAX_CLASSES = 64,
+    TK_MAX_STATES = 128,
+};
+
+struct tokenizer_dfa {
+    unsigned char Class[256];
+
+    // State 0 is the start state, a transition to 0 means "no transition".
+    unsigned char Next[TK_MAX_STATES][TK_MAX_CLASSES];
+    unsigned char Accept[TK_MAX_STATES];  // token_type of the operator ending in this state, or TOKEN_UNKNOWN
+
+    int ClassCount;
+    int StateCount;
+
+    tokenizer_dfa() {
+        memset(this, 0, sizeof(*this));
+
+        for (int i = 'a'; i <= 'z'; ++i) Class[i] = TK_CLASS_LETTER;
+        for (int i = 'A'; i <= 'Z'; ++i) Class[i] = TK_CLASS_LETTER;
+        for (int i = '0'; i <= '9'; ++i) Class[i] = TK_CLASS_DIGIT;
+        Class['_'] = TK_CLASS_LETTER;
+        Class['.'] = TK_CLASS_DOT;
+        Class['"'] = TK_CLASS_QUOTE;
+        Class['\''] = TK_CLASS_QUOTE;
+        Class[0] = TK_CLASS_EOS;
+
+        ClassCount = TK_CLASS_OPERATOR;
+        StateCount = 1;
+
+        for (int i = 0; i < (int)TOKENIZER_OPERATOR_COUNT; ++i) {
+            int State = 0;
+
+            for (const char* c = TkOperators[i].Text; *c; ++c) {
+                unsigned char Ch = (unsigned char)*c;
+                if (!Class[Ch]) Class[Ch] = (unsigned char)ClassCount++;
+
+                unsigned char* To = &Next[State][Class[Ch]];
+                if (!*To) *To = (unsigned char)StateCount++;
+                State = *To;
+            }
+
+            Accept[State] = (unsigned char)TkOperators[i].Type;
+        }
+    }
+};
+
+static const tokenizer_dfa TkDfa;
+
+template <bool Bounded, bool Intern, typename Policy = tokenizer_policy>
+static inline void LexTokenDfa(token* Token, char* c, char* End, unsigned int* Hash) {
+
+    int Class = TkDfa.Class[(unsigned char)TK_PEEK(0)];
+
+    if (Class >= TK_CLASS_OPERATOR) {
+
+        // Every prefix of a built-in operator is an operator too, so the last state reached is the match.
+        int State = TkDfa.Next[0][Class];
+        int Length = 1;
+
+        while (int To = TkDfa.Next[State][TkDfa.Class[(unsigned char)TK_PEEK(Length)]]) {
+            State = To;
+            ++Length;
+        }
+
+        Token->Type = (token_type)TkDfa.Accept[State];
+        Token->Length = Length;
+        return;
+    }
+
+    switch (Class) {
+        case TK_CLASS_EOS:   { Token->Type = TOKEN_EOS; }     break;
+        case TK_CLASS_QUOTE: {
+            if (*c == '"') LexString<Bounded, '"', Policy>(Token, c, End);
+            else LexString<Bounded, '\'', Policy>(Token, c, End);
+        } break;
+        case TK_CLASS_DOT:   { LexWord<Bounded, Intern, Policy>(Token, c + 1, End, Hash); } break;
+        default:             { LexWord<Bounded, Intern, Policy>(Token, c, End, Hash); }     break;
+    }
+}
+
+
+// The operators of a tokenizer_operators are added to the same kind of state machine as TkDfa, built at
+// run time and sized to fit. Operators can share prefixes that aren't operators themselves ("..." without
+// ".."), so the walk remembers the last accepting state.
+
+static bool IsOperatorChar(char Ch) {
+    return Ch && !IS_WHITE(Ch) && !IS_LETTER(Ch) && !IS_DIGIT(Ch) && Ch != '_' && Ch != '"' && Ch != '\'';
+}
+
+static void AddOperatorClasses(tokenizer_operators* Operators, const char* Text) {
+    for (const char* c = Text; *c; ++c) {
+        unsigned char Ch = (unsigned char)*c;
+        if (!Operators->Class[Ch]) Operators->Class[Ch] = (unsigned char)Operators->ClassCount++;
+    }
+}
+
+static void AddOperatorStates(tokenizer_operators* Operators, const char* Text, token_type Type, int Id) {
+    int State = 0;
+
+    for (const char* c = Text; *c; ++c) {
+        unsigned short* To = &Operators->Next[State * Operators->ClassCount + Operators->Class[(unsigned char)*c]];
+        if (!*To) *To = (unsigned short)Operators->StateCount++;
+        State = *To;
+    }
+
+    Operators->Types[State] = (unsigned char)Type;
+    Operators->Ids[State] = Id;
+}
+
+TOKENIZER_DEF bool InitOperators(tokenizer_operators* Operators, const tokenizer_operator* List, int Count) {
+    memset(Operators, 0, sizeof(*Operators));
+    Operators->ClassCount = 1;
+
+    int Characters = 0;
+
+    for (int i = 0; i < (int)TOKENIZER_OPERATOR_COUNT; ++i) {
+        AddOperatorClasses(Operators, TkOperators[i].Text);
+        Characters += (int)strlen(TkOperators[i].Text);
+    }
+
+    for (int i = 0; i < Count; ++i) {
+        const char* Text = List[i].Text;
+        int Length = (int)strlen(Text);
+
+        for (int j = 0; j < Length; ++j) {
+            if (!IsOperatorChar(Text[j])) return false;
+        }
+
+        if (!Length || strstr(Text, "//") || strstr(Text, "/*")) {
+            return false;
+        }
+
+        AddOperatorClasses(Operators, Text);
+        Characters += Length;
+
+        if (Length > Operators->MaxLength) Operators->MaxLength = Length;
+
+        unsigned char Ch = (unsigned char)Text[0];
+        Operators->First[Ch >> 5] |= 1u << (Ch & 31);
+    }
+
+    // At most one state per character, plus the start state.
+    int Capacity = Characters + 1;
+    if (Capacity > 65535) {
+        return false;
+    }
+
+    Operators->Next = (unsigned short*)TOKENIZER_MALLOC(Capacity * Operators->ClassCount * sizeof(unsigned short));
+    Operators->Types = (unsigned char*)TOKENIZER_MALLOC(Capacity);
+    Operators->Ids = (int*)TOKENIZER_MALLOC(Capacity * sizeof(int));
+
+    if (!Operators->Next || !Operators->Types || !Operators->Ids) {
+        FreeOperators(Operators);
+        return false;
+    }
+
+    memset(Operators->Next, 0, Capacity * Operators->ClassCount * sizeof(unsigned short));
+    memset(Operators->Types, TOKEN_UNKNOWN, Capacity);
+    memset(Operators->Ids, 0, Capacity * sizeof(int));
+    Operators->StateCount = 1;
+
+    // Extra operators go last, so they replace the built-in ones with the same text.
+    for (int i = 0; i < (int)TOKENIZER_OPERATOR_COUNT; ++i) {
+        AddOperatorStates(Operators, TkOperators[i].Text, TkOperators[i].Type, 0);
+    }
+
+    for (int i = 0; i < Count; ++i) {
+        AddOperatorStates(Operators, List[i].Text, TOKEN_OPERATOR, List[i].Id);
+    }
+
+    return true;
+}
+
+TOKENIZER_DEF void FreeOperators(tokenizer_operators* Operators) {
+    TOKENIZER_FREE(Operators->Next);
+    TOKENIZER_FREE(Operators->Types);
+    TOKENIZER_FREE(Operators->Ids);
+    memset(Operators, 0, sizeof(*Operators));
+}
+
+// The longest operator at 'c', built-in or not. Returns false if there is none, or if a number starts here.
+template <bool Bounded>
+static inline bool LexOperator(token* Token, char* c, char* End, tokenizer_operators* Operators) {
+
+    if (*c == '.' && IS_DIGIT(TK_PEEK(1))) {
+        return false;
+    }
+
+    int State = 0;
+    int Length = 0;
+    int Match = 0;
+    int MatchState = 0;
+
+    while (int To = Operators->Next[State * Operators->ClassCount + Operators->Class[(unsigned char)TK_PEEK(Length)]]) {
+        State = To;
+        ++Length;
+
+        if (Operators->Types[State] != TOKEN_UNKNOWN) {
+            Match = Length;
+            MatchState = State;
+        }
+    }
+
+    if (!Match) {
+        return false;
+    }
+
+    Token->Type = (token_type)Operators->Types[MatchState];
+    Token->Length = Match;
+    if (Token->Type == TOKEN_OPERATOR) Token->Operator = Operators->Ids[MatchState];
+
+    return true;
+}
+
+static unsigned int InternHashed(tokenizer_interner* Interner, const char* Text, int Length, unsigned int Hash);
+
+template <bool Bounded, bool Intern, bool CountLines, typename Policy>
+static inline token LexToken(tokenizer *Tokenizer, char* At, char* End, int* Line) {
+
+    char *c = SkipBlanks<Bounded, CountLines, Policy>(At, End, Line);
+
+    token Token;
+    Token.Type = TOKEN_UNKNOWN;
+    Token.Length = 1;
+    Token.Text = c;
+    Token.Int = 0;
+
+    unsigned int Hash = 0;
+
+    // Only the characters starting an extra operator take the slower path.
+    tokenizer_operators* Operators = Tokenizer->Operators;
+    unsigned char First = (unsigned char)TK_PEEK(0);
+
+    if (Operators && (Operators->First[First >> 5] & (1u << (First & 31))) && LexOperator<Bounded>(&Token, c, End, Operators)) {
+        return Token;
+    }
+
+#ifdef TOKENIZER_USE_DFA
+    LexTokenDfa<Bounded, Intern, Policy>(&Token, c, End, &Hash);
+#else
+    LexTokenSwitch<Bounded, Intern, Policy>(&Token, c, End, &Hash);
+#endif
+
+    if (Intern && Token.Type == TOKEN_IDENT) {
+        Token.Atom = InternHashed(Tokenizer->Interner, Token.Text, Token.Length, Hash);
+        if (!Token.Atom) {
+            SetError(Tokenizer, "Out of memory for the interner");
+        }
+    }
+
+    // See ParseFloat.
+    if (Policy::ConvertNumbers && Token.Type == TOKEN_FLOAT && Token.Float != Token.Float) {
+        SetError(Tokenizer, "Out of memory for a float literal");
+    }
+
+    if (CountLines) {
+        *Line += CountTokenNewLines(&Token);
+    }
+
+    return Token;
+}
+
+// Lexes the token starting at (or after the whitespaces at) 'At'. 'Line' is updated with the lines skipped,
+// and the ones inside the token (see CountTokenNewLines).
+// Without Policy::CountLines, the last four cases are the same functions as the first four.
+template <typename Policy = tokenizer_policy>
+static token LexNextToken(tokenizer *Tokenizer, char* At, int* Line) {
+
+    char* End = Tokenizer->End;
+    int Mode = (End ? 1 : 0) | (Tokenizer->Interner ? 2 : 0) | (Tokenizer->CountLines ? 4 : 0);
+    const bool Lines = Policy::CountLines;
+
+    switch (Mode) {
+        case 0:  return LexToken<false, false, false, Policy>(Tokenizer, At, End, Line);
+        case 1:  return LexToken<true, false, false, Policy>(Tokenizer, At, End, Line);
+        case 2:  return LexToken<false, true, false, Policy>(Tokenizer, At, End, Line);
+        case 3:  return LexToken<true, true, false, Policy>(Tokenizer, At, End, Line);
+        case 4:  return LexToken<false, false, Lines, Policy>(Tokenizer, At, End, Line);
+        case 5:  return LexToken<true, false, Lines, Policy>(Tokenizer, At, End, Line);
+        case 6:  return LexToken<false, true, Lines, Policy>(Tokenizer, At, End, Line);
+        default: return LexToken<true, true, Lines, Policy>(Tokenizer, At, End, Line);
+    }
+}
+
+#ifdef TOKENIZER_STATS
+// LexNextToken, adding up the counters. The blanks are skipped twice, once here to measure the
+// comments, so the lexer itself stays the same.
+template <typename Policy>
+static token LexNextTokenCounted(tokenizer *Tokenizer, char* At, int* Line) {
+    tokenizer_stats* Stats = Tokenizer->Stats;
+    char* End = Tokenizer->End;
+
+    long long CommentBytes = 0;
+    char* c = End ? SkipBlanks<true, false, Policy>(At, End, 0, &CommentBytes)
+                  : SkipBlanks<false, false, Policy>(At, End, 0, &CommentBytes);
+
+    char First = End && c >= End ? 0 : *c;
+    bool Number = IS_DIGIT(First) || First == '.' || First == '\'';
+
+    std::chrono::steady_clock::time_point Start;
+    if (Number) Start = std::chrono::steady_clock::now();
+
+    token Token = LexNextToken<Policy>(Tokenizer, At, Line);
+
+    if (Token.Type == TOKEN_INTEGER || Token.Type == TOKEN_FLOAT || Token.Type == TOKEN_CHAR) {
+        ++Stats->Numbers;
+        if (Number) Stats->NumberSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+    }
+
+    Stats->WhitespaceBytes += (Token.Text - At) - CommentBytes;
+    Stats->CommentBytes += CommentBytes;
+    if (Token.Type != TOKEN_EOS) Stats->TokenBytes += Token.Length;
+    ++Stats->Types[Token.Type];
+
+    return Token;
+}
+#endif
+
+template <typename Policy = tokenizer_policy>
+static inline token NextToken(tokenizer *Tokenizer, char* At, int* Line) {
+#ifdef TOKENIZER_STATS
+    if (Tokenizer->Stats) return LexNextTokenCounted<Policy>(Tokenizer, At, Line);
+#endif
+    return LexNextToken<Policy>(Tokenizer, At, Line);
+}
+
+// The newlines NextToken counted inside 'Token', 0 if it doesn't count lines.
+template <typename Policy = tokenizer_policy>
+static inline int CountedNewLines(tokenizer* Tokenizer, const token* Token) {
+    return Policy::CountLines && Tokenizer->CountLines ? CountTokenNewLines(Token) : 0;
+}
+
+#ifdef TOKENIZER_STATS
+// The lookahead ring is stale and about to be dropped.
+static void CountRelexed(tokenizer* Tokenizer) {
+    if (Tokenizer->Stats) {
+        Tokenizer->Stats->RelexedTokens += Tokenizer->LookaheadCount;
+        Tokenizer->Stats->RelexedBytes += Tokenizer->LookaheadAt - Tokenizer->LookaheadFrom;
+    }
+}
+#endif
+
+template <typename Policy>
+static inline token GetTokenWith(tokenizer* Tokenizer) {
+
+#ifdef TOKENIZER_STATS
+    tokenizer_stats* Stats = Tokenizer->Stats;
+    if (Stats) ++Stats->Gets;
+#endif
+
+    if (Tokenizer->LookaheadCount) {
+
+        // Consume the token lexed by PeekToken, unless someone moved 'At' in the meantime.
+        if (Tokenizer->At == Tokenizer->LookaheadFrom) {
+            int Index = Tokenizer->LookaheadFirst;
+            token Token = Tokenizer->Lookahead[Index];
+
+            Tokenizer->Line = Tokenizer->LookaheadLines[Index];
+            Tokenizer->TokenNewLines = CountedNewLines<Policy>(Tokenizer, &Token);
+            Tokenizer->At = Token.Type == TOKEN_EOS ? Token.Text : Token.Text + Token.Length;
+
+            Tokenizer->LookaheadFirst = (Index + 1) & (TOKENIZER_LOOKAHEAD - 1);
+            Tokenizer->LookaheadFrom = Tokenizer->At;
+            --Tokenizer->LookaheadCount;
+
+#ifdef TOKENIZER_STATS
+            if (Stats) ++Stats->PeekHits;
+#endif
+            return Token;
+        }
+
+#ifdef TOKENIZER_STATS
+        CountRelexed(Tokenizer);
+#endif
+        Tokenizer->LookaheadCount = 0;
+    }
+
+    int Line = Tokenizer->Line + Tokenizer->TokenNewLines;
+    token Token = NextToken<Policy>(Tokenizer, Tokenizer->At, &Line);
+
+    Tokenizer->TokenNewLines = CountedNewLines<Policy>(Tokenizer, &Token);
+    Tokenizer->Line = Line - Tokenizer->TokenNewLines;
+
+    // Stay on the terminator: getting tokens past the end keeps returning TOKEN_EOS.
+    Tokenizer->At = Token.Type == TOKEN_EOS ? Token.Text : Token.Text + Token.Length;
+    return Token;
+}
+
+template <typename Policy>
+static inline token PeekTokenWith(tokenizer* Tokenizer, int Ahead) {
+    assert(Ahead >= 0 && Ahead < TOKENIZER_LOOKAHEAD);
+
+#ifdef TOKENIZER_STATS
+    if (Tokenizer->Stats) {
+        ++Tokenizer->Stats->Peeks;
+        if (Tokenizer->LookaheadCount && Tokenizer->At != Tokenizer->LookaheadFrom) CountRelexed(Tokenizer);
+    }
+#endif
+
+    if (!Tokenizer->LookaheadCount || Tokenizer->At != Tokenizer->LookaheadFrom) {
+        Tokenizer->LookaheadFirst = 0;
+        Tokenizer->LookaheadCount = 0;
+        Tokenizer->LookaheadFrom = Tokenizer->At;
+        Tokenizer->LookaheadAt = Tokenizer->At;
+        Tokenizer->LookaheadLine = Tokenizer->Line + Tokenizer->TokenNewLines;
+    }
+
+    while (Tokenizer->LookaheadCount <= Ahead) {
+        int Index = (Tokenizer->LookaheadFirst + Tokenizer->LookaheadCount) & (TOKENIZER_LOOKAHEAD - 1);
+
+        token Token = NextToken<Policy>(Tokenizer, Tokenizer->LookaheadAt, &Tokenizer->LookaheadLine);
+
+        Tokenizer->Lookahead[Index] = Token;
+        Tokenizer->LookaheadLines[Index] = Tokenizer->LookaheadLine - CountedNewLines<Policy>(Tokenizer, &Token);
+        ++Tokenizer->LookaheadCount;
+
+        // Peeking past the end keeps returning TOKEN_EOS.
+        Tokenizer->LookaheadAt = Token.Type == TOKEN_EOS ? Token.Text : Token.Text + Token.Length;
+    }
+
+    return Tokenizer->Lookahead[(Tokenizer->LookaheadFirst + Ahead) & (TOKENIZER_LOOKAHEAD - 1)];
+}
+
+template <typename Policy>
+static inline bool OptionalTokenWith(tokenizer* Tokenizer, token_type Type, token* Optional) {
+    token Token = PeekTokenWith<Policy>(Tokenizer, 0);
+
+    if (Token.Type != Type) {
+        return false;
+    }
+    else {
+        GetTokenWith<Policy>(Tokenizer); // Just pops the token we peeked
+        if (Optional) *Optional = Token;
+    }
+
+    return true;
+}
+
+// Storing a diagnostic is a copy: nothing is formatted, and the line is only looked up if it's known.
+static void PushDiagnostic(tokenizer_diagnostics* Diagnostics, int Code, int Line, token Token, token_type Expected, const char* Message) {
+    if (Diagnostics->Count == Diagnostics->Capacity) {
+        if (Diagnostics->Arena) {
+            ++Diagnostics->Dropped;
+            return;
+        }
+
+        int Capacity = Diagnostics->Capacity ? Diagnostics->Capacity * 2 : 64;
+        tokenizer_diagnostic* Items = (tokenizer_diagnostic*)TOKENIZER_REALLOC(Diagnostics->Items, Capacity * sizeof(tokenizer_diagnostic));
+        if (!Items) {
+            ++Diagnostics->Dropped;
+            return;
+        }
+
+        Diagnostics->Items = Items;
+        Diagnostics->Capacity = Capacity;
+    }
+
+    tokenizer_diagnostic* Diagnostic = &Diagnostics->Items[Diagnostics->Count++];
+    Diagnostic->Code = Code;
+    Diagnostic->Line = Line;
+    Diagnostic->Token = Token;
+    Diagnostic->Expected = Expected;
+    Diagnostic->Message = Message;
+}
+
+template <typename Policy>
+static inline bool RequireTokenWith(tokenizer* Tokenizer, token_type Type, token* Required) {
+    token Token = PeekTokenWith<Policy>(Tokenizer, 0);
+
+    if (Token.Type != Type) {
+        if (Tokenizer->Diagnostics) {
+            int Line = Policy::CountLines && Tokenizer->CountLines ? Tokenizer->LookaheadLines[Tokenizer->LookaheadFirst] : 0;
+            PushDiagnostic(Tokenizer->Diagnostics, DIAGNOSTIC_UNEXPECTED_TOKEN, Line, Token, Type, 0);
+        }
+        else {
+            Tokenizer->Error = true;
+        }
+#ifdef TOKENIZER_LOG_ERRORS
+        int Line = Policy::CountLines && Tokenizer->CountLines ? Tokenizer->LookaheadLines[Tokenizer->LookaheadFirst] : GetTokenLocation(Tokenizer, Token).Line;
+        fprintf(stderr, "Token type mismatch at line %d: required token type is %s but current token type is %s.\n", Line, TokenTypes[Type], TokenTypes[Token.Type]);
+#endif
+        return false;
+    }
+    else {
+        GetTokenWith<Policy>(Tokenizer); // Just pops the token we peeked
+        if (Required) *Required = Token;
+    }
+
+    return true;
+}
+
+TOKENIZER_DEF token GetToken(tokenizer* Tokenizer) {
+    return GetTokenWith<tokenizer_policy>(Tokenizer);
+}
+
+TOKENIZER_DEF token PeekToken(tokenizer* Tokenizer, int Ahead) {
+    return PeekTokenWith<tokenizer_policy>(Tokenizer, Ahead);
+}
+
+TOKENIZER_DEF bool OptionalToken(tokenizer* Tokenizer, token_type Type, token* Optional) {
+    return OptionalTokenWith<tokenizer_policy>(Tokenizer, Type, Optional);
+}
+
+TOKENIZER_DEF bool RequireToken(tokenizer* Tokenizer, token_type Type, token* Required) {
+    return RequireTokenWith<tokenizer_policy>(Tokenizer, Type, Required);
+}
+
+template <typename Policy>
+token basic_tokenizer<Policy>::GetToken() {
+    return GetTokenWith<Policy>(this);
+}
+
+template <typename Policy>
+token basic_tokenizer<Policy>::PeekToken(int Ahead) {
+    return PeekTokenWith<Policy>(this, Ahead);
+}
+
+template <typename Policy>
+bool basic_tokenizer<Policy>::OptionalToken(token_type Type, token* Optional) {
+    return OptionalTokenWith<Policy>(this, Type, Optional);
+}
+
+template <typename Policy>
+bool basic_tokenizer<Policy>::RequireToken(token_type Type, token* Required) {
+    return RequireTokenWith<Policy>(this, Type, Required);
+}
+
+#ifdef TOKENIZER_RANGES
+
+template <typename Policy>
+const token_view& basic_token_iterator<Policy>::Lex() const {
+    if (Lexed) {
+        return Token;
+    }
+
+    Lexed = true;
+
+    // Same as a 'while (Parsing(&Tokenizer))' loop: nothing more is lexed after an error.
+    if (Tokenizer->Error) {
+        Token.Type = TOKEN_EOS;
+        return Token;
+    }
+
+    token Next = GetTokenWith<Policy>(Tokenizer);
+    Token.Type = Next.Type;
+    Token.Text = std::string_view(Next.Text, (size_t)Next.Length);
+    Token.Int = Next.Int;
+    return Token;
+}
+
+template <typename Policy>
+basic_token_iterator<Policy> basic_token_range<Policy>::begin() const {
+    basic_token_iterator<Policy> Iterator;
+    Iterator.Tokenizer = Tokenizer;
+    return Iterator;
+}
+
+#endif
+
+TOKENIZER_DEF void SetError(tokenizer *Tokenizer, const char* Message) {
+    Tokenizer->Error = true;
+
+    if (Tokenizer->Diagnostics) {
+        token Here;
+        Here.Text = Tokenizer->At;
+        PushDiagnostic(Tokenizer->Diagnostics, DIAGNOSTIC_ERROR, Tokenizer->CountLines ? Tokenizer->Line + Tokenizer->TokenNewLines : 0, Here, TOKEN_UNKNOWN, Message);
+    }
+#ifdef TOKENIZER_LOG_ERRORS
+    int Line = Tokenizer->Line + Tokenizer->TokenNewLines;
+    if (!Tokenizer->CountLines && Tokenizer->Start) {
+        token Here;
+        Here.Text = Tokenizer->At;
+        Line = GetTokenLocation(Tokenizer, Here).Line;
+    }
+
+    fprintf(stderr, "Error at line %d: %s.\n", Line, Message);
+#endif
+}
+
+// Appends the offsets of the newlines in ['Indexed', 'Until') to the index.
+static bool IndexNewLines(tokenizer* Tokenizer, char* Until) {
+
+    char* c = Tokenizer->Indexed;
+
+    while (c < Until) {
+        if (Tokenizer->NewLineCapacity - Tokenizer->NewLineCount < TK_NEWLINES_PER_STEP) {
+            int Capacity = Tokenizer->NewLineCapacity ? Tokenizer->NewLineCapacity * 2 : 1024;
+            int* NewLines = (int*)TOKENIZER_REALLOC(Tokenizer->NewLines, Capacity * sizeof(int));
+            if (!NewLines) return false;
+
+            Tokenizer->NewLines = NewLines;
+            Tokenizer->NewLineCapacity = Capacity;
+        }
+
+        int* Out = Tokenizer->NewLines + Tokenizer->NewLineCount;
+        int* OutStart = Out;
+
+#ifdef TOKENIZER_SIMD_WIDTH
+        // Aligned blocks like the skip loops, as many as there is room for.
+        unsigned int Valid;
+        char* Block = TkAlignBlock(c, &Valid);
+        const tk_vec NewLine = TK_SPLAT('\n');
+
+        for (int Step = 0; Step < TK_NEWLINES_PER_STEP / TOKENIZER_SIMD_WIDTH && Block < Until; ++Step) {
+            if (Until - Block < TOKENIZER_SIMD_WIDTH) Valid &= (1u << (Until - Block)) - 1;
+
+            unsigned int Lf = TK_MATCH(TK_LOAD(Block), NewLine) & Valid;
+            int Offset = (int)(Block - Tokenizer->Start);
+
+            while (Lf) {
+                *Out++ = Offset + TkFirstBit(Lf);
+                Lf &= Lf - 1;
+            }
+
+            Block += TOKENIZER_SIMD_WIDTH;
+            Valid = TK_FULL_MASK;
+        }
+
+        c = Block;
+#else
+        char* NewLine = (char*)memchr(c, '\n', Until - c);
+        if (NewLine) *Out++ = (int)(NewLine - Tokenizer->Start);
+        c = NewLine ? NewLine + 1 : Until;
+#endif
+
+        Tokenizer->NewLineCount += (int)(Out - OutStart);
+    }
+
+    Tokenizer->Indexed = Until > Tokenizer->Indexed ? Until : Tokenizer->Indexed;
+    return true;
+}
+
+TOKENIZER_DEF token_location GetTokenLocation(tokenizer* Tokenizer, token Token) {
+    token_location Location = { 0, 0 };
+
+    if (Token.Text > Tokenizer->Indexed && !IndexNewLines(Tokenizer, Token.Text)) {
+        return Location;
+    }
+
+    // Number of newlines before the token.
+    int Offset = (int)(Token.Text - Tokenizer->Start);
+    int Low = 0, High = Tokenizer->NewLineCount;
+
+    while (Low < High) {
+        int Mid = (Low + High) / 2;
+        if (Tokenizer->NewLines[Mid] < Offset) Low = Mid + 1;
+        else High = Mid;
+    }
+
+    Location.Line = Low + 1;
+    Location.Column = Offset - (Low ? Tokenizer->NewLines[Low - 1] + 1 : 0) + 1;
+    return Location;
+}
+
+TOKENIZER_DEF bool Parsing(tokenizer *Tokenizer) {
+    if (Tokenizer->End && Tokenizer->At >= Tokenizer->End) return false;
+    return (*Tokenizer->At && !Tokenizer->Error);
+}
+
+TOKENIZER_DEF token_type Synchronize(tokenizer* Tokenizer, const token_type* Types, int Count) {
+    bool Stop[TOKEN_TYPE_COUNT] = {};
+    for (int i = 0; i < Count; ++i) Stop[Types[i]] = true;
+
+    int Depth = 0;
+
+    for (;;) {
+        token Token = PeekToken(Tokenizer);
+
+        if (Token.Type == TOKEN_EOS || Tokenizer->Error) {
+            return TOKEN_EOS;
+        }
+
+        if (Depth == 0 && Stop[Token.Type]) {
+            return Token.Type;
+        }
+
+        switch (Token.Type) {
+            case TOKEN_OPEN_PAREN:
+            case TOKEN_OPEN_BRACKET:
+            case TOKEN_OPEN_BRACE: {
+                ++Depth;
+            } break;
+
+            case TOKEN_CLOSE_PAREN:
+            case TOKEN_CLOSE_BRACKET:
+            case TOKEN_CLOSE_BRACE: {
+                if (Depth == 0) return Token.Type;
+                --Depth;
+            } break;
+
+            default: break;
+        }
+
+        GetToken(Tokenizer);
+    }
+}
+
+TOKENIZER_DEF const char* GetTokenTypeName(token_type Type) {
+    return Type >= 0 && Type < TOKEN_TYPE_COUNT ? TokenTypes[Type] : "TOKEN_UNKNOWN";
+}
+
+TOKENIZER_DEF bool InitDiagnostics(tokenizer_diagnostics* Diagnostics, tokenizer_arena* Arena, int Capacity) {
+    *Diagnostics = tokenizer_diagnostics();
+    Diagnostics->Arena = Arena;
+
+    if (Arena) {
+        if (Capacity <= 0) Capacity = 256;
+
+        Diagnostics->Items = (tokenizer_diagnostic*)PushArena(Arena, Capacity * sizeof(tokenizer_diagnostic));
+        if (!Diagnostics->Items) {
+            return false;
+        }
+
+        Diagnostics->Capacity = Capacity;
+    }
+
+    return true;
+}
+
+TOKENIZER_DEF void FreeDiagnostics(tokenizer_diagnostics* Diagnostics) {
+    if (!Diagnostics->Arena) {
+        TOKENIZER_FREE(Diagnostics->Items);
+    }
+
+    *Diagnostics = tokenizer_diagnostics();
+}
+
+TOKENIZER_DEF void ClearDiagnostics(tokenizer_diagnostics* Diagnostics) {
+    Diagnostics->Count = 0;
+    Diagnostics->Dropped = 0;
+}
+
+TOKENIZER_DEF void AddDiagnostic(tokenizer* Tokenizer, int Code, token Token, token_type Expected, const char* Message) {
+    if (Tokenizer->Diagnostics) {
+        PushDiagnostic(Tokenizer->Diagnostics, Code, Tokenizer->CountLines ? Tokenizer->Line : 0, Token, Expected, Message);
+    }
+}
+
+TOKENIZER_DEF int FormatDiagnostic(tokenizer* Tokenizer, tokenizer_diagnostic* Diagnostic, char* Buffer, int Size) {
+    int Line = Diagnostic->Line ? Diagnostic->Line : GetTokenLocation(Tokenizer, Diagnostic->Token).Line;
+
+    int Length = Tokenizer->File ? snprintf(Buffer, Size, "Error at %s:%d: ", Tokenizer->File, Line)
+                                 : snprintf(Buffer, Size, "Error at line %d: ", Line);
+
+    // Appends to what fits, and keeps counting like snprintf.
+#define TK_APPEND(...) Length += snprintf(Buffer + (Length < Size ? Length : Size), Length < Size ? Size - Length : 0, __VA_ARGS__)
+
+    token* Token = &Diagnostic->Token;
+    const char* Message = Diagnostic->Message;
+
+    if (Message) {
+        TK_APPEND("%s", Message);
+    }
+
+    if (Diagnostic->Code == DIAGNOSTIC_UNEXPECTED_TOKEN || Diagnostic->Expected != TOKEN_UNKNOWN) {
+        TK_APPEND("%sexpected %s, found %s", Message ? ", " : "", GetTokenTypeName(Diagnostic->Expected), GetTokenTypeName(Token->Type));
+
+        if (Token->Type != TOKEN_EOS && Token->Length > 0) {
+            TK_APPEND(" '%.*s%s'", Token->Length < 32 ? Token->Length : 32, Token->Text, Token->Length > 32 ? "..." : "");
+        }
+    }
+    else if (!Message) {
+        TK_APPEND("error %d", Diagnostic->Code);
+    }
+
+    TK_APPEND(".");
+#undef TK_APPEND
+
+    return Length;
+}
+
+#ifdef TOKENIZER_STATS
+TOKENIZER_DEF int FormatTokenizerStats(const tokenizer_stats* Stats, char* Buffer, int Size) {
+    int Length = 0;
+
+#define TK_APPEND(...) Length += snprintf(Buffer + (Length < Size ? Length : Size), Length < Size ? Size - Length : 0, __VA_ARGS__)
+
+    long long Tokens = 0;
+    for (int i = 0; i < TOKEN_TYPE_COUNT; ++i) Tokens += Stats->Types[i];
+
+    TK_APPEND("{\"whitespace_bytes\":%lld,\"comment_bytes\":%lld,\"token_bytes\":%lld,\"tokens\":%lld,\"types\":{",
+              Stats->WhitespaceBytes, Stats->CommentBytes, Stats->TokenBytes, Tokens);
+
+    bool First = true;
+    for (int i = 0; i < TOKEN_TYPE_COUNT; ++i) {
+        if (!Stats->Types[i]) continue;
+        TK_APPEND("%s\"%s\":%lld", First ? "" : ",", TokenTypes[i], Stats->Types[i]);
+        First = false;
+    }
+
+    TK_APPEND("},\"numbers\":%lld,\"number_seconds\":%.6f,\"gets\":%lld,\"peeks\":%lld,\"peek_hits\":%lld,\"peeks_per_get\":",
+              Stats->Numbers, Stats->NumberSeconds, Stats->Gets, Stats->Peeks, Stats->PeekHits);
+
+    // null rather than a division by zero.
+    if (Stats->Gets) TK_APPEND("%.3f", (double)Stats->Peeks / Stats->Gets);
+    else TK_APPEND("null");
+
+    TK_APPEND(",\"relexed_tokens\":%lld,\"relexed_bytes\":%lld}", Stats->RelexedTokens, Stats->RelexedBytes);
+#undef TK_APPEND
+
+    return Length;
+}
+#endif
+
+
+
+TOKENIZER_DEF void InitArena(tokenizer_arena* Arena, void* Memory, size_t Size) {
+    Arena->Base = (char*)Memory;
+    Arena->Size = Size;
+    Arena->Used = 0;
+}
+
+TOKENIZER_DEF void* PushArena(tokenizer_arena* Arena, size_t Size) {
+    size_t Start = (Arena->Used + 7) & ~(size_t)7;
+
+    if (Start > Arena->Size || Size > Arena->Size - Start) {
+        return 0;
+    }
+
+    Arena->Used = Start + Size;
+    return Arena->Base + Start;
+}
+
+static int EncodeUtf8(char* Out, unsigned int CodePoint) {
+    if (CodePoint > 0x10FFFF || (CodePoint >= 0xD800 && CodePoint <= 0xDFFF)) {
+        CodePoint = 0xFFFD;
+    }
+
+    if (CodePoint < 0x80) {
+        Out[0] = (char)CodePoint;
+        return 1;
+    }
+    if (CodePoint < 0x800) {
+        Out[0] = (char)(0xC0 | (CodePoint >> 6));
+        Out[1] = (char)(0x80 | (CodePoint & 0x3F));
+        return 2;
+    }
+    if (CodePoint < 0x10000) {
+        Out[0] = (char)(0xE0 | (CodePoint >> 12));
+        Out[1] = (char)(0x80 | ((CodePoint >> 6) & 0x3F));
+        Out[2] = (char)(0x80 | (CodePoint & 0x3F));
+        return 3;
+    }
+
+    Out[0] = (char)(0xF0 | (CodePoint >> 18));
+    Out[1] = (char)(0x80 | ((CodePoint >> 12) & 0x3F));
+    Out[2] = (char)(0x80 | ((CodePoint >> 6) & 0x3F));
+    Out[3] = (char)(0x80 | (CodePoint & 0x3F));
+    return 4;
+}
+
+TOKENIZER_DEF char* UnescapeString(token Token, tokenizer_arena* Arena, int* Length) {
+    if ((Token.Type != TOKEN_STRING && Token.Type != TOKEN_CHAR) || Token.Length < 1) {
+        return 0;
+    }
+
+    // No escape is shorter than what it decodes to, so the quotes leave room for the '\0'.
+    char* Result = (char*)PushArena(Arena, Token.Length);
+    if (!Result) {
+        return 0;
+    }
+
+    char Quote = Token.Text[0];
+    const char* c = Token.Text + 1;
+    const char* End = Token.Text + Token.Length;
+    char* Out = Result;
+
+    while (c < End && *c != Quote) {
+        bool Unicode;
+        unsigned int Value = DecodeChar(&c, End, &Unicode);
+
+        if (Unicode) Out += EncodeUtf8(Out, Value);
+        else *Out++ = (char)Value;
+    }
+
+    *Out = 0;
+    if (Length) *Length = (int)(Out - Result);
+
+    return Result;
+}
+
+TOKENIZER_DEF bool IsValidUtf8(const char* Text, int Length) {
+    const char* c = Text;
+    const char* End = Text + Length;
+
+    while (c < End) {
+#ifdef TOKENIZER_SIMD_WIDTH
+        // Whole aligned blocks of ASCII are skipped at once, without reading past the end.
+        if (((size_t)c & (TOKENIZER_SIMD_WIDTH - 1)) == 0) {
+            while (End - c >= TOKENIZER_SIMD_WIDTH && !TK_HIGH_BITS(TK_LOAD(c))) c += TOKENIZER_SIMD_WIDTH;
+            if (c == End) break;
+        }
+#endif
+        if ((unsigned char)*c < 0x80) {
+            ++c;
+            continue;
+        }
+
+        unsigned int CodePoint;
+        int Sequence = TkDecodeUtf8<true>(c, End, &CodePoint);
+        if (!Sequence) return false;
+
+        c += Sequence;
+    }
+
+    return true;
+}
+
+
+TOKENIZER_DEF void InitInterner(tokenizer_interner* Interner, tokenizer_arena* Arena) {
+    *Interner = tokenizer_interner();
+    Interner->Arena = Arena;
+}
+
+TOKENIZER_DEF void FreeInterner(tokenizer_interner* Interner) {
+
+    if (!Interner->Arena) {
+        TOKENIZER_FREE(Interner->Slots);
+        TOKENIZER_FREE(Interner->Atoms);
+
+        while (char* Block = Interner->Blocks) {
+            memcpy(&Interner->Blocks, Block, sizeof(char*));
+            TOKENIZER_FREE(Block);
+        }
+    }
+
+    InitInterner(Interner, Interner->Arena);
+}
+
+#define TK_INTERNER_BLOCK_SIZE (64 * 1024)
+
+static char* CopyAtomText(tokenizer_interner* Interner, const char* Text, int Length) {
+    char* Copy;
+
+    if (Interner->Arena) {
+        Copy = (char*)PushArena(Interner->Arena, Length + 1);
+    }
+    else {
+        Copy = (char*)PushArena(&Interner->Store, Length + 1);
+
+        if (!Copy) {
+            size_t Size = Length + 1 + sizeof(char*) > TK_INTERNER_BLOCK_SIZE ? Length + 1 + sizeof(char*) : TK_INTERNER_BLOCK_SIZE;
+            char* Block = (char*)TOKENIZER_MALLOC(Size);
+            if (!Block) return 0;
+
+            memcpy(Block, &Interner->Blocks, sizeof(char*));
+            Interner->Blocks = Block;
+
+            InitArena(&Interner->Store, Block, Size);
+            PushArena(&Interner->Store, sizeof(char*));
+            Copy = (char*)PushArena(&Interner->Store, Length + 1);
+        }
+    }
+
+    if (Copy) {
+        memcpy(Copy, Text, Length);
+        Copy[Length] = 0;
+    }
+
+    return Copy;
+}
+
+// Doubles the slot table, so it stays at most half full.
+static bool GrowInternerSlots(tokenizer_interner* Interner) {
+    int SlotCount = Interner->SlotCount ? Interner->SlotCount * 2 : 256;
+    size_t Size = SlotCount * sizeof(tokenizer_interner_slot);
+
+    tokenizer_interner_slot* Slots = (tokenizer_interner_slot*)(Interner->Arena ? PushArena(Interner->Arena, Size) : TOKENIZER_MALLOC(Size));
+    if (!Slots) return false;
+
+    memset(Slots, 0, Size);
+
+    unsigned int Mask = SlotCount - 1;
+    for (int Atom = 1; Atom < Interner->AtomCount; ++Atom) {
+        unsigned int i = Interner->Atoms[Atom].Hash & Mask;
+        while (Slots[i].Atom) i = (i + 1) & Mask;
+
+        Slots[i].Hash = Interner->Atoms[Atom].Hash;
+        Slots[i].Atom = Atom;
+    }
+
+    if (!Interner->Arena) TOKENIZER_FREE(Interner->Slots);
+
+    Interner->Slots = Slots;
+    Interner->SlotCount = SlotCount;
+    return true;
+}
+
+static bool GrowInternerAtoms(tokenizer_interner* Interner) {
+    int Capacity = Interner->AtomCapacity ? Interner->AtomCapacity * 2 : 128;
+    size_t Size = Capacity * sizeof(tokenizer_atom);
+    tokenizer_atom* Atoms;
+
+    if (Interner->Arena) {
+        Atoms = (tokenizer_atom*)PushArena(Interner->Arena, Size);
+        if (Atoms && Interner->AtomCount) memcpy(Atoms, Interner->Atoms, Interner->AtomCount * sizeof(tokenizer_atom));
+    }
+    else {
+        Atoms = (tokenizer_atom*)TOKENIZER_REALLOC(Interner->Atoms, Size);
+    }
+
+    if (!Atoms) return false;
+
+    if (!Interner->AtomCount) {
+        // Atom 0 means "no atom".
+        Atoms[0] = tokenizer_atom();
+        Interner->AtomCount = 1;
+    }
+
+    Interner->Atoms = Atoms;
+    Interner->AtomCapacity = Capacity;
+    return true;
+}
+
+static unsigned int InternHashed(tokenizer_interner* Interner, const char* Text, int Length, unsigned int Hash) {
+
+    if (Interner->AtomCount * 2 >= Interner->SlotCount && !GrowInternerSlots(Interner)) {
+        return 0;
+    }
+
+    unsigned int Mask = Interner->SlotCount - 1;
+    unsigned int i = Hash & Mask;
+
+    for (; Interner->Slots[i].Atom; i = (i + 1) & Mask) {
+        if (Interner->Slots[i].Hash == Hash) {
+            tokenizer_atom* Atom = &Interner->Atoms[Interner->Slots[i].Atom];
+
+            if (Atom->Length == Length && memcmp(Atom->Text, Text, Length) == 0) {
+                return Interner->Slots[i].Atom;
+            }
+        }
+    }
+
+    if (Interner->AtomCount == Interner->AtomCapacity && !GrowInternerAtoms(Interner)) {
+        return 0;
+    }
+
+    char* Copy = CopyAtomText(Interner, Text, Length);
+    if (!Copy) return 0;
+
+    unsigned int Atom = Interner->AtomCount++;
+    Interner->Atoms[Atom].Text = Copy;
+    Interner->Atoms[Atom].Length = Length;
+    Interner->Atoms[Atom].Hash = Hash;
+
+    Interner->Slots[i].Hash = Hash;
+    Interner->Slots[i].Atom = Atom;
+
+    return Atom;
+}
+
+TOKENIZER_DEF unsigned int Intern(tokenizer_interner* Interner, const char* Text, int Length) {
+    return InternHashed(Interner, Text, Length, TkHash(Text, Length));
+}
+
+TOKENIZER_DEF unsigned int InternKeywords(tokenizer_interner* Interner, const char* const* Words, int Count) {
+    unsigned int First = 0;
+
+    for (int i = 0; i < Count; ++i) {
+        unsigned int Atom = Intern(Interner, Words[i], (int)strlen(Words[i]));
+        if (!Atom) return 0;
+        if (i == 0) First = Atom;
+    }
+
+    return First;
+}
+
+TOKENIZER_DEF const char* GetAtomText(tokenizer_interner* Interner, unsigned int Atom, int* Length) {
+
+    if (Atom == 0 || (int)Atom >= Interner->AtomCount) {
+        return 0;
+    }
+
+    if (Length) *Length = Interner->Atoms[Atom].Length;
+    return Interner->Atoms[Atom].Text;
+}
+
+
+#define TOKEN_BUFFER_BYTES_PER_TOKEN (sizeof(token_value) + 3 * sizeof(int) + sizeof(unsigned char))
+
+TOKENIZER_DEF void InitTokenBuffer(token_buffer* Buffer, tokenizer_arena* Arena) {
+    *Buffer = token_buffer();
+    Buffer->Arena = Arena;
+}
+
+TOKENIZER_DEF void FreeTokenBuffer(token_buffer* Buffer) {
+    if (Buffer->Mapping) {
+        TkUnmapFile(Buffer->Mapping, Buffer->MappingSize);
+    }
+    else if (!Buffer->Arena) {
+        TOKENIZER_FREE(Buffer->Types);
+        TOKENIZER_FREE(Buffer->Offsets);
+        TOKENIZER_FREE(Buffer->Lengths);
+        TOKENIZER_FREE(Buffer->Values);
+        TOKENIZER_FREE(Buffer->Lines);
+    }
+
+    InitTokenBuffer(Buffer, Buffer->Arena);
+}
+
+static bool DetachTokenBuffer(token_buffer* Buffer);
+
+// Heap-backed buffers grow by doubling.
+static bool GrowTokenBuffer(token_buffer* Buffer) {
+    if (Buffer->Mapping) {
+        return DetachTokenBuffer(Buffer);
+    }
+
+    int Capacity = Buffer->Capacity ? Buffer->Capacity * 2 : 4096;
+
+    unsigned char* Types = (unsigned char*)TOKENIZER_REALLOC(Buffer->Types, Capacity * sizeof(unsigned char));
+    if (Types) Buffer->Types = Types;
+    int* Offsets = (int*)TOKENIZER_REALLOC(Buffer->Offsets, Capacity * sizeof(int));
+    if (Offsets) Buffer->Offsets = Offsets;
+    int* Lengths = (int*)TOKENIZER_REALLOC(Buffer->Lengths, Capacity * sizeof(int));
+    if (Lengths) Buffer->Lengths = Lengths;
+    token_value* Values = (token_value*)TOKENIZER_REALLOC(Buffer->Values, Capacity * sizeof(token_value));
+    if (Values) Buffer->Values = Values;
+    int* Lines = (int*)TOKENIZER_REALLOC(Buffer->Lines, Capacity * sizeof(int));
+    if (Lines) Buffer->Lines = Lines;
+
+    if (!Types || !Offsets || !Lengths || !Values || !Lines) {
+        return false;
+    }
+
+    Buffer->Capacity = Capacity;
+    return true;
+}
+
+// Moves the arrays of a buffer loaded from a cache file to the heap, with room for more tokens.
+static bool DetachTokenBuffer(token_buffer* Buffer) {
+    int Count = Buffer->Count;
+
+    token_buffer Copy;
+    InitTokenBuffer(&Copy, 0);
+
+    while (Copy.Capacity <= Count) {
+        if (!GrowTokenBuffer(&Copy)) {
+            FreeTokenBuffer(&Copy);
+            return false;
+        }
+    }
+
+    memcpy(Copy.Types, Buffer->Types, Count * sizeof(unsigned char));
+    memcpy(Copy.Offsets, Buffer->Offsets, Count * sizeof(int));
+    memcpy(Copy.Lengths, Buffer->Lengths, Count * sizeof(int));
+    memcpy(Copy.Values, Buffer->Values, Count * sizeof(token_value));
+    memcpy(Copy.Lines, Buffer->Lines, Count * sizeof(int));
+
+    TkUnmapFile(Buffer->Mapping, Buffer->MappingSize);
+    Buffer->Mapping = 0;
+    Buffer->MappingSize = 0;
+
+    Buffer->Types = Copy.Types;
+    Buffer->Offsets = Copy.Offsets;
+    Buffer->Lengths = Copy.Lengths;
+    Buffer->Values = Copy.Values;
+    Buffer->Lines = Copy.Lines;
+    Buffer->Capacity = Copy.Capacity;
+
+    return true;
+}
+
+// Arena-backed buffers take all the space left in the arena, and give back what wasn't used once
+// the run is over (see PackArenaTokenBuffer).
+static void CarveArenaTokenBuffer(token_buffer* Buffer) {
+    tokenizer_arena* Arena = Buffer->Arena;
+
+    size_t Start = (Arena->Used + 7) & ~(size_t)7;
+    size_t Available = Start < Arena->Size ? Arena->Size - Start : 0;
+    size_t Capacity = Available / TOKEN_BUFFER_BYTES_PER_TOKEN;
+    if (Capacity > 0x7FFFFFFF) Capacity = 0x7FFFFFFF;
+
+    char* At = Arena->Base + Start;
+    Buffer->Values  = (token_value*)At;   At += Capacity * sizeof(token_value);
+    Buffer->Offsets = (int*)At;           At += Capacity * sizeof(int);
+    Buffer->Lengths = (int*)At;           At += Capacity * sizeof(int);
+    Buffer->Lines   = (int*)At;           At += Capacity * sizeof(int);
+    Buffer->Types   = (unsigned char*)At; At += Capacity * sizeof(unsigned char);
+
+    Buffer->Capacity = (int)Capacity;
+    Arena->Used = At - Arena->Base;
+}
+
+static void PackArenaTokenBuffer(token_buffer* Buffer) {
+    int Count = Buffer->Count;
+
+    // Every array moves down (or stays), so moving them in order never overwrites live data.
+    char* At = (char*)(Buffer->Values + Count);
+    memmove(At, Buffer->Offsets, Count * sizeof(int)); Buffer->Offsets = (int*)At; At += Count * sizeof(int);
+    memmove(At, Buffer->Lengths, Count * sizeof(int)); Buffer->Lengths = (int*)At; At += Count * sizeof(int);
+    memmove(At, Buffer->Lines, Count * sizeof(int));   Buffer->Lines = (int*)At;   At += Count * sizeof(int);
+    memmove(At, Buffer->Types, Count);                 Buffer->Types = (unsigned char*)At; At += Count;
+
+    Buffer->Capacity = Count;
+    Buffer->Arena->Used = At - Buffer->Arena->Base;
+}
+
+static inline void SetBufferToken(token_buffer* Buffer, int Index, token* Token, int Line) {
+    Buffer->Types[Index] = (unsigned char)Token->Type;
+    Buffer->Offsets[Index] = (int)(Token->Text - Buffer->Base);
+    Buffer->Lengths[Index] = Token->Length;
+    Buffer->Lines[Index] = Line;
+    Buffer->Values[Index].Int = (Token->Type == TOKEN_INTEGER || Token->Type == TOKEN_FLOAT || Token->Type == TOKEN_CHAR) ? Token->Int : 0;
+    if (Token->Type == TOKEN_IDENT) Buffer->Values[Index].Atom = Token->Atom;
+    if (Token->Type == TOKEN_KEYWORD) Buffer->Values[Index].Keyword = Token->Keyword;
+    if (Token->Type == TOKEN_OPERATOR) Buffer->Values[Index].Operator = Token->Operator;
+}
+
+template <typename Policy>
+static bool TokenizeAllWith(tokenizer* Tokenizer, token_buffer* Buffer) {
+    std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+
+    FreeTokenBuffer(Buffer);
+    Buffer->Base = Tokenizer->At;
+
+    if (Buffer->Arena) {
+        CarveArenaTokenBuffer(Buffer);
+    }
+
+    bool Result = true;
+
+    while (!Tokenizer->Error) {
+
+        if (Buffer->Count == Buffer->Capacity) {
+            if (Buffer->Arena || !GrowTokenBuffer(Buffer)) {
+                SetError(Tokenizer, "Out of memory for the token buffer");
+                break;
+            }
+        }
+
+        token Token = GetTokenWith<Policy>(Tokenizer);
+        SetBufferToken(Buffer, Buffer->Count++, &Token, Tokenizer->Line);
+
+        if (Token.Type == TOKEN_EOS) {
+            // Stay on the terminator instead of stepping past it.
+            Tokenizer->At = Token.Text;
+            break;
+        }
+    }
+
+    if (Tokenizer->Error) {
+        Result = false;
+    }
+
+    if (Buffer->Arena) {
+        PackArenaTokenBuffer(Buffer);
+    }
+
+    Buffer->Bytes = Tokenizer->At - Buffer->Base;
+    Buffer->Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+
+    return Result;
+}
+
+TOKENIZER_DEF bool TokenizeAll(tokenizer* Tokenizer, token_buffer* Buffer) {
+    return TokenizeAllWith<tokenizer_policy>(Tokenizer, Buffer);
+}
+
+template <typename Policy>
+bool basic_tokenizer<Policy>::TokenizeAll(token_buffer* Buffer) {
+    return TokenizeAllWith<Policy>(this, Buffer);
+}
+
+#define TK_PACKED_LONG 0xFFFF
+
+TOKENIZER_DEF void InitPackedTokenBuffer(packed_token_buffer* Buffer, char* Base) {
+    *Buffer = packed_token_buffer();
+    Buffer->Base = Base;
+}
+
+TOKENIZER_DEF void FreePackedTokenBuffer(packed_token_buffer* Buffer) {
+    TOKENIZER_FREE(Buffer->Tokens);
+    TOKENIZER_FREE(Buffer->Extras);
+    InitPackedTokenBuffer(Buffer, Buffer->Base);
+}
+
+TOKENIZER_DEF bool PackToken(packed_token_buffer* Buffer, token* Token) {
+
+    size_t Offset = (size_t)(Token->Text - Buffer->Base);
+    if (Token->Text < Buffer->Base || Offset > 0xFFFFFFFFu) {
+        return false;
+    }
+
+    if (Buffer->Count == Buffer->Capacity) {
+        int Capacity = Buffer->Capacity ? Buffer->Capacity * 2 : 4096;
+        packed_token* Tokens = (packed_token*)TOKENIZER_REALLOC(Buffer->Tokens, Capacity * sizeof(packed_token));
+        if (!Tokens) return false;
+
+        Buffer->Tokens = Tokens;
+        Buffer->Capacity = Capacity;
+    }
+
+    bool HasValue = Token->Type == TOKEN_INTEGER || Token->Type == TOKEN_FLOAT || Token->Type == TOKEN_CHAR || Token->Type == TOKEN_KEYWORD ||
+                    Token->Type == TOKEN_OPERATOR || (Token->Type == TOKEN_IDENT && Token->Atom);
+    bool IsLong = Token->Length >= TK_PACKED_LONG;
+
+    if (HasValue || IsLong) {
+        if (Buffer->ExtraCount == Buffer->ExtraCapacity) {
+            int Capacity = Buffer->ExtraCapacity ? Buffer->ExtraCapacity * 2 : 1024;
+            packed_token_extra* Extras = (packed_token_extra*)TOKENIZER_REALLOC(Buffer->Extras, Capacity * sizeof(packed_token_extra));
+            if (!Extras) return false;
+
+            Buffer->Extras = Extras;
+            Buffer->ExtraCapacity = Capacity;
+        }
+
+        packed_token_extra* Extra = &Buffer->Extras[Buffer->ExtraCount++];
+        Extra->Token = Buffer->Count;
+        Extra->Length = Token->Length;
+        Extra->Value.Int = (Token->Type == TOKEN_INTEGER || Token->Type == TOKEN_FLOAT || Token->Type == TOKEN_CHAR) ? Token->Int : 0;
+        if (Token->Type == TOKEN_IDENT) Extra->Value.Atom = Token->Atom;
+        if (Token->Type == TOKEN_KEYWORD) Extra->Value.Keyword = Token->Keyword;
+        if (Token->Type == TOKEN_OPERATOR) Extra->Value.Operator = Token->Operator;
+    }
+
+    packed_token* Packed = &Buffer->Tokens[Buffer->Count++];
+    Packed->Offset = (unsigned int)Offset;
+    Packed->Length = IsLong ? TK_PACKED_LONG : (unsigned short)Token->Length;
+    Packed->Type = (unsigned short)Token->Type;
+
+    return true;
+}
+
+TOKENIZER_DEF token UnpackToken(packed_token_buffer* Buffer, int Index) {
+    packed_token* Packed = &Buffer->Tokens[Index];
+
+    token Token;
+    Token.Type = (token_type)Packed->Type;
+    Token.Length = Packed->Length;
+    Token.Text = Buffer->Base + Packed->Offset;
+    Token.Int = 0;
+
+    bool HasValue = Token.Type == TOKEN_INTEGER || Token.Type == TOKEN_FLOAT || Token.Type == TOKEN_CHAR || Token.Type == TOKEN_KEYWORD ||
+                    Token.Type == TOKEN_OPERATOR || Token.Type == TOKEN_IDENT;
+
+    if (HasValue || Packed->Length == TK_PACKED_LONG) {
+        int Low = 0, High = Buffer->ExtraCount;
+
+        while (Low < High) {
+            int Mid = (Low + High) / 2;
+            if (Buffer->Extras[Mid].Token < Index) Low = Mid + 1;
+            else High = Mid;
+        }
+
+        // Identifiers without an atom have no entry.
+        if (Low < Buffer->ExtraCount && Buffer->Extras[Low].Token == Index) {
+            Token.Length = Buffer->Extras[Low].Length;
+            Token.Int = Buffer->Extras[Low].Value.Int;
+        }
+    }
+
+    return Token;
+}
+
+TOKENIZER_DEF bool TokenizeAllPacked(tokenizer* Tokenizer, packed_token_buffer* Buffer) {
+
+    FreePackedTokenBuffer(Buffer);
+    Buffer->Base = Tokenizer->At;
+
+    while (!Tokenizer->Error) {
+        token Token = GetToken(Tokenizer);
+
+        if (!PackToken(Buffer, &Token)) {
+            SetError(Tokenizer, "Out of memory for the token buffer");
+            break;
+        }
+
+        if (Token.Type == TOKEN_EOS) {
+            // Stay on the terminator instead of stepping past it.
+            Tokenizer->At = Token.Text;
+            break;
+        }
+    }
+
+    return !Tokenizer->Error;
+}
+
+// Where token 'Index' is in the arrays, see token_buffer::Tail.
+static inline int TkBufferSlot(token_buffer* Buffer, int Index) {
+    return Index < Buffer->Count - Buffer->Tail ? Index : Index + Buffer->Capacity - Buffer->Count;
+}
+
+static inline int TkBufferOffset(token_buffer* Buffer, int Index) {
+    return Buffer->Offsets[TkBufferSlot(Buffer, Index)] + (Index < Buffer->Count - Buffer->Tail ? 0 : Buffer->TailOffset);
+}
+
+// Moves 'Count' tokens from slot 'From' to slot 'To', shifting their offsets and lines.
+static void MoveBufferTokens(token_buffer* Buffer, int To, int From, int Count, int Offset, int Line) {
+    memmove(Buffer->Types + To, Buffer->Types + From, Count * sizeof(unsigned char));
+    memmove(Buffer->Offsets + To, Buffer->Offsets + From, Count * sizeof(int));
+    memmove(Buffer->Lengths + To, Buffer->Lengths + From, Count * sizeof(int));
+    memmove(Buffer->Values + To, Buffer->Values + From, Count * sizeof(token_value));
+    memmove(Buffer->Lines + To, Buffer->Lines + From, Count * sizeof(int));
+
+    if (Offset) {
+        for (int i = To; i < To + Count; ++i) Buffer->Offsets[i] += Offset;
+    }
+
+    if (Line) {
+        for (int i = To; i < To + Count; ++i) Buffer->Lines[i] += Line;
+    }
+}
+
+// Makes the tokens from 'Index' on the tail. Only the tokens between 'Index' and the current start of
+// the tail move.
+static void SplitTokenBuffer(token_buffer* Buffer, int Index) {
+    int Head = Buffer->Count - Buffer->Tail;
+    int Gap = Buffer->Capacity - Buffer->Count;
+
+    if (Index < Head) {
+        MoveBufferTokens(Buffer, Index + Gap, Index, Head - Index, -Buffer->TailOffset, -Buffer->TailLine);
+    }
+    else {
+        MoveBufferTokens(Buffer, Head, Head + Gap, Index - Head, Buffer->TailOffset, Buffer->TailLine);
+    }
+
+    Buffer->Tail = Buffer->Count - Index;
+}
+
+TOKENIZER_DEF void FlushTokenEdits(token_buffer* Buffer) {
+    SplitTokenBuffer(Buffer, Buffer->Count);
+
+    Buffer->TailOffset = 0;
+    Buffer->TailLine = 0;
+}
+
+// Index of the first token at or after 'Offset'.
+static int FindBufferToken(token_buffer* Buffer, int Offset) {
+    int Low = 0, High = Buffer->Count;
+
+    while (Low < High) {
+        int Mid = (Low + High) / 2;
+        if (TkBufferOffset(Buffer, Mid) < Offset) Low = Mid + 1;
+        else High = Mid;
+    }
+
+    return Low;
+}
+
+// A token looks at most this far past its end (an identifier checks whether the UTF-8 sequence after
+// it is a letter).
+#define TK_TOKEN_LOOKAHEAD 4
+
+// Looking for the longest extra operator can go further.
+static inline int TkTokenLookahead(tokenizer* Tokenizer) {
+    int Operators = Tokenizer->Operators ? Tokenizer->Operators->MaxLength - 1 : 0;
+    return Operators > TK_TOKEN_LOOKAHEAD ? Operators : TK_TOKEN_LOOKAHEAD;
+}
+
+// Like FixupChunk: the lexer has no state apart from its position, so once a new token starts where an
+// old one did (past the edit), the rest of the old tokens are still right, only shifted.
+TOKENIZER_DEF bool TokenizeEdit(tokenizer* Tokenizer, token_buffer* Buffer, int Offset, int RemovedLength, int InsertedLength,
+                                int* FirstChanged, int* ChangedCount) {
+
+    if (!Buffer->Count || Offset < 0 || RemovedLength < 0 || InsertedLength < 0 ||
+        Offset + RemovedLength > TkBufferOffset(Buffer, Buffer->Count - 1)) {
+        SetError(Tokenizer, "Invalid edit");
+        return false;
+    }
+
+    Tokenizer->LookaheadCount = 0;
+
+    char* Base = Tokenizer->At;
+    int Delta = InsertedLength - RemovedLength;
+
+    // Keep the tokens that end, lookahead included, before the edit.
+    int Keep = FindBufferToken(Buffer, Offset);
+    int Lookahead = TkTokenLookahead(Tokenizer);
+    while (Keep > 0 && TkBufferOffset(Buffer, Keep - 1) + Buffer->Lengths[TkBufferSlot(Buffer, Keep - 1)] + Lookahead > Offset) {
+        --Keep;
+    }
+
+    char* c = Base;
+    int Line = Tokenizer->Line;
+
+    if (Keep) {
+        token Last = GetBufferToken(Buffer, Keep - 1);
+        Last.Text = Base + TkBufferOffset(Buffer, Keep - 1);
+        c = Last.Text + Last.Length;
+        Line = GetBufferLine(Buffer, Keep - 1) + CountedNewLines(Tokenizer, &Last);
+    }
+
+    // Re-lex until a token starts past the edit, at the shifted offset of an old token.
+    int Old = FindBufferToken(Buffer, Offset + RemovedLength);
+    int LineDelta = 0;
+
+    token_buffer Tokens;
+    InitTokenBuffer(&Tokens, 0);
+    Tokens.Base = Base;
+
+    for (;;) {
+        token Token = NextToken(Tokenizer, c, &Line);
+        int TokenLine = Line - CountedNewLines(Tokenizer, &Token);
+        int At = (int)(Token.Text - Base);
+
+        if (At >= Offset + InsertedLength) {
+            while (Old < Buffer->Count && TkBufferOffset(Buffer, Old) < At - Delta) ++Old;
+
+            if (Old < Buffer->Count && TkBufferOffset(Buffer, Old) == At - Delta) {
+                LineDelta = TokenLine - GetBufferLine(Buffer, Old);
+                break;
+            }
+        }
+
+        if (Tokens.Count == Tokens.Capacity && !GrowTokenBuffer(&Tokens)) {
+            SetError(Tokenizer, "Out of memory for the token buffer");
+            break;
+        }
+
+        SetBufferToken(&Tokens, Tokens.Count++, &Token, TokenLine);
+
+        if (Token.Type == TOKEN_EOS) {
+            Old = Buffer->Count;
+            break;
+        }
+
+        c = Token.Text + Token.Length;
+    }
+
+    int Tail = Buffer->Count - Old;
+    int Count = Keep + Tokens.Count + Tail;
+
+    if (!Tokenizer->Error && Buffer->Capacity < Count) {
+        // The tail has to end up at the end of the new arrays.
+        FlushTokenEdits(Buffer);
+        while (!Buffer->Arena && Buffer->Capacity < Count && GrowTokenBuffer(Buffer));
+
+        if (Buffer->Capacity < Count) {
+            SetError(Tokenizer, "Out of memory for the token buffer");
+        }
+    }
+
+    if (Tokenizer->Error) {
+        FreeTokenBuffer(&Tokens);
+        return false;
+    }
+
+    int To = Keep + Tokens.Count;
+
+    // The old tokens from 'Old' on become the tail, and the shift of the edit is added to the one it
+    // already has. The new tokens go right after the kept ones, in the free capacity.
+    SplitTokenBuffer(Buffer, Old);
+    Buffer->Count = Count;
+    Buffer->TailOffset += Delta;
+    Buffer->TailLine += LineDelta;
+
+    if (Tokens.Count) {
+        memcpy(Buffer->Types + Keep, Tokens.Types, Tokens.Count * sizeof(unsigned char));
+        memcpy(Buffer->Offsets + Keep, Tokens.Offsets, Tokens.Count * sizeof(int));
+        memcpy(Buffer->Lengths + Keep, Tokens.Lengths, Tokens.Count * sizeof(int));
+        memcpy(Buffer->Values + Keep, Tokens.Values, Tokens.Count * sizeof(token_value));
+        memcpy(Buffer->Lines + Keep, Tokens.Lines, Tokens.Count * sizeof(int));
+    }
+
+    FreeTokenBuffer(&Tokens);
+
+    Buffer->Base = Base;
+    Buffer->Bytes = TkBufferOffset(Buffer, Count - 1);
+
+    // Like TokenizeAll, stay on the terminator.
+    Tokenizer->At = Base + Buffer->Bytes;
+    Tokenizer->Line = GetBufferLine(Buffer, Count - 1);
+    Tokenizer->TokenNewLines = 0;
+
+    if (FirstChanged) *FirstChanged = Keep;
+    if (ChangedCount) *ChangedCount = To - Keep;
+
+    return true;
+}
+
+// A cache file is this header, then the Values, Offsets, Lengths, Lines and Types of the tokens (the
+// layout of CarveArenaTokenBuffer), padded to 8 bytes, then the identifiers of the data in the order
+// they first appear. Their texts are taken from the data, not from the file.
+struct tk_cache_header {
+    char Magic[8];
+    unsigned long long Hash;        // Of the data
+    unsigned long long Settings;    // Of everything else that changes the tokens, see TkCacheSettings
+    long long Bytes;                // Size of the data
+    int Count;
+    int AtomCount;
+    unsigned int MaxAtom;
+    int Padding;
+};
+
+struct tk_cache_atom {
+    unsigned int Atom;              // As given when the file was written
+    int Token;                      // Where it first appears
+};
+
+static const char TkCacheMagic[8] = { 'T', 'K', 'C', 'A', 'C', 'H', 'E', '1' };
+
+#define TK_PRIME64_1 0x9E3779B185EBCA87ull
+#define TK_PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define TK_PRIME64_3 0x165667B19E3779F9ull
+
+static inline unsigned long long TkRotate64(unsigned long long Value, int Bits) {
+    return (Value << Bits) | (Value >> (64 - Bits));
+}
+
+static inline unsigned long long TkHashRound(unsigned long long Hash, unsigned long long Word) {
+    return TkRotate64(Hash + Word * TK_PRIME64_2, 31) * TK_PRIME64_1;
+}
+
+// Hashes 32 bytes per step on four independent lanes, so checking a big file costs little more than
+// reading it.
+static unsigned long long TkHashData(const char* Data, size_t Size, unsigned long long Seed) {
+    unsigned long long Lanes[4] = { Seed + TK_PRIME64_1 + TK_PRIME64_2, Seed + TK_PRIME64_2, Seed, Seed - TK_PRIME64_1 };
+
+    size_t i = 0;
+    for (; i + 32 <= Size; i += 32) {
+        unsigned long long Words[4];
+        memcpy(Words, Data + i, sizeof(Words));
+
+        Lanes[0] = TkHashRound(Lanes[0], Words[0]);
+        Lanes[1] = TkHashRound(Lanes[1], Words[1]);
+        Lanes[2] = TkHashRound(Lanes[2], Words[2]);
+        Lanes[3] = TkHashRound(Lanes[3], Words[3]);
+    }
+
+    unsigned long long Hash = TkRotate64(Lanes[0], 1) + TkRotate64(Lanes[1], 7) + TkRotate64(Lanes[2], 12) + TkRotate64(Lanes[3], 18);
+    Hash += Size;
+
+    for (; i + 8 <= Size; i += 8) {
+        unsigned long long Word;
+        memcpy(&Word, Data + i, sizeof(Word));
+        Hash = TkRotate64(Hash ^ TkHashRound(0, Word), 27) * TK_PRIME64_1 + TK_PRIME64_2;
+    }
+
+    for (; i < Size; ++i) {
+        Hash = TkRotate64(Hash ^ ((unsigned char)Data[i] * TK_PRIME64_1), 11) * TK_PRIME64_2;
+    }
+
+    Hash ^= Hash >> 33;
+    Hash *= TK_PRIME64_2;
+    Hash ^= Hash >> 29;
+    Hash *= TK_PRIME64_3;
+    Hash ^= Hash >> 32;
+    return Hash;
+}
+
+#define TK_CACHE_VERSION 4
+
+// Everything but the data that the tokens depend on. It's hashed as bytes, so a file written on a
+// machine with another byte order is never used.
+static unsigned long long TkCacheSettings(tokenizer* Tokenizer) {
+    int Layout[] = { TK_CACHE_VERSION, (int)sizeof(token_value), (int)TOKEN_TYPE_COUNT, Tokenizer->Interner != 0,
+                     Tokenizer->CountLines, Tokenizer->Line };
+
+    unsigned long long Hash = TkHashData((const char*)Layout, sizeof(Layout), 0);
+
+#ifdef TOKENIZER_KEYWORDS
+    for (int i = 0; i < TkKeywordCount; ++i) {
+        Hash = TkHashData(TkKeywords[i], strlen(TkKeywords[i]) + 1, Hash);
+    }
+#endif
+
+    if (tokenizer_operators* Operators = Tokenizer->Operators) {
+        size_t States = (size_t)Operators->StateCount;
+
+        Hash = TkHashData((const char*)Operators->Class, sizeof(Operators->Class), Hash);
+        Hash = TkHashData((const char*)Operators->Next, States * Operators->ClassCount * sizeof(unsigned short), Hash);
+        Hash = TkHashData((const char*)Operators->Types, States, Hash);
+        Hash = TkHashData((const char*)Operators->Ids, States * sizeof(int), Hash);
+    }
+
+    return Hash;
+}
+
+// Size of a cache file, and where its identifiers start.
+static unsigned long long TkCacheSize(tk_cache_header* Header, unsigned long long* AtomsAt) {
+    unsigned long long Size = sizeof(tk_cache_header) + (unsigned long long)Header->Count * TOKEN_BUFFER_BYTES_PER_TOKEN;
+    Size = (Size + 7) & ~7ull;
+
+    *AtomsAt = Size;
+    return Size + (unsigned long long)Header->AtomCount * sizeof(tk_cache_atom);
+}
+
+// Returns false if there is no cache file for 'Key', or if it's damaged.
+static bool LoadTokenCache(tokenizer* Tokenizer, token_buffer* Buffer, const char* CachePath, tk_cache_header* Key) {
+    size_t Size = 0;
+    char* Mapping = (char*)TkMapCacheFile(CachePath, &Size);
+    if (!Mapping) {
+        return false;
+    }
+
+    tk_cache_header* Header = (tk_cache_header*)Mapping;
+    unsigned long long AtomsAt = 0;
+
+    if (Size < sizeof(tk_cache_header) || memcmp(Header->Magic, TkCacheMagic, sizeof(TkCacheMagic)) != 0 ||
+        Header->Hash != Key->Hash || Header->Settings != Key->Settings || Header->Bytes != Key->Bytes ||
+        Header->Count < 1 || Header->AtomCount < 0 || TkCacheSize(Header, &AtomsAt) != Size) {
+        TkUnmapFile(Mapping, Size);
+        return false;
+    }
+
+    int Count = Header->Count;
+    unsigned int MaxAtom = Header->MaxAtom;
+
+    char* At = Mapping + sizeof(tk_cache_header);
+    token_value* Values = (token_value*)At;     At += Count * sizeof(token_value);
+    int* Offsets = (int*)At;                    At += Count * sizeof(int);
+    int* Lengths = (int*)At;                    At += Count * sizeof(int);
+    int* Lines = (int*)At;                      At += Count * sizeof(int);
+    unsigned char* Types = (unsigned char*)At;
+
+    // The hash in the header is the one of the source, not of the tokens, so a truncated or damaged
+    // payload is only caught here: every token must be in the source, in order, and end with TOKEN_EOS.
+    bool Result = Types[Count - 1] == TOKEN_EOS;
+    int Previous = 0;
+
+    for (int i = 0; Result && i < Count; ++i) {
+        if (Types[i] >= TOKEN_TYPE_COUNT || Offsets[i] < Previous || Lengths[i] < 0 ||
+            (long long)Offsets[i] + (Types[i] == TOKEN_EOS ? 0 : Lengths[i]) > Key->Bytes || (Types[i] == TOKEN_IDENT && Values[i].Atom > MaxAtom)) {
+            Result = false;
+        }
+
+        Previous = Offsets[i];
+    }
+
+    // Intern the identifiers in the order lexing would have, from the data. Usually the interner is in
+    // the same state as when the file was written and every atom is the same, otherwise the tokens are
+    // fixed up. Every identifier must then have the text of its atom.
+    tokenizer_interner* Interner = Tokenizer->Interner;
+    tk_cache_atom* Atoms = (tk_cache_atom*)(Mapping + AtomsAt);
+    char* Base = Tokenizer->At;
+
+    unsigned int* Remap = 0;
+    bool Moved = false;
+
+    if (Result && Interner) {
+        Remap = (unsigned int*)TOKENIZER_MALLOC(((size_t)MaxAtom + 1) * sizeof(unsigned int));
+        if (!Remap) {
+            SetError(Tokenizer, "Out of memory for the token buffer");
+            Result = false;
+        }
+        else {
+            memset(Remap, 0, ((size_t)MaxAtom + 1) * sizeof(unsigned int));
+        }
+    }
+
+    for (int i = 0; Result && i < Header->AtomCount; ++i) {
+        tk_cache_atom* Atom = &Atoms[i];
+        int Token = Atom->Token;
+
+        if (!Interner || Atom->Atom == 0 || Atom->Atom > MaxAtom || Remap[Atom->Atom] || Token < 0 || Token >= Count ||
+            Types[Token] != TOKEN_IDENT || Values[Token].Atom != Atom->Atom) {
+            Result = false;
+            break;
+        }
+
+        unsigned int New = Intern(Interner, Base + Offsets[Token], Lengths[Token]);
+
+        if (!New) {
+            SetError(Tokenizer, "Out of memory for the interner");
+            Result = false;
+            break;
+        }
+
+        Remap[Atom->Atom] = New;
+        Moved = Moved || New != Atom->Atom;
+    }
+
+    for (int i = 0; Result && i < Count; ++i) {
+        if (Types[i] != TOKEN_IDENT) continue;
+
+        if (!Interner) {
+            Result = Values[i].Atom == 0;
+            continue;
+        }
+
+        int Length = 0;
+        const char* Text = GetAtomText(Interner, Remap[Values[i].Atom], &Length);
+        Result = Text && Length == Lengths[i] && memcmp(Text, Base + Offsets[i], Length) == 0;
+    }
+
+    if (Result && Moved) {
+        for (int i = 0; i < Count; ++i) {
+            if (Types[i] == TOKEN_IDENT) Values[i].Atom = Remap[Values[i].Atom];
+        }
+    }
+
+    TOKENIZER_FREE(Remap);
+
+    if (!Result) {
+        TkUnmapFile(Mapping, Size);
+        return false;
+    }
+
+    Buffer->Count = Count;
+    Buffer->Capacity = Count;
+    Buffer->Types = Types;
+    Buffer->Offsets = Offsets;
+    Buffer->Lengths = Lengths;
+    Buffer->Values = Values;
+    Buffer->Lines = Lines;
+    Buffer->Base = Base;
+    Buffer->Mapping = Mapping;
+    Buffer->MappingSize = Size;
+
+    // Like TokenizeAll, stay on the terminator.
+    Tokenizer->At = Buffer->Base + Offsets[Count - 1];
+    Tokenizer->Line = Lines[Count - 1];
+    Tokenizer->TokenNewLines = 0;
+    Tokenizer->LookaheadCount = 0;
+
+    return true;
+}
+
+// Failing to write the cache isn't an error, the next run lexes the data again.
+static void WriteTokenCache(tokenizer* Tokenizer, token_buffer* Buffer, const char* CachePath, tk_cache_header* Header) {
+    tokenizer_interner* Interner = Tokenizer->Interner;
+    int Count = Buffer->Count;
+
+    // The first token of each identifier of the data.
+    int* Atoms = 0;
+    unsigned char* Seen = 0;
+
+    if (Interner && Interner->AtomCount) {
+        int Capacity = Count < Interner->AtomCount ? Count : Interner->AtomCount;
+
+        Atoms = (int*)TOKENIZER_MALLOC(Capacity * sizeof(int));
+        Seen = (unsigned char*)TOKENIZER_MALLOC(Interner->AtomCount);
+
+        if (!Atoms || !Seen) {
+            TOKENIZER_FREE(Atoms);
+            TOKENIZER_FREE(Seen);
+            return;
+        }
+
+        memset(Seen, 0, Interner->AtomCount);
+
+        for (int i = 0; i < Count; ++i) {
+            unsigned int Atom = Buffer->Values[i].Atom;
+
+            if (Buffer->Types[i] == TOKEN_IDENT && Atom && (int)Atom < Interner->AtomCount && !Seen[Atom]) {
+                Seen[Atom] = 1;
+                Atoms[Header->AtomCount++] = i;
+                if (Atom > Header->MaxAtom) Header->MaxAtom = Atom;
+            }
+        }
+    }
+
+    Header->Count = Count;
+
+    size_t PathLength = strlen(CachePath);
+    char* Temporary = (char*)TOKENIZER_MALLOC(PathLength + 32);
+    FILE* File = 0;
+
+    if (Temporary) {
+        snprintf(Temporary, PathLength + 32, "%s.%lu.tmp", CachePath, TkProcessId());
+        File = fopen(Temporary, "wb");
+    }
+
+    if (File) {
+        static const char Zeros[8] = {};
+        unsigned long long AtomsAt = 0;
+        TkCacheSize(Header, &AtomsAt);
+
+        size_t Padding = (size_t)(AtomsAt - sizeof(tk_cache_header) - (unsigned long long)Count * TOKEN_BUFFER_BYTES_PER_TOKEN);
+
+        bool Written = fwrite(Header, sizeof(tk_cache_header), 1, File) == 1;
+        Written = Written && fwrite(Buffer->Values, sizeof(token_value), Count, File) == (size_t)Count;
+        Written = Written && fwrite(Buffer->Offsets, sizeof(int), Count, File) == (size_t)Count;
+        Written = Written && fwrite(Buffer->Lengths, sizeof(int), Count, File) == (size_t)Count;
+        Written = Written && fwrite(Buffer->Lines, sizeof(int), Count, File) == (size_t)Count;
+        Written = Written && fwrite(Buffer->Types, sizeof(unsigned char), Count, File) == (size_t)Count;
+        Written = Written && fwrite(Zeros, 1, Padding, File) == Padding;
+
+        for (int i = 0; Written && i < Header->AtomCount; ++i) {
+            tk_cache_atom Atom;
+            Atom.Atom = Buffer->Values[Atoms[i]].Atom;
+            Atom.Token = Atoms[i];
+            Written = fwrite(&Atom, sizeof(Atom), 1, File) == 1;
+        }
+
+        Written = fclose(File) == 0 && Written;
+
+        if (!Written || !TkReplaceFile(Temporary, CachePath)) {
+            remove(Temporary);
+        }
+    }
+
+    TOKENIZER_FREE(Temporary);
+    TOKENIZER_FREE(Atoms);
+    TOKENIZER_FREE(Seen);
+}
+
+TOKENIZER_DEF bool TokenizeAllCached(tokenizer* Tokenizer, token_buffer* Buffer, const char* CachePath, bool* Hit) {
+    std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+
+    if (Hit) *Hit = false;
+
+    size_t Bytes = Tokenizer->End ? (size_t)(Tokenizer->End - Tokenizer->At) : strlen(Tokenizer->At);
+
+    tk_cache_header Header;
+    memset(&Header, 0, sizeof(Header));
+    memcpy(Header.Magic, TkCacheMagic, sizeof(TkCacheMagic));
+    Header.Hash = TkHashData(Tokenizer->At, Bytes, 0);
+    Header.Settings = TkCacheSettings(Tokenizer);
+    Header.Bytes = (long long)Bytes;
+
+    FreeTokenBuffer(Buffer);
+
+    if (!Tokenizer->Error && LoadTokenCache(Tokenizer, Buffer, CachePath, &Header)) {
+        Buffer->Bytes = Tokenizer->At - Buffer->Base;
+        Buffer->Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+
+        if (Hit) *Hit = true;
+        return true;
+    }
+
+    if (Tokenizer->Error || !TokenizeAll(Tokenizer, Buffer)) {
+        return false;
+    }
+
+    WriteTokenCache(Tokenizer, Buffer, CachePath, &Header);
+    return true;
+}
+
+#ifdef TOKENIZER_PARALLEL
+
+struct tokenizer_chunk {
+    char* Start;
+    char* End;
+
+    // Speculative tokens. Lines are relative to the start of the chunk.
+    token_buffer Tokens;
+
+    // First token starting at or after 'End', and its relative line.
+    char* Resume;
+    int ResumeLine;
+
+    // Set by the fix-up pass: tokens re-lexed from the real starting point, followed by the
+    // speculative tokens from 'First' on, which need 'LineOffset' added to their lines.
+    token_buffer Fixup;
+    int First;
+    int LineOffset;
+
+    bool Failed;
+};
+
+static void LexChunk(tokenizer* Tokenizer, tokenizer_chunk* Chunk) {
+    token_buffer* Tokens = &Chunk->Tokens;
+
+    char* c = Chunk->Start;
+    int Line = 0;
+
+    for (;;) {
+        token Token = NextToken(Tokenizer, c, &Line);
+        int TokenLine = Line - CountedNewLines(Tokenizer, &Token);
+
+        if (Token.Text >= Chunk->End || Token.Type == TOKEN_EOS) {
+            Chunk->Resume = Token.Text;
+            Chunk->ResumeLine = TokenLine;
+            break;
+        }
+
+        if (Tokens->Count == Tokens->Capacity && !GrowTokenBuffer(Tokens)) {
+            Chunk->Failed = true;
+            break;
+        }
+
+        SetBufferToken(Tokens, Tokens->Count++, &Token, TokenLine);
+        c = Token.Text + Token.Length;
+    }
+}
+
+// Index of the first speculative token at or after 'Offset'.
+static int FindChunkToken(tokenizer_chunk* Chunk, int Offset) {
+    int Low = 0, High = Chunk->Tokens.Count;
+
+    while (Low < High) {
+        int Mid = (Low + High) / 2;
+        if (Chunk->Tokens.Offsets[Mid] < Offset) Low = Mid + 1;
+        else High = Mid;
+    }
+
+    return Low;
+}
+
+// The lexer has no state apart from its position, so as soon as the real token stream reaches the
+// start of a speculative token both streams are the same from there on (only lines are shifted).
+// Given the real start of the first token in the chunk, finds that point, re-lexing what comes before it.
+static void FixupChunk(tokenizer* Tokenizer, tokenizer_chunk* Chunk, char** Resume, int* ResumeLine) {
+    char* Base = Chunk->Tokens.Base;
+
+    Chunk->First = Chunk->Tokens.Count;
+    Chunk->LineOffset = 0;
+
+    // Something that began in an earlier chunk (a long comment, say) covers the whole chunk.
+    if (*Resume >= Chunk->End) {
+        return;
+    }
+
+    char* c = *Resume;
+    int Line = *ResumeLine;
+    int Index = FindChunkToken(Chunk, (int)(c - Base));
+
+    for (;;) {
+        token Token = NextToken(Tokenizer, c, &Line);
+        int TokenLine = Line - CountedNewLines(Tokenizer, &Token);
+
+        if (Token.Text >= Chunk->End || Token.Type == TOKEN_EOS) {
+            *Resume = Token.Text;
+            *ResumeLine = TokenLine;
+            return;
+        }
+
+        int Offset = (int)(Token.Text - Base);
+        while (Index < Chunk->Tokens.Count && Chunk->Tokens.Offsets[Index] < Offset) {
+            ++Index;
+        }
+
+        if (Index < Chunk->Tokens.Count && Chunk->Tokens.Offsets[Index] == Offset) {
+            Chunk->First = Index;
+            Chunk->LineOffset = TokenLine - Chunk->Tokens.Lines[Index];
+
+            *Resume = Chunk->Resume;
+            *ResumeLine = Chunk->ResumeLine + Chunk->LineOffset;
+            return;
+        }
+
+        token_buffer* Fixup = &Chunk->Fixup;
+        if (Fixup->Count == Fixup->Capacity && !GrowTokenBuffer(Fixup)) {
+            Chunk->Failed = true;
+            return;
+        }
+
+        SetBufferToken(Fixup, Fixup->Count++, &Token, TokenLine);
+        c = Token.Text + Token.Length;
+    }
+}
+
+// Splits 'Base'..'End' in chunks of about 'ChunkSize' bytes. Chunks end right after a newline, which
+// is rarely inside a string or a comment. Returns 0 when out of memory.
+static tokenizer_chunk* SplitChunks(char* Base, char* End, int ChunkSize, int* Count) {
+    int ChunkCount = (int)((End - Base + ChunkSize - 1) / ChunkSize);
+    tokenizer_chunk* Chunks = (tokenizer_chunk*)TOKENIZER_MALLOC(ChunkCount * sizeof(tokenizer_chunk));
+    if (!Chunks) {
+        return 0;
+    }
+
+    char* At = Base;
+    *Count = 0;
+
+    while (At < End) {
+        char* Split = (End - At > ChunkSize) ? At + ChunkSize : End;
+        char* NewLine = Split < End ? (char*)memchr(Split, '\n', End - Split) : 0;
+        Split = NewLine ? NewLine + 1 : End;
+
+        tokenizer_chunk* Chunk = &Chunks[(*Count)++];
+        *Chunk = tokenizer_chunk();
+        Chunk->Start = At;
+        Chunk->End = Split;
+        InitTokenBuffer(&Chunk->Tokens, 0);
+        InitTokenBuffer(&Chunk->Fixup, 0);
+        Chunk->Tokens.Base = Chunk->Fixup.Base = Base;
+
+        At = Split;
+    }
+
+    return Chunks;
+}
+
+static void FreeChunks(tokenizer_chunk* Chunks, int Count) {
+    for (int i = 0; i < Count; ++i) {
+        FreeTokenBuffer(&Chunks[i].Tokens);
+        FreeTokenBuffer(&Chunks[i].Fixup);
+    }
+    TOKENIZER_FREE(Chunks);
+}
+
+// Fix-up pass over lexed chunks, 'Line' being the line of the first one. The first chunk started
+// where the tokenizer was, so it is always right. Returns the number of tokens of the merged stream
+// with its EOS, or -1 when out of memory.
+static long long int FixupChunks(tokenizer* Speculative, tokenizer_chunk* Chunks, int Count, int Line, char** Resume, int* ResumeLine) {
+    *Resume = Chunks[0].Resume;
+    *ResumeLine = Chunks[0].ResumeLine + Line;
+    Chunks[0].First = 0;
+    Chunks[0].LineOffset = Line;
+
+    bool Failed = Chunks[0].Failed;
+    long long int Total = Chunks[0].Tokens.Count + 1;
+
+    for (int i = 1; i < Count && !Failed; ++i) {
+        FixupChunk(Speculative, &Chunks[i], Resume, ResumeLine);
+        Failed = Chunks[i].Failed;
+        Total += Chunks[i].Fixup.Count + Chunks[i].Tokens.Count - Chunks[i].First;
+    }
+
+    return Failed ? -1 : Total;
+}
+
+// Copies the fixed-up chunks to 'Buffer', interning identifiers with the tokenizer's interner, and
+// moves the tokenizer to the end. Returns false when out of memory.
+static bool MergeChunks(tokenizer* Tokenizer, token_buffer* Buffer, tokenizer_chunk* Chunks, int Count, long long int Total, char* Resume, int ResumeLine) {
+    char* Base = Buffer->Base;
+
+    if (Buffer->Arena) {
+        CarveArenaTokenBuffer(Buffer);
+    }
+    else {
+        while (Buffer->Capacity < Total && GrowTokenBuffer(Buffer));
+    }
+
+    bool Failed = Buffer->Capacity < Total;
+
+    if (!Failed) {
+        int Index = 0;
+
+        for (int i = 0; i < Count; ++i) {
+            tokenizer_chunk* Chunk = &Chunks[i];
+            token_buffer* Parts[2] = { &Chunk->Fixup, &Chunk->Tokens };
+
+            for (int p = 0; p < 2; ++p) {
+                int First = p ? Chunk->First : 0;
+                int LineOffset = p ? Chunk->LineOffset : 0;
+                int PartCount = Parts[p]->Count - First;
+                if (PartCount <= 0) continue;
+
+                memcpy(Buffer->Types + Index, Parts[p]->Types + First, PartCount * sizeof(unsigned char));
+                memcpy(Buffer->Offsets + Index, Parts[p]->Offsets + First, PartCount * sizeof(int));
+                memcpy(Buffer->Lengths + Index, Parts[p]->Lengths + First, PartCount * sizeof(int));
+                memcpy(Buffer->Values + Index, Parts[p]->Values + First, PartCount * sizeof(token_value));
+
+                for (int t = 0; t < PartCount; ++t) {
+                    Buffer->Lines[Index + t] = Parts[p]->Lines[First + t] + LineOffset;
+                }
+
+                if (Tokenizer->Interner) {
+                    for (int t = Index; t < Index + PartCount && !Failed; ++t) {
+                        if (Buffer->Types[t] != TOKEN_IDENT) continue;
+
+                        Buffer->Values[t].Atom = Intern(Tokenizer->Interner, Base + Buffer->Offsets[t], Buffer->Lengths[t]);
+                        Failed = !Buffer->Values[t].Atom;
+                    }
+                }
+
+                Index += PartCount;
+            }
+        }
+
+        token Eos = NextToken(Tokenizer, Resume, &ResumeLine);
+        SetBufferToken(Buffer, Index++, &Eos, ResumeLine);
+
+        Buffer->Count = Index;
+        Tokenizer->At = Resume;
+        Tokenizer->Line = ResumeLine;
+        Tokenizer->TokenNewLines = 0;
+    }
+
+    if (Buffer->Arena) {
+        if (Failed) Buffer->Count = 0;
+        PackArenaTokenBuffer(Buffer);
+    }
+
+    return !Failed;
+}
+
+TOKENIZER_DEF bool TokenizeAllParallel(tokenizer* Tokenizer, token_buffer* Buffer, int ThreadCount, int ChunkSize) {
+
+    if (ThreadCount <= 0) ThreadCount = (int)std::thread::hardware_concurrency();
+    if (ThreadCount <= 0) ThreadCount = 1;
+    if (ChunkSize <= 0) ChunkSize = 1 << 20;
+
+    char* Base = Tokenizer->At;
+    char* End = Tokenizer->End ? Tokenizer->End : Base + strlen(Base);
+
+    if (ThreadCount == 1 || End - Base < 2 * (long long int)ChunkSize) {
+        return TokenizeAll(Tokenizer, Buffer);
+    }
+
+    std::chrono::steady_clock::time_point StartTime = std::chrono::steady_clock::now();
+
+    // Peeked tokens would be lexed again from 'At' anyway.
+    Tokenizer->LookaheadCount = 0;
+
+    FreeTokenBuffer(Buffer);
+    Buffer->Base = Base;
+
+    int Count;
+    tokenizer_chunk* Chunks = SplitChunks(Base, End, ChunkSize, &Count);
+    if (!Chunks) {
+        SetError(Tokenizer, "Out of memory for the token buffer");
+        return false;
+    }
+
+    // The calling thread is one of the workers.
+    std::atomic<int> NextChunk(0);
+
+    // The interner isn't thread safe, so atoms are left at 0 and filled in while merging, in order.
+    tokenizer Speculative = *Tokenizer;
+    Speculative.Interner = 0;
+#ifdef TOKENIZER_STATS
+    Speculative.Stats = 0;
+#endif
+
+    auto Worker = [&]() {
+        for (;;) {
+            int Index = NextChunk.fetch_add(1);
+            if (Index >= Count) break;
+            LexChunk(&Speculative, &Chunks[Index]);
+        }
+    };
+
+    if (ThreadCount > Count) ThreadCount = Count;
+
+    std::thread* Threads = new std::thread[ThreadCount - 1];
+    for (int i = 0; i < ThreadCount - 1; ++i) Threads[i] = std::thread(Worker);
+    Worker();
+    for (int i = 0; i < ThreadCount - 1; ++i) Threads[i].join();
+    delete[] Threads;
+
+    char* Resume;
+    int ResumeLine;
+    long long int Total = FixupChunks(&Speculative, Chunks, Count, Tokenizer->Line + Tokenizer->TokenNewLines, &Resume, &ResumeLine);
+
+    bool Failed = Total < 0 || !MergeChunks(Tokenizer, Buffer, Chunks, Count, Total, Resume, ResumeLine);
+
+    FreeChunks(Chunks, Count);
+
+    if (Failed) {
+        SetError(Tokenizer, "Out of memory for the token buffer");
+    }
+
+    Buffer->Bytes = Tokenizer->At - Base;
+    Buffer->Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+
+    return !Tokenizer->Error;
+}
+
+// TokenizeBatch. Each worker has a deque of tasks: it takes from the back of its own and steals from
+// the front of the others. A task is a whole file, or a chunk of a big file: the worker that opens a
+// big file splits it and pushes its chunks, so idle workers steal them, and the worker that lexes the
+// last chunk fixes them up and merges them. Tasks are coarse, so a lock per deque is enough.
+
+struct tk_batch_task {
+    int File;
+    int Chunk;                  // -1 for the whole file
+};
+
+struct tk_batch_queue {
+    std::mutex Lock;
+    tk_batch_task* Tasks = 0;
+    int First = 0;
+    int Count = 0;
+    int Capacity = 0;
+};
+
+struct tk_batch_split {
+    tokenizer Speculative;
+    tokenizer_chunk* Chunks;
+    int Count;
+    std::atomic<int> Remaining;
+};
+
+struct tk_batch_state {
+    tokenizer_batch* Batch;
+    tk_batch_queue* Queues;
+    tk_batch_split** Splits;    // By file
+    std::atomic<long long int> Pending;
+    int ChunkSize;
+    size_t BlockSize;
+};
+
+static bool PushBatchTask(tk_batch_queue* Queue, tk_batch_task Task) {
+    std::lock_guard<std::mutex> Lock(Queue->Lock);
+
+    if (Queue->Count == Queue->Capacity) {
+        if (Queue->First > 0) {
+            memmove(Queue->Tasks, Queue->Tasks + Queue->First, (Queue->Count - Queue->First) * sizeof(tk_batch_task));
+            Queue->Count -= Queue->First;
+            Queue->First = 0;
+        }
+        else {
+            int Capacity = Queue->Capacity ? 2 * Queue->Capacity : 64;
+            tk_batch_task* Tasks = (tk_batch_task*)TOKENIZER_REALLOC(Queue->Tasks, Capacity * sizeof(tk_batch_task));
+            if (!Tasks) return false;
+
+            Queue->Tasks = Tasks;
+            Queue->Capacity = Capacity;
+        }
+    }
+
+    Queue->Tasks[Queue->Count++] = Task;
+    return true;
+}
+
+static bool PopBatchTask(tk_batch_queue* Queue, tk_batch_task* Task, bool Steal) {
+    std::lock_guard<std::mutex> Lock(Queue->Lock);
+
+    if (Queue->First == Queue->Count) {
+        return false;
+    }
+
+    *Task = Steal ? Queue->Tasks[Queue->First++] : Queue->Tasks[--Queue->Count];
+    return true;
+}
+
+// Makes room for 'Size' bytes in the worker's arena, in a new block if needed.
+static bool ReserveBatchArena(tokenizer_batch_worker* Worker, size_t Size, size_t BlockSize) {
+    size_t Start = (Worker->Arena.Used + 7) & ~(size_t)7;
+
+    if (Worker->Blocks && Start <= Worker->Arena.Size && Size <= Worker->Arena.Size - Start) {
+        return true;
+    }
+
+    // The header is 8 bytes too, so the arrays stay aligned.
+    if (Size + 8 > BlockSize) BlockSize = Size + 8;
+
+    char* Block = (char*)TOKENIZER_MALLOC(BlockSize);
+    if (!Block) {
+        return false;
+    }
+
+    memcpy(Block, &Worker->Blocks, sizeof(char*));
+    Worker->Blocks = Block;
+
+    InitArena(&Worker->Arena, Block, BlockSize);
+    PushArena(&Worker->Arena, sizeof(char*));
+    return true;
+}
+
+static void MergeBatchFile(tk_batch_state* State, int WorkerIndex, int Index) {
+    tokenizer_batch* Batch = State->Batch;
+    tokenizer_batch_worker* Worker = &Batch->Workers[WorkerIndex];
+    tokenizer_batch_file* File = &Batch->Files[Index];
+    tk_batch_split* Split = State->Splits[Index];
+    tokenizer* Tokenizer = &File->Tokenizer;
+
+    char* Resume;
+    int ResumeLine;
+    long long int Total = FixupChunks(&Split->Speculative, Split->Chunks, Split->Count, Tokenizer->Line, &Resume, &ResumeLine);
+
+    InitTokenBuffer(&File->Tokens, &Worker->Arena);
+    File->Tokens.Base = Tokenizer->At;
+
+    Tokenizer->Interner = Batch->Intern ? &Worker->Shard : 0;
+
+    File->Error = Total < 0 ||
+        !ReserveBatchArena(Worker, (size_t)Total * TOKEN_BUFFER_BYTES_PER_TOKEN + 8, State->BlockSize) ||
+        !MergeChunks(Tokenizer, &File->Tokens, Split->Chunks, Split->Count, Total, Resume, ResumeLine);
+
+    File->Tokens.Bytes = Tokenizer->At - File->Tokens.Base;
+    File->Shard = Tokenizer->Interner ? WorkerIndex : -1;
+    Tokenizer->Interner = 0;
+
+    FreeChunks(Split->Chunks, Split->Count);
+    delete Split;
+    State->Splits[Index] = 0;
+}
+
+static void LexBatchChunk(tk_batch_state* State, int WorkerIndex, int Index, int Chunk) {
+    tk_batch_split* Split = State->Splits[Index];
+
+    LexChunk(&Split->Speculative, &Split->Chunks[Chunk]);
+    ++State->Batch->Workers[WorkerIndex].Chunks;
+
+    if (Split->Remaining.fetch_sub(1) == 1) {
+        MergeBatchFile(State, WorkerIndex, Index);
+    }
+}
+
+static void LexBatchFile(tk_batch_state* State, int WorkerIndex, int Index) {
+    tokenizer_batch* Batch = State->Batch;
+    tokenizer_batch_worker* Worker = &Batch->Workers[WorkerIndex];
+    tokenizer_batch_file* File = &Batch->Files[Index];
+    tokenizer* Tokenizer = &File->Tokenizer;
+
+    if (File->Data) {
+        InitTokenizer(Tokenizer, File->Data, File->Path);
+        if (File->Size) Tokenizer->End = File->Data + File->Size;
+    }
+    else if (!File->Path || !InitTokenizerFromFile(Tokenizer, File->Path)) {
+        File->Error = true;
+        return;
+    }
+
+    Tokenizer->Operators = Batch->Operators;
+    Tokenizer->Interner = 0;
+
+    char* End = Tokenizer->End ? Tokenizer->End : Tokenizer->At + strlen(Tokenizer->At);
+    size_t Size = End - Tokenizer->At;
+
+    ++Worker->Files;
+    Worker->Bytes += Size;
+
+    if (Batch->WorkerCount > 1 && Size >= 2 * (size_t)State->ChunkSize) {
+        tk_batch_split* Split = new tk_batch_split;
+        Split->Speculative = *Tokenizer;
+        Split->Chunks = SplitChunks(Tokenizer->At, End, State->ChunkSize, &Split->Count);
+
+        if (!Split->Chunks) {
+            delete Split;
+            File->Error = true;
+            return;
+        }
+
+        Split->Remaining = Split->Count;
+        State->Splits[Index] = Split;
+
+        // This task becomes the first chunk. The others go to the back of the queue, the second one
+        // last so that this worker goes on with it while the far ones are stolen.
+        State->Pending += Split->Count - 1;
+
+        for (int i = Split->Count - 1; i > 0; --i) {
+            if (!PushBatchTask(&State->Queues[WorkerIndex], { Index, i })) {
+                LexBatchChunk(State, WorkerIndex, Index, i);
+                --State->Pending;
+            }
+        }
+
+        LexBatchChunk(State, WorkerIndex, Index, 0);
+        return;
+    }
+
+    // Never more tokens than bytes, plus the EOS.
+    Tokenizer->Interner = Batch->Intern ? &Worker->Shard : 0;
+    InitTokenBuffer(&File->Tokens, &Worker->Arena);
+
+    File->Error = !ReserveBatchArena(Worker, (Size + 1) * TOKEN_BUFFER_BYTES_PER_TOKEN + 8, State->BlockSize) ||
+        !TokenizeAll(Tokenizer, &File->Tokens);
+
+    File->Shard = Tokenizer->Interner ? WorkerIndex : -1;
+    Tokenizer->Interner = 0;
+}
+
+static void RunBatchWorker(tk_batch_state* State, int WorkerIndex) {
+    tokenizer_batch* Batch = State->Batch;
+    tokenizer_batch_worker* Worker = &Batch->Workers[WorkerIndex];
+    int Count = Batch->WorkerCount;
+
+    for (;;) {
+        tk_batch_task Task;
+        bool Found = PopBatchTask(&State->Queues[WorkerIndex], &Task, false);
+
+        for (int i = 1; i < Count && !Found; ++i) {
+            Found = PopBatchTask(&State->Queues[(WorkerIndex + i) % Count], &Task, true);
+            Worker->Steals += Found;
+        }
+
+        if (!Found) {
+            // Tasks still running may split their file and push more.
+            if (State->Pending.load() == 0) break;
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+
+        if (Task.Chunk < 0) LexBatchFile(State, WorkerIndex, Task.File);
+        else LexBatchChunk(State, WorkerIndex, Task.File, Task.Chunk);
+
+        Worker->Seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+        --State->Pending;
+    }
+}
+
+// Interns the atoms of every shard into the batch's interner, then rewrites the tokens in parallel.
+static bool MergeBatchShards(tokenizer_batch* Batch) {
+    int WorkerCount = Batch->WorkerCount;
+    unsigned int** Remaps = (unsigned int**)TOKENIZER_MALLOC(WorkerCount * sizeof(unsigned int*));
+    if (!Remaps) {
+        return false;
+    }
+
+    bool Failed = false;
+
+    for (int w = 0; w < WorkerCount; ++w) {
+        tokenizer_interner* Shard = &Batch->Workers[w].Shard;
+        Remaps[w] = (unsigned int*)TOKENIZER_MALLOC((Shard->AtomCount + 1) * sizeof(unsigned int));
+
+        if (!Remaps[w]) {
+            Failed = true;
+            continue;
+        }
+
+        Remaps[w][0] = 0;
+        for (int a = 1; a < Shard->AtomCount && !Failed; ++a) {
+            Remaps[w][a] = Intern(Batch->Interner, Shard->Atoms[a].Text, Shard->Atoms[a].Length);
+            Failed = !Remaps[w][a];
+        }
+    }
+
+    if (!Failed) {
+        std::atomic<int> NextFile(0);
+
+        auto Worker = [&]() {
+            for (;;) {
+                int Index = NextFile.fetch_add(1);
+                if (Index >= Batch->FileCount) break;
+
+                tokenizer_batch_file* File = &Batch->Files[Index];
+                if (File->Shard < 0) continue;
+
+                unsigned int* Remap = Remaps[File->Shard];
+                token_buffer* Tokens = &File->Tokens;
+
+                for (int t = 0; t < Tokens->Count; ++t) {
+                    if (Tokens->Types[t] == TOKEN_IDENT) Tokens->Values[t].Atom = Remap[Tokens->Values[t].Atom];
+                }
+
+                File->Shard = -1;
+            }
+        };
+
+        std::thread* Threads = new std::thread[WorkerCount - 1];
+        for (int i = 0; i < WorkerCount - 1; ++i) Threads[i] = std::thread(Worker);
+        Worker();
+        for (int i = 0; i < WorkerCount - 1; ++i) Threads[i].join();
+        delete[] Threads;
+
+        for (int w = 0; w < WorkerCount; ++w) {
+            FreeInterner(&Batch->Workers[w].Shard);
+        }
+    }
+
+    for (int w = 0; w < WorkerCount; ++w) {
+        TOKENIZER_FREE(Remaps[w]);
+    }
+    TOKENIZER_FREE(Remaps);
+
+    return !Failed;
+}
+
+TOKENIZER_DEF bool TokenizeBatch(tokenizer_batch* Batch) {
+    FreeBatch(Batch);
+
+    std::chrono::steady_clock::time_point StartTime = std::chrono::steady_clock::now();
+
+    int ThreadCount = Batch->ThreadCount;
+    if (ThreadCount <= 0) ThreadCount = (int)std::thread::hardware_concurrency();
+    if (ThreadCount <= 0) ThreadCount = 1;
+
+    tk_batch_state State;
+    State.Batch = Batch;
+    State.ChunkSize = Batch->ChunkSize > 0 ? Batch->ChunkSize : 1 << 20;
+    State.BlockSize = Batch->BlockSize > 0 ? Batch->BlockSize : (size_t)64 << 20;
+    State.Pending = 0;
+
+    Batch->Workers = (tokenizer_batch_worker*)TOKENIZER_MALLOC(ThreadCount * sizeof(tokenizer_batch_worker));
+    State.Splits = (tk_batch_split**)TOKENIZER_MALLOC((Batch->FileCount + 1) * sizeof(tk_batch_split*));
+
+    if (!Batch->Workers || !State.Splits) {
+        TOKENIZER_FREE(Batch->Workers);
+        TOKENIZER_FREE(State.Splits);
+        Batch->Workers = 0;
+        Batch->FailedCount = Batch->FileCount;
+        return Batch->FileCount == 0;
+    }
+
+    Batch->WorkerCount = ThreadCount;
+    for (int w = 0; w < ThreadCount; ++w) {
+        Batch->Workers[w] = tokenizer_batch_worker();
+        InitInterner(&Batch->Workers[w].Shard, 0);
+    }
+
+    // Dealt out in turns, and pushed backwards so that each worker takes its files in order.
+    State.Queues = new tk_batch_queue[ThreadCount];
+
+    for (int i = Batch->FileCount - 1; i >= 0; --i) {
+        Batch->Files[i].Error = !PushBatchTask(&State.Queues[i % ThreadCount], { i, -1 });
+        State.Splits[i] = 0;
+        State.Pending += !Batch->Files[i].Error;
+    }
+
+    std::thread* Threads = new std::thread[ThreadCount - 1];
+    for (int i = 0; i < ThreadCount - 1; ++i) Threads[i] = std::thread(RunBatchWorker, &State, i + 1);
+    RunBatchWorker(&State, 0);
+    for (int i = 0; i < ThreadCount - 1; ++i) Threads[i].join();
+    delete[] Threads;
+
+    for (int w = 0; w < ThreadCount; ++w) {
+        TOKENIZER_FREE(State.Queues[w].Tasks);
+    }
+    delete[] State.Queues;
+    TOKENIZER_FREE(State.Splits);
+
+    if (Batch->Intern && Batch->Interner && !MergeBatchShards(Batch)) {
+        for (int i = 0; i < Batch->FileCount; ++i) {
+            Batch->Files[i].Error |= Batch->Files[i].Shard >= 0;
+        }
+    }
+
+    for (int i = 0; i < Batch->FileCount; ++i) {
+        Batch->FailedCount += Batch->Files[i].Error;
+        Batch->TokenCount += Batch->Files[i].Tokens.Count;
+    }
+
+    for (int w = 0; w < ThreadCount; ++w) {
+        Batch->Bytes += Batch->Workers[w].Bytes;
+    }
+
+    Batch->Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+
+    return Batch->FailedCount == 0;
+}
+
+TOKENIZER_DEF void FreeBatch(tokenizer_batch* Batch) {
+    for (int i = 0; i < Batch->FileCount; ++i) {
+        tokenizer_batch_file* File = &Batch->Files[i];
+
+        FreeTokenizer(&File->Tokenizer);
+        File->Tokenizer = tokenizer();
+        File->Tokens = token_buffer();
+        File->Shard = -1;
+        File->Error = false;
+    }
+
+    for (int w = 0; w < Batch->WorkerCount; ++w) {
+        tokenizer_batch_worker* Worker = &Batch->Workers[w];
+        FreeInterner(&Worker->Shard);
+
+        while (char* Block = Worker->Blocks) {
+            memcpy(&Worker->Blocks, Block, sizeof(char*));
+            TOKENIZER_FREE(Block);
+        }
+    }
+
+    TOKENIZER_FREE(Batch->Workers);
+    Batch->Workers = 0;
+    Batch->WorkerCount = 0;
+    Batch->FailedCount = 0;
+    Batch->Bytes = 0;
+    Batch->TokenCount = 0;
+    Batch->Seconds = 0;
+}
+
+#endif // TOKENIZER_PARALLEL
+
+TOKENIZER_DEF token GetBufferToken(token_buffer* Buffer, int Index) {
+    int Slot = TkBufferSlot(Buffer, Index);
+
+    token Token;
+    Token.Type = (token_type)Buffer->Types[Slot];
+    Token.Length = Buffer->Lengths[Slot];
+    Token.Text = Buffer->Base + TkBufferOffset(Buffer, Index);
+    Token.Int = Buffer->Values[Slot].Int;
+    return Token;
+}
+
+TOKENIZER_DEF int GetBufferLine(token_buffer* Buffer, int Index) {
+    return Buffer->Lines[TkBufferSlot(Buffer, Index)] + (Index < Buffer->Count - Buffer->Tail ? 0 : Buffer->TailLine);
+}
+
+TOKENIZER_DEF double GetTokensPerSecond(token_buffer* Buffer) {
+    return Buffer->Seconds > 0 ? Buffer->Count / Buffer->Seconds : 0;
+}
+
+TOKENIZER_DEF double GetBytesPerToken(token_buffer* Buffer) {
+    return Buffer->Count ? (double)Buffer->Bytes / Buffer->Count : 0;
+}
+
+enum {
+    TK_STREAM_NO_COMMENT,
+    TK_STREAM_LINE_COMMENT,
+    TK_STREAM_BLOCK_COMMENT,
+};
+
+// Drops everything before 'Keep' and reads as much as fits in the window.
+static void RefillStream(tokenizer_stream* Stream, char* Keep) {
+    int Kept = (int)(Stream->End - Keep);
+
+    memmove(Stream->Window, Keep, Kept);
+    Stream->Base += Keep - Stream->Window;
+    Stream->End = Stream->Window + Kept;
+
+    while (!Stream->Eof && Stream->End < Stream->Window + Stream->WindowSize) {
+        int Read = Stream->Read(Stream->User, Stream->End, (int)(Stream->Window + Stream->WindowSize - Stream->End));
+
+        if (Read <= 0) Stream->Eof = true;
+        else Stream->End += Read;
+    }
+
+    *Stream->End = 0;
+}
+
+TOKENIZER_DEF bool InitTokenizerStream(tokenizer_stream* Stream, tokenizer_read_func* Read, void* User,
+                                       int WindowSize, char* Window, const char* Filename) {
+    *Stream = tokenizer_stream();
+
+    if (WindowSize <= 0) WindowSize = 64 * 1024;
+
+    Stream->Read = Read;
+    Stream->User = User;
+    Stream->WindowSize = WindowSize;
+    Stream->Window = Window;
+
+    if (!Stream->Window) {
+        Stream->Window = (char*)TOKENIZER_MALLOC(WindowSize + 1);
+        Stream->OwnsWindow = true;
+
+        if (!Stream->Window) {
+            return false;
+        }
+    }
+
+    Stream->End = Stream->Window;
+    RefillStream(Stream, Stream->Window);
+
+    InitTokenizer(&Stream->Tokenizer, Stream->Window, Filename);
+    return true;
+}
+
+TOKENIZER_DEF void FreeTokenizerStream(tokenizer_stream* Stream) {
+    if (Stream->OwnsWindow) {
+        TOKENIZER_FREE(Stream->Window);
+    }
+
+    *Stream = tokenizer_stream();
+}
+
+// Same as SkipBlanks, but a comment or a run of whitespaces can go on after the end of the window:
+// what has been skipped is dropped, the window is refilled, and we carry on.
+static char* SkipStreamBlanks(tokenizer_stream* Stream, char* c) {
+    int Lines = 0;
+
+    for (;;) {
+        bool More = !Stream->Eof;
+
+        if (Stream->Comment == TK_STREAM_BLOCK_COMMENT) {
+            char* Body = c;
+            c = SkipBlockComment<false, true>(c, 0, &Lines);
+
+            if (*c == '*') {
+                c += 2;
+                Stream->Comment = TK_STREAM_NO_COMMENT;
+            }
+            else if (c == Stream->End && More) {
+                // Keep a trailing '*' of the comment, the '/' closing it might come with the next read.
+                bool Star = Stream->End > Body && Stream->End[-1] == '*';
+                RefillStream(Stream, Star ? Stream->End - 1 : Stream->End);
+                c = Stream->Window;
+                continue;
+            }
+            else {
+                Stream->Comment = TK_STREAM_NO_COMMENT;
+            }
+        }
+        else if (Stream->Comment == TK_STREAM_LINE_COMMENT) {
+            c = SkipLineComment<false>(c, 0);
+
+            if (c == Stream->End && More) {
+                RefillStream(Stream, Stream->End);
+                c = Stream->Window;
+                continue;
+            }
+
+            Stream->Comment = TK_STREAM_NO_COMMENT;
+        }
+
+        c = SkipWhitespace<false, true>(c, 0, &Lines);
+
+        if (c == Stream->End && More) {
+            RefillStream(Stream, Stream->End);
+            c = Stream->Window;
+        }
+        else if (*c == '/' && c + 1 == Stream->End && More) {
+            // Can't tell a comment from a division yet.
+            RefillStream(Stream, c);
+            c = Stream->Window;
+        }
+        else if (*c == '/' && c[1] == '/') {
+            c += 2;
+            Stream->Comment = TK_STREAM_LINE_COMMENT;
+        }
+        else if (*c == '/' && c[1] == '*') {
+            c += 2;
+            Stream->Comment = TK_STREAM_BLOCK_COMMENT;
+        }
+        else break;
+    }
+
+    if (Stream->Tokenizer.CountLines) Stream->Tokenizer.Line += Lines;
+
+    return c;
+}
+
+TOKENIZER_DEF token GetStreamToken(tokenizer_stream* Stream) {
+    tokenizer* Tokenizer = &Stream->Tokenizer;
+
+    Tokenizer->Line += Tokenizer->TokenNewLines;
+    Tokenizer->TokenNewLines = 0;
+
+    char* c = SkipStreamBlanks(Stream, Tokenizer->At);
+
+    for (;;) {
+        // A token cut by the end of the window is lexed again, so its newlines only count once it's kept.
+        int Line = Tokenizer->Line;
+        token Token = NextToken(Tokenizer, c, &Line);
+        int TokenNewLines = CountedNewLines(Tokenizer, &Token);
+
+        if (Token.Type == TOKEN_EOS) {
+            Tokenizer->At = Token.Text;
+            Tokenizer->Line = Line;
+            return Token;
+        }
+
+        // A token that ends this close to the end of the window might go on in the next read.
+        if (Token.Text + Token.Length + TkTokenLookahead(Tokenizer) > Stream->End && !Stream->Eof) {
+
+            if (c == Stream->Window) {
+                SetError(Tokenizer, "Token does not fit in the stream window");
+                Tokenizer->At = Stream->End;
+                return Token;
+            }
+
+            RefillStream(Stream, c);
+            c = Stream->Window;
+            continue;
+        }
+
+        Tokenizer->At = Token.Text + Token.Length;
+        Tokenizer->Line = Line - TokenNewLines;
+        Tokenizer->TokenNewLines = TokenNewLines;
+        return Token;
+    }
+}
+
+#ifdef TOKENIZER_PREPROCESSOR
+
+enum {
+    TK_DIRECTIVE_NONE,          // A '#' alone on its line
+    TK_DIRECTIVE_IF,
+    TK_DIRECTIVE_IFDEF,
+    TK_DIRECTIVE_IFNDEF,
+    TK_DIRECTIVE_ELIF,
+    TK_DIRECTIVE_ELSE,
+    TK_DIRECTIVE_ENDIF,
+    TK_DIRECTIVE_DEFINE,
+    TK_DIRECTIVE_UNDEF,
+    TK_DIRECTIVE_INCLUDE,
+    TK_DIRECTIVE_INCLUDE_NEXT,
+    TK_DIRECTIVE_PRAGMA,
+    TK_DIRECTIVE_ERROR,
+    TK_DIRECTIVE_IGNORED,       // #line, #warning, #ident and line markers
+    TK_DIRECTIVE_UNKNOWN,
+};
+
+enum {
+    TK_BUILTIN_NONE,
+    TK_BUILTIN_LINE,
+    TK_BUILTIN_FILE,
+};
+
+#define TK_MAX_INCLUDE_DEPTH 200
+
+static const struct {
+    const char* Name;
+    int Kind;
+} TkDirectives[] = {
+    { "if", TK_DIRECTIVE_IF }, { "ifdef", TK_DIRECTIVE_IFDEF }, { "ifndef", TK_DIRECTIVE_IFNDEF },
+    { "elif", TK_DIRECTIVE_ELIF }, { "else", TK_DIRECTIVE_ELSE }, { "endif", TK_DIRECTIVE_ENDIF },
+    { "define", TK_DIRECTIVE_DEFINE }, { "undef", TK_DIRECTIVE_UNDEF }, { "include", TK_DIRECTIVE_INCLUDE },
+    { "include_next", TK_DIRECTIVE_INCLUDE_NEXT },
+    { "pragma", TK_DIRECTIVE_PRAGMA }, { "error", TK_DIRECTIVE_ERROR }, { "line", TK_DIRECTIVE_IGNORED },
+    { "warning", TK_DIRECTIVE_IGNORED }, { "ident", TK_DIRECTIVE_IGNORED },
+};
+
+// Grows an array to hold at least 'Needed' elements.
+template <typename T>
+static bool TkReserve(T** Array, int* Capacity, int Needed) {
+    if (Needed <= *Capacity) return true;
+
+    int NewCapacity = *Capacity ? *Capacity : 16;
+    while (NewCapacity < Needed) NewCapacity *= 2;
+
+    T* NewArray = (T*)TOKENIZER_REALLOC(*Array, NewCapacity * sizeof(T));
+    if (!NewArray) return false;
+
+    *Array = NewArray;
+    *Capacity = NewCapacity;
+    return true;
+}
+
+static inline bool TkIsText(token* Token, const char* Text) {
+    int Length = (int)strlen(Text);
+    return Token->Length == Length && memcmp(Token->Text, Text, Length) == 0;
+}
+
+static void SetPreprocessorError(tokenizer_preprocessor* Preprocessor, preprocessor_location Location, const char* Message) {
+    if (Preprocessor->Error) return;
+    Preprocessor->Error = true;
+
+#ifdef TOKENIZER_LOG_ERRORS
+    const char* Path = Location.Source >= 0 ? Preprocessor->Sources[Location.Source].Path : "<command line>";
+    fprintf(stderr, "Error at %s:%d: %s.\n", Path, Location.Line, Message);
+#else
+    (void)Location;
+    (void)Message;
+#endif
+}
+
+static bool PreprocessorOutOfMemory(tokenizer_preprocessor* Preprocessor) {
+    preprocessor_location Nowhere = { -1, 0 };
+    SetPreprocessorError(Preprocessor, Nowhere, "Out of memory");
+    return false;
+}
+
+// Makes room for every atom handed out so far in the atom tables.
+static bool ReserveAtoms(tokenizer_preprocessor* Preprocessor) {
+    int Needed = Preprocessor->Interner.AtomCount + 1;
+    if (Needed <= Preprocessor->AtomCapacity) return true;
+
+    int Capacity = Preprocessor->AtomCapacity;
+    int SourceCapacity = Capacity;
+
+    if (!TkReserve(&Preprocessor->AtomMacros, &Capacity, Needed) ||
+        !TkReserve(&Preprocessor->AtomSources, &SourceCapacity, Capacity)) {
+        return PreprocessorOutOfMemory(Preprocessor);
+    }
+
+    for (int i = Preprocessor->AtomCapacity; i < Capacity; ++i) {
+        Preprocessor->AtomMacros[i] = -1;
+        Preprocessor->AtomSources[i] = -1;
+    }
+
+    Preprocessor->AtomCapacity = Capacity;
+    return true;
+}
+
+// The atom of an identifier or a keyword, 0 for other tokens.
+static unsigned int GetNameAtom(tokenizer_preprocessor* Preprocessor, token* Token) {
+    if (Token->Type == TOKEN_IDENT && Token->Atom) {
+        return Token->Atom;
+    }
+
+    if (Token->Type == TOKEN_KEYWORD) {
+        int Capacity = Preprocessor->KeywordCapacity;
+
+        if (Token->Keyword >= Capacity) {
+            if (!TkReserve(&Preprocessor->KeywordAtoms, &Capacity, Token->Keyword + 1)) return 0;
+
+            memset(Preprocessor->KeywordAtoms + Preprocessor->KeywordCapacity, 0,
+                   (Capacity - Preprocessor->KeywordCapacity) * sizeof(unsigned int));
+            Preprocessor->KeywordCapacity = Capacity;
+        }
+
+        unsigned int* Atom = &Preprocessor->KeywordAtoms[Token->Keyword];
+        if (!*Atom) *Atom = Intern(&Preprocessor->Interner, Token->Text, Token->Length);
+        return *Atom;
+    }
+
+    if (Token->Type == TOKEN_IDENT) {
+        return Intern(&Preprocessor->Interner, Token->Text, Token->Length);
+    }
+
+    return 0;
+}
+
+static int GetMacro(tokenizer_preprocessor* Preprocessor, token* Token) {
+    unsigned int Atom = GetNameAtom(Preprocessor, Token);
+    return Atom && (int)Atom < Preprocessor->AtomCapacity ? Preprocessor->AtomMacros[Atom] : -1;
+}
+
+static bool IsDefined(tokenizer_preprocessor* Preprocessor, unsigned int Atom) {
+    return (int)Atom < Preprocessor->AtomCapacity && Preprocessor->AtomMacros[Atom] >= 0;
+}
+
+static char* ReserveText(tokenizer_preprocessor* Preprocessor, int Length) {
+    if (!TkReserve(&Preprocessor->Text, &Preprocessor->TextCapacity, Length + 1)) {
+        PreprocessorOutOfMemory(Preprocessor);
+        return 0;
+    }
+
+    return Preprocessor->Text;
+}
+
+// Makes a token from text that has no source: the text is interned so it lives as long as the preprocessor.
+// Returns false if the text isn't exactly one token.
+static bool MakeToken(tokenizer_preprocessor* Preprocessor, const char* Text, int Length, token* Token) {
+    unsigned int Atom = Intern(&Preprocessor->Interner, Text, Length);
+    if (!Atom) return PreprocessorOutOfMemory(Preprocessor);
+
+    tokenizer Tokenizer;
+    InitTokenizer(&Tokenizer, Preprocessor->Interner.Atoms[Atom].Text, 0);
+    Tokenizer.Interner = &Preprocessor->Interner;
+    Tokenizer.Operators = Preprocessor->Operators;
+
+    *Token = GetToken(&Tokenizer);
+    token After = GetToken(&Tokenizer);
+
+    return Token->Text == Preprocessor->Interner.Atoms[Atom].Text && Token->Length == Length && After.Type == TOKEN_EOS;
+}
+
+static bool PushStack(tokenizer_preprocessor* Preprocessor, preprocessed_token* Token) {
+    if (!TkReserve(&Preprocessor->Stack, &Preprocessor->StackCapacity, Preprocessor->StackCount + 1)) {
+        return PreprocessorOutOfMemory(Preprocessor);
+    }
+
+    Preprocessor->Stack[Preprocessor->StackCount++] = *Token;
+    return true;
+}
+
+static bool PushBound(tokenizer_preprocessor* Preprocessor, int Bound) {
+    if (!TkReserve(&Preprocessor->Bounds, &Preprocessor->BoundCapacity, Preprocessor->BoundCount + 1)) {
+        return PreprocessorOutOfMemory(Preprocessor);
+    }
+
+    Preprocessor->Bounds[Preprocessor->BoundCount++] = Bound;
+    return true;
+}
+
+static preprocessor_context* PushContext(tokenizer_preprocessor* Preprocessor, int Macro) {
+    if (Preprocessor->Depth == Preprocessor->ContextCapacity) {
+        int Capacity = Preprocessor->ContextCapacity;
+
+        if (!TkReserve(&Preprocessor->Contexts, &Capacity, Preprocessor->Depth + 1)) {
+            PreprocessorOutOfMemory(Preprocessor);
+            return 0;
+        }
+
+        memset(Preprocessor->Contexts + Preprocessor->ContextCapacity, 0,
+               (Capacity - Preprocessor->ContextCapacity) * sizeof(preprocessor_context));
+        Preprocessor->ContextCapacity = Capacity;
+    }
+
+    // The token memory of a context is kept for the next one at the same depth.
+    preprocessor_context* Context = &Preprocessor->Contexts[Preprocessor->Depth++];
+    Context->Count = 0;
+    Context->At = 0;
+    Context->Macro = Macro;
+    return Context;
+}
+
+static bool PushContextToken(tokenizer_preprocessor* Preprocessor, preprocessor_context* Context, preprocessed_token* Token) {
+    if (!TkReserve(&Context->Tokens, &Context->Capacity, Context->Count + 1)) {
+        return PreprocessorOutOfMemory(Preprocessor);
+    }
+
+    Context->Tokens[Context->Count++] = *Token;
+    return true;
+}
+
+static void PopContext(tokenizer_preprocessor* Preprocessor) {
+    preprocessor_context* Context = &Preprocessor->Contexts[--Preprocessor->Depth];
+
+    if (Context->Macro >= 0) {
+        Preprocessor->Macros[Context->Macro].Disabled = false;
+    }
+}
+
+// Pushes the tokens in Stack[Start, StackCount) as a context and removes them from the stack.
+static preprocessor_context* PushStackContext(tokenizer_preprocessor* Preprocessor, int Start) {
+    preprocessor_context* Context = PushContext(Preprocessor, -1);
+    if (!Context) return 0;
+
+    int Count = Preprocessor->StackCount - Start;
+
+    if (!TkReserve(&Context->Tokens, &Context->Capacity, Count)) {
+        PreprocessorOutOfMemory(Preprocessor);
+        return 0;
+    }
+
+    if (Count) memcpy(Context->Tokens, Preprocessor->Stack + Start, Count * sizeof(preprocessed_token));
+    Context->Count = Count;
+    Preprocessor->StackCount = Start;
+    return Context;
+}
+
+static preprocessed_token GetSourceToken(tokenizer_preprocessor* Preprocessor, int SourceIndex, int Index) {
+    token_buffer* Tokens = &Preprocessor->Sources[SourceIndex].Tokens;
+
+    preprocessed_token Token;
+    Token.Token = GetBufferToken(Tokens, Index);
+    Token.Location.Source = SourceIndex;
+    Token.Location.Line = Tokens->Lines[Index];
+    Token.Expansion = Token.Location;
+    Token.Space = Index == 0 || Tokens->Offsets[Index - 1] + Tokens->Lengths[Index - 1] != Tokens->Offsets[Index];
+    Token.NoExpand = false;
+    return Token;
+}
+
+// What the reader gives after the end, or after an error.
+static preprocessed_token GetEndToken(tokenizer_preprocessor* Preprocessor) {
+    preprocessed_token Token = preprocessed_token();
+
+    if (Preprocessor->FileCount) {
+        int Source = Preprocessor->Files[0].Source;
+        Token = GetSourceToken(Preprocessor, Source, Preprocessor->Sources[Source].Tokens.Count - 1);
+    }
+    else {
+        Token.Token.Type = TOKEN_EOS;
+        Token.Location.Source = -1;
+        Token.Expansion.Source = -1;
+    }
+
+    return Token;
+}
+
+// Pushes the tokens of a directive line, from 'From', to the stack. A '\' at the end of a line joins
+// it with the next one.
+static bool PushDirectiveLine(tokenizer_preprocessor* Preprocessor, int SourceIndex, int From, int End) {
+    token_buffer* Tokens = &Preprocessor->Sources[SourceIndex].Tokens;
+
+    for (int i = From; i < End; ++i) {
+        if (Tokens->Types[i] == TOKEN_BACKSLASH && (i + 1 == End || Tokens->Lines[i + 1] != Tokens->Lines[i])) {
+            continue;
+        }
+
+        preprocessed_token Token = GetSourceToken(Preprocessor, SourceIndex, i);
+        if (!PushStack(Preprocessor, &Token)) return false;
+    }
+
+    return true;
+}
+
+
+// Lexes a file and indexes its directives. Returns the index of the source, -1 if the file can't be
+// read (or on error).
+static int LoadSource(tokenizer_preprocessor* Preprocessor, unsigned int PathAtom, char* Data) {
+    if (!TkReserve(&Preprocessor->Sources, &Preprocessor->SourceCapacity, Preprocessor->SourceCount + 1)) {
+        PreprocessorOutOfMemory(Preprocessor);
+        return -1;
+    }
+
+    int Index = Preprocessor->SourceCount;
+    preprocessor_source* Source = &Preprocessor->Sources[Index];
+    *Source = preprocessor_source();
+    Source->Path = Preprocessor->Interner.Atoms[PathAtom].Text;
+
+    if (Data) {
+        InitTokenizer(&Source->Tokenizer, Data, Source->Path);
+    }
+    else if (!InitTokenizerFromFile(&Source->Tokenizer, Source->Path)) {
+        return -1;
+    }
+
+    Source->Tokenizer.Interner = &Preprocessor->Interner;
+    Source->Tokenizer.Operators = Preprocessor->Operators;
+
+    InitTokenBuffer(&Source->Tokens, 0);
+
+    // From here on the source is kept even if it is broken, so that FreePreprocessor releases it.
+    Preprocessor->SourceCount++;
+
+    preprocessor_location Where = { Index, 0 };
+
+    if (!TokenizeAll(&Source->Tokenizer, &Source->Tokens)) {
+        SetPreprocessorError(Preprocessor, Where, "Could not lex the file");
+        return -1;
+    }
+
+    token_buffer* Tokens = &Source->Tokens;
+    int Capacity = 0;
+
+    // Bounds holds the directives of the conditionals that are still open.
+    int Open = Preprocessor->BoundCount;
+
+    for (int i = 0; i < Tokens->Count; ++i) {
+        bool LineStart = i == 0 || (Tokens->Lines[i] != Tokens->Lines[i - 1] && Tokens->Types[i - 1] != TOKEN_BACKSLASH);
+        if (Tokens->Types[i] != TOKEN_HASHTAG || !LineStart) continue;
+
+        int End = i + 1;
+        while (Tokens->Types[End] != TOKEN_EOS &&
+               (Tokens->Lines[End] == Tokens->Lines[End - 1] || Tokens->Types[End - 1] == TOKEN_BACKSLASH)) {
+            ++End;
+        }
+
+        preprocessor_directive Directive = { i, End, TK_DIRECTIVE_NONE, -1 };
+        Where.Line = Tokens->Lines[i];
+
+        if (End > i + 1) {
+            token Name = GetBufferToken(Tokens, i + 1);
+            Directive.Kind = Name.Type == TOKEN_INTEGER ? TK_DIRECTIVE_IGNORED : TK_DIRECTIVE_UNKNOWN;
+
+            if (Name.Type == TOKEN_IDENT || Name.Type == TOKEN_KEYWORD) {
+                for (int d = 0; d < (int)(sizeof(TkDirectives) / sizeof(TkDirectives[0])); ++d) {
+                    if (TkIsText(&Name, TkDirectives[d].Name)) {
+                        Directive.Kind = TkDirectives[d].Kind;
+                        break;
+                    }
+                }
+            }
+        }
+
+        int Count = Source->DirectiveCount;
+
+        if (Directive.Kind >= TK_DIRECTIVE_ELIF && Directive.Kind <= TK_DIRECTIVE_ENDIF) {
+            if (Preprocessor->BoundCount == Open) {
+                SetPreprocessorError(Preprocessor, Where, "Conditional directive without #if");
+                return -1;
+            }
+
+            preprocessor_directive* Previous = &Source->Directives[Preprocessor->Bounds[Preprocessor->BoundCount - 1]];
+
+            if (Previous->Kind == TK_DIRECTIVE_ELSE && Directive.Kind != TK_DIRECTIVE_ENDIF) {
+                SetPreprocessorError(Preprocessor, Where, "Conditional directive after #else");
+                return -1;
+            }
+
+            Previous->Next = Count;
+            Preprocessor->BoundCount--;
+        }
+
+        if (Directive.Kind >= TK_DIRECTIVE_IF && Directive.Kind <= TK_DIRECTIVE_ELSE) {
+            if (!PushBound(Preprocessor, Count)) return -1;
+        }
+
+        if (!TkReserve(&Source->Directives, &Capacity, Count + 1)) {
+            PreprocessorOutOfMemory(Preprocessor);
+            return -1;
+        }
+
+        Source->Directives[Source->DirectiveCount++] = Directive;
+        i = End - 1;
+    }
+
+    if (Preprocessor->BoundCount != Open) {
+        Where.Line = Tokens->Lines[Source->Directives[Preprocessor->Bounds[Open]].Token];
+        Preprocessor->BoundCount = Open;
+        SetPreprocessorError(Preprocessor, Where, "#if without #endif");
+        return -1;
+    }
+
+    // An include guard: #ifndef first, its #endif last, and nothing else around.
+    preprocessor_directive* Directives = Source->Directives;
+    int Last = Source->DirectiveCount - 1;
+
+    if (Last > 0 && Directives[0].Token == 0 && Directives[0].Kind == TK_DIRECTIVE_IFNDEF &&
+        Directives[0].Next == Last && Directives[Last].End == Tokens->Count - 1 && Directives[0].End > 2) {
+        token Name = GetBufferToken(Tokens, 2);
+        Source->Guard = GetNameAtom(Preprocessor, &Name);
+    }
+
+    if (!ReserveAtoms(Preprocessor)) return -1;
+    Preprocessor->AtomSources[PathAtom] = Index;
+    return Index;
+}
+
+// Returns the source of a path, lexing the file the first time.
+static int FindSource(tokenizer_preprocessor* Preprocessor, const char* Directory, int DirectoryLength,
+                      const char* Name, int NameLength) {
+
+    bool Separator = DirectoryLength && Directory[DirectoryLength - 1] != '/' && Directory[DirectoryLength - 1] != '\\';
+    int Length = DirectoryLength + Separator + NameLength;
+
+    char* Path = ReserveText(Preprocessor, Length);
+    if (!Path) return -1;
+
+    memcpy(Path, Directory, DirectoryLength);
+    if (Separator) Path[DirectoryLength] = '/';
+    memcpy(Path + DirectoryLength + Separator, Name, NameLength);
+    Path[Length] = 0;
+
+    unsigned int Atom = Intern(&Preprocessor->Interner, Path, Length);
+
+    if (!Atom) {
+        PreprocessorOutOfMemory(Preprocessor);
+        return -1;
+    }
+
+    if (!ReserveAtoms(Preprocessor)) return -1;
+
+    int Source = Preprocessor->AtomSources[Atom];
+
+    if (Source == -1) {
+        Source = LoadSource(Preprocessor, Atom, 0);
+
+        // Missing files are remembered too, the same paths are tried for every #include <...>.
+        if (Source < 0 && !Preprocessor->Error) Preprocessor->AtomSources[Atom] = -2;
+    }
+
+    return Source;
+}
+
+static bool ExpandToken(tokenizer_preprocessor* Preprocessor, int Floor, preprocessed_token* Result);
+static void HandleDirective(tokenizer_preprocessor* Preprocessor);
+
+static void ReadFileToken(tokenizer_preprocessor* Preprocessor, preprocessed_token* Result) {
+    for (;;) {
+        if (Preprocessor->Error || !Preprocessor->FileCount) {
+            *Result = GetEndToken(Preprocessor);
+            return;
+        }
+
+        preprocessor_file* File = &Preprocessor->Files[Preprocessor->FileCount - 1];
+        preprocessor_source* Source = &Preprocessor->Sources[File->Source];
+
+        if (File->Directive < Source->DirectiveCount && Source->Directives[File->Directive].Token == File->At) {
+            HandleDirective(Preprocessor);
+            continue;
+        }
+
+        if (Source->Tokens.Types[File->At] == TOKEN_EOS && Preprocessor->FileCount > 1) {
+            Preprocessor->FileCount--;
+            continue;
+        }
+
+        *Result = GetSourceToken(Preprocessor, File->Source, File->At);
+        if (Result->Token.Type != TOKEN_EOS) File->At++;
+        return;
+    }
+}
+
+// Reads a token without expanding it. With a 'Floor', only reads from the context at that depth and
+// the ones above it (returns false once it is done). Without one (-1), reads from the files once there
+// are no more contexts.
+static bool ReadRawToken(tokenizer_preprocessor* Preprocessor, int Floor, preprocessed_token* Token) {
+    for (;;) {
+        if (Preprocessor->Error) {
+            *Token = GetEndToken(Preprocessor);
+            return Floor < 0;
+        }
+
+        if (!Preprocessor->Depth) {
+            ReadFileToken(Preprocessor, Token);
+            return true;
+        }
+
+        preprocessor_context* Context = &Preprocessor->Contexts[Preprocessor->Depth - 1];
+
+        if (Context->At < Context->Count) {
+            *Token = Context->Tokens[Context->At++];
+            return true;
+        }
+
+        if (Preprocessor->Depth - 1 == Floor) {
+            return false;
+        }
+
+        PopContext(Preprocessor);
+    }
+}
+
+// Puts back a token read too early.
+static void UnreadToken(tokenizer_preprocessor* Preprocessor, preprocessed_token* Token) {
+    preprocessor_context* Context = PushContext(Preprocessor, -1);
+    if (Context) PushContextToken(Preprocessor, Context, Token);
+}
+
+// Writes the spelling of tokens between quotes, as #Parameter does.
+static bool StringizeTokens(tokenizer_preprocessor* Preprocessor, preprocessed_token* Tokens, int Count, preprocessed_token* Result) {
+    int Length = 2;
+    for (int i = 0; i < Count; ++i) Length += 2 * Tokens[i].Token.Length + 1;
+
+    char* Text = ReserveText(Preprocessor, Length);
+    if (!Text) return false;
+
+    char* c = Text;
+    *c++ = '"';
+
+    for (int i = 0; i < Count; ++i) {
+        token* Token = &Tokens[i].Token;
+        bool Quoted = Token->Type == TOKEN_STRING || Token->Type == TOKEN_CHAR;
+
+        if (i > 0 && Tokens[i].Space) *c++ = ' ';
+
+        for (int j = 0; j < Token->Length; ++j) {
+            if (Quoted && (Token->Text[j] == '"' || Token->Text[j] == '\\')) *c++ = '\\';
+            *c++ = Token->Text[j];
+        }
+    }
+
+    *c++ = '"';
+
+    unsigned int Atom = Intern(&Preprocessor->Interner, Text, (int)(c - Text));
+    if (!Atom) return PreprocessorOutOfMemory(Preprocessor);
+
+    Result->Token.Type = TOKEN_STRING;
+    Result->Token.Text = Preprocessor->Interner.Atoms[Atom].Text;
+    Result->Token.Length = (int)(c - Text);
+    Result->Token.Int = 0;
+    return true;
+}
+
+// Joins two tokens into one, as ## does.
+static bool PasteTokens(tokenizer_preprocessor* Preprocessor, preprocessed_token* Left, preprocessed_token* Right) {
+    int Length = Left->Token.Length + Right->Token.Length;
+
+    char* Text = ReserveText(Preprocessor, Length);
+    if (!Text) return false;
+
+    memcpy(Text, Left->Token.Text, Left->Token.Length);
+    memcpy(Text + Left->Token.Length, Right->Token.Text, Right->Token.Length);
+
+    // ## itself can be made by pasting, it is kept as a TOKEN_HASHTAG of length 2.
+    if (Length == 2 && Text[0] == '#' && Text[1] == '#') {
+        unsigned int Atom = Intern(&Preprocessor->Interner, Text, Length);
+        if (!Atom) return PreprocessorOutOfMemory(Preprocessor);
+
+        Left->Token.Type = TOKEN_HASHTAG;
+        Left->Token.Text = Preprocessor->Interner.Atoms[Atom].Text;
+        Left->Token.Length = Length;
+        Left->Token.Int = 0;
+    }
+    else if (!MakeToken(Preprocessor, Text, Length, &Left->Token)) {
+        SetPreprocessorError(Preprocessor, Left->Location, "Pasting does not give a valid token");
+        return false;
+    }
+
+    Left->NoExpand = false;
+    return true;
+}
+
+static bool ExpandBuiltin(tokenizer_preprocessor* Preprocessor, preprocessor_macro* Macro, preprocessed_token* Token) {
+    preprocessor_location Where = Token->Expansion;
+
+    if (Macro->Builtin == TK_BUILTIN_LINE) {
+        char Digits[16];
+        int Length = 0;
+        unsigned int Line = (unsigned int)Where.Line;
+
+        do {
+            Digits[15 - Length++] = (char)('0' + Line % 10);
+            Line /= 10;
+        } while (Line);
+
+        return MakeToken(Preprocessor, Digits + 16 - Length, Length, &Token->Token) || !Preprocessor->Error;
+    }
+
+    preprocessed_token Path;
+    Path.Space = false;
+    Path.Token.Type = TOKEN_STRING;
+    Path.Token.Text = (char*)(Where.Source >= 0 ? Preprocessor->Sources[Where.Source].Path : "");
+    Path.Token.Length = (int)strlen(Path.Token.Text);
+
+    return StringizeTokens(Preprocessor, &Path, 1, Token);
+}
+
+// Replaces a macro by its body: the expansion is pushed as a context, and the macro disabled until the
+// context is done. The arguments are in Stack, delimited by the 'ArgumentCount' pairs of indices at
+// Bounds[BoundBase], followed by the pairs of the expanded arguments.
+static bool SubstituteMacro(tokenizer_preprocessor* Preprocessor, int MacroIndex, preprocessed_token* Invocation,
+                            int ArgumentCount, int BoundBase) {
+
+    preprocessor_macro* Macro = &Preprocessor->Macros[MacroIndex];
+    int* Bounds = Preprocessor->Bounds + BoundBase;
+
+    preprocessor_context* Context = PushContext(Preprocessor, MacroIndex);
+    if (!Context) return false;
+
+    // Index of the token the next ## pastes to, -1 after an empty argument (a placemarker).
+    int PasteTarget = -1;
+    bool SkipPaste = false;
+
+    for (int b = 0; b < Macro->Count; ++b) {
+        preprocessor_macro_token* Body = &Preprocessor->Bodies[Macro->First + b];
+        bool PasteLeft = b > 0 && Body[-1].Paste && !SkipPaste;
+        SkipPaste = false;
+
+        preprocessed_token* Group = &Body->Token;
+        int GroupCount = 1;
+        preprocessed_token Stringized;
+
+        if (Body->Parameter >= 0) {
+            int Argument = Body->Parameter;
+            int Pair = Body->Expand ? 2 * (ArgumentCount + Argument) : 2 * Argument;
+
+            Group = Preprocessor->Stack + Bounds[Pair];
+            GroupCount = Bounds[Pair + 1] - Bounds[Pair];
+
+            if (Body->Stringize) {
+                Stringized = Body->Token;
+                if (!StringizeTokens(Preprocessor, Group, GroupCount, &Stringized)) return false;
+
+                Group = &Stringized;
+                GroupCount = 1;
+            }
+        }
+        else if (Body->Paste && Body->Token.Token.Type == TOKEN_COMMA && b + 1 < Macro->Count &&
+                 Body[1].Parameter == Macro->ParameterCount - 1 && Macro->Variadic) {
+            // , ## __VA_ARGS__ drops the comma when there are no variadic arguments.
+            int Pair = 2 * Body[1].Parameter;
+            if (Bounds[Pair] == Bounds[Pair + 1]) {
+                ++b;
+                continue;
+            }
+
+            SkipPaste = true;
+        }
+
+        if (!PasteLeft) PasteTarget = -1;
+
+        for (int i = 0; i < GroupCount; ++i) {
+            preprocessed_token Token = Group[i];
+            Token.Expansion = Invocation->Expansion;
+
+            if (i == 0) {
+                Token.Space = b == 0 ? Invocation->Space : Body->Token.Space;
+
+                if (PasteLeft && PasteTarget >= 0) {
+                    if (!PasteTokens(Preprocessor, &Context->Tokens[PasteTarget], &Token)) return false;
+                    continue;
+                }
+            }
+
+            if (!PushContextToken(Preprocessor, Context, &Token)) return false;
+        }
+
+        if (GroupCount) PasteTarget = Context->Count - 1;
+    }
+
+    Macro->Disabled = true;
+    return true;
+}
+
+// Expands the arguments in Stack[Start, End): they are pushed as a context that is read up to its end.
+static bool ExpandArgument(tokenizer_preprocessor* Preprocessor, int Start, int End) {
+    preprocessor_context* Context = PushContext(Preprocessor, -1);
+    if (!Context || !TkReserve(&Context->Tokens, &Context->Capacity, End - Start)) {
+        return PreprocessorOutOfMemory(Preprocessor);
+    }
+
+    if (End > Start) memcpy(Context->Tokens, Preprocessor->Stack + Start, (End - Start) * sizeof(preprocessed_token));
+    Context->Count = End - Start;
+
+    int Floor = Preprocessor->Depth - 1;
+    preprocessed_token Token;
+
+    while (ExpandToken(Preprocessor, Floor, &Token)) {
+        if (!PushStack(Preprocessor, &Token)) break;
+    }
+
+    if (Preprocessor->Error) return false;
+
+    PopContext(Preprocessor);
+    return true;
+}
+
+// Reads the arguments of a function-like macro, whose '(' was just read, and substitutes it.
+static bool ExpandCall(tokenizer_preprocessor* Preprocessor, int Floor, int MacroIndex, preprocessed_token* Invocation) {
+    int Base = Preprocessor->StackCount;
+    int BoundBase = Preprocessor->BoundCount;
+
+    int Parameters = Preprocessor->Macros[MacroIndex].ParameterCount;
+    bool Variadic = Preprocessor->Macros[MacroIndex].Variadic;
+
+    int Nesting = 0;
+    int Start = Base;
+    int Count = 0;
+
+    for (;;) {
+        preprocessed_token Token;
+
+        if (!ReadRawToken(Preprocessor, Floor, &Token) || Token.Token.Type == TOKEN_EOS) {
+            SetPreprocessorError(Preprocessor, Invocation->Location, "Unterminated macro call");
+            return false;
+        }
+
+        token_type Type = Token.Token.Type;
+        bool Split = false;
+
+        if (Type == TOKEN_OPEN_PAREN) {
+            ++Nesting;
+        }
+        else if (Type == TOKEN_CLOSE_PAREN) {
+            if (Nesting-- == 0) break;
+        }
+        else if (Type == TOKEN_COMMA && Nesting == 0) {
+            Split = !Variadic || Count < Parameters - 1;
+        }
+
+        if (Split) {
+            if (!PushBound(Preprocessor, Start) || !PushBound(Preprocessor, Preprocessor->StackCount)) return false;
+            Start = Preprocessor->StackCount;
+            ++Count;
+        }
+        else if (!PushStack(Preprocessor, &Token)) {
+            return false;
+        }
+    }
+
+    if (!PushBound(Preprocessor, Start) || !PushBound(Preprocessor, Preprocessor->StackCount)) return false;
+    ++Count;
+
+    // f() has no argument if f takes none, and the variadic ones may be left out.
+    if (Count == 1 && Parameters == 0 && Start == Preprocessor->StackCount) {
+        Count = 0;
+        Preprocessor->BoundCount -= 2;
+    }
+    else if (Variadic && Count == Parameters - 1) {
+        if (!PushBound(Preprocessor, Preprocessor->StackCount) || !PushBound(Preprocessor, Preprocessor->StackCount)) return false;
+        ++Count;
+    }
+
+    if (Count != Parameters) {
+        SetPreprocessorError(Preprocessor, Invocation->Location, "Wrong number of macro arguments");
+        return false;
+    }
+
+    // Arguments used as such (not with # or ##) are fully expanded before being substituted.
+    for (int a = 0; a < Count; ++a) {
+        if (!PushBound(Preprocessor, -1) || !PushBound(Preprocessor, -1)) return false;
+    }
+
+    preprocessor_macro* Macro = &Preprocessor->Macros[MacroIndex];
+
+    for (int b = 0; b < Macro->Count; ++b) {
+        preprocessor_macro_token* Body = &Preprocessor->Bodies[Macro->First + b];
+        int Pair = BoundBase + 2 * (Count + Body->Parameter);
+
+        if (!Body->Expand || Preprocessor->Bounds[Pair] >= 0) continue;
+
+        int Expanded = Preprocessor->StackCount;
+        int Argument = BoundBase + 2 * Body->Parameter;
+
+        if (!ExpandArgument(Preprocessor, Preprocessor->Bounds[Argument], Preprocessor->Bounds[Argument + 1])) return false;
+
+        Preprocessor->Bounds[Pair] = Expanded;
+        Preprocessor->Bounds[Pair + 1] = Preprocessor->StackCount;
+        Macro = &Preprocessor->Macros[MacroIndex];
+    }
+
+    bool Result = SubstituteMacro(Preprocessor, MacroIndex, Invocation, Count, BoundBase);
+
+    Preprocessor->StackCount = Base;
+    Preprocessor->BoundCount = BoundBase;
+    return Result;
+}
+
+// Returns the next token with all macros expanded. See ReadRawToken for 'Floor'.
+static bool ExpandToken(tokenizer_preprocessor* Preprocessor, int Floor, preprocessed_token* Result) {
+    for (;;) {
+        preprocessed_token Token;
+        if (!ReadRawToken(Preprocessor, Floor, &Token)) return false;
+
+        int MacroIndex = Token.NoExpand ? -1 : GetMacro(Preprocessor, &Token.Token);
+
+        if (MacroIndex < 0) {
+            *Result = Token;
+            return true;
+        }
+
+        preprocessor_macro* Macro = &Preprocessor->Macros[MacroIndex];
+
+        if (Macro->Disabled) {
+            Token.NoExpand = true;
+            *Result = Token;
+            return true;
+        }
+
+        if (Macro->Builtin) {
+            if (!ExpandBuiltin(Preprocessor, Macro, &Token)) continue;
+            *Result = Token;
+            return true;
+        }
+
+        if (Macro->ParameterCount < 0) {
+            SubstituteMacro(Preprocessor, MacroIndex, &Token, 0, Preprocessor->BoundCount);
+            continue;
+        }
+
+        // A function-like macro not followed by '(' is just a name.
+        preprocessed_token Next;
+        bool Read = ReadRawToken(Preprocessor, Floor, &Next);
+
+        if (!Read || Next.Token.Type != TOKEN_OPEN_PAREN) {
+            if (Read) UnreadToken(Preprocessor, &Next);
+            *Result = Token;
+            return true;
+        }
+
+        ExpandCall(Preprocessor, Floor, MacroIndex, &Token);
+    }
+}
+
+
+// The number of tokens making '...' at 'At', 0 if there is none.
+static int GetEllipsisLength(preprocessed_token* Tokens, int At, int Count) {
+    if (At < Count && TkIsText(&Tokens[At].Token, "...")) return 1;
+
+    if (At + 2 < Count && TkIsText(&Tokens[At].Token, ".") && TkIsText(&Tokens[At + 1].Token, ".") &&
+        TkIsText(&Tokens[At + 2].Token, ".") && !Tokens[At + 1].Space && !Tokens[At + 2].Space) {
+        return 3;
+    }
+
+    return 0;
+}
+
+static bool DefineMacroTokens(tokenizer_preprocessor* Preprocessor, preprocessed_token* Tokens, int Count, preprocessor_location Where) {
+    unsigned int Name = Count ? GetNameAtom(Preprocessor, &Tokens[0].Token) : 0;
+
+    if (!Name) {
+        SetPreprocessorError(Preprocessor, Where, "Macro name missing");
+        return false;
+    }
+
+    preprocessor_macro Macro = { Name, -1, false, false, TK_BUILTIN_NONE, Preprocessor->BodyCount, 0 };
+
+    // The parameters go to Bounds while the body is read.
+    int Parameters = Preprocessor->BoundCount;
+    int i = 1;
+
+    if (i < Count && Tokens[i].Token.Type == TOKEN_OPEN_PAREN && !Tokens[i].Space) {
+        Macro.ParameterCount = 0;
+        ++i;
+
+        for (;; ++i) {
+            if (i < Count && Tokens[i].Token.Type == TOKEN_CLOSE_PAREN && Macro.ParameterCount == 0) {
+                break;
+            }
+
+            unsigned int Parameter = 0;
+            int Ellipsis = GetEllipsisLength(Tokens, i, Count);
+
+            if (Ellipsis) {
+                Parameter = Intern(&Preprocessor->Interner, "__VA_ARGS__", 11);
+                Macro.Variadic = true;
+                i += Ellipsis - 1;
+            }
+            else if (i < Count) {
+                Parameter = GetNameAtom(Preprocessor, &Tokens[i].Token);
+
+                // GNU named variadic parameter: 'Name...'
+                Ellipsis = GetEllipsisLength(Tokens, i + 1, Count);
+                Macro.Variadic = Ellipsis != 0;
+                i += Ellipsis;
+            }
+
+            if (!Parameter || !PushBound(Preprocessor, (int)Parameter)) {
+                Preprocessor->BoundCount = Parameters;
+                SetPreprocessorError(Preprocessor, Where, "Invalid macro parameter");
+                return false;
+            }
+
+            ++Macro.ParameterCount;
+            ++i;
+
+            if (i < Count && Tokens[i].Token.Type == TOKEN_CLOSE_PAREN) break;
+
+            if (i >= Count || Tokens[i].Token.Type != TOKEN_COMMA || Macro.Variadic) {
+                Preprocessor->BoundCount = Parameters;
+                SetPreprocessorError(Preprocessor, Where, "Invalid macro parameter list");
+                return false;
+            }
+        }
+
+        ++i;
+    }
+
+    for (; i < Count; ++i) {
+        preprocessor_macro_token Body;
+        Body.Token = Tokens[i];
+        Body.Parameter = -1;
+        Body.Stringize = false;
+        Body.Paste = false;
+        Body.Expand = false;
+
+        bool Hash = Tokens[i].Token.Type == TOKEN_HASHTAG;
+
+        // ## is two '#' in a row.
+        if (Hash && i + 1 < Count && Tokens[i + 1].Token.Type == TOKEN_HASHTAG && !Tokens[i + 1].Space) {
+            if (Macro.Count == 0 || i + 2 == Count) {
+                Preprocessor->BoundCount = Parameters;
+                SetPreprocessorError(Preprocessor, Where, "## at the edge of a macro");
+                return false;
+            }
+
+            Preprocessor->Bodies[Preprocessor->BodyCount - 1].Paste = true;
+            ++i;
+            continue;
+        }
+
+        if (Hash && Macro.ParameterCount >= 0) {
+            if (i + 1 == Count) {
+                Preprocessor->BoundCount = Parameters;
+                SetPreprocessorError(Preprocessor, Where, "# is not followed by a parameter");
+                return false;
+            }
+
+            bool Space = Tokens[i].Space;
+
+            Body.Stringize = true;
+            Body.Token = Tokens[++i];
+            Body.Token.Space = Space;
+        }
+
+        unsigned int Atom = GetNameAtom(Preprocessor, &Body.Token.Token);
+
+        for (int p = 0; Atom && p < Macro.ParameterCount; ++p) {
+            if ((unsigned int)Preprocessor->Bounds[Parameters + p] == Atom) {
+                Body.Parameter = p;
+                break;
+            }
+        }
+
+        if (Body.Stringize && Body.Parameter < 0) {
+            Preprocessor->BoundCount = Parameters;
+            SetPreprocessorError(Preprocessor, Where, "# is not followed by a parameter");
+            return false;
+        }
+
+        if (!TkReserve(&Preprocessor->Bodies, &Preprocessor->BodyCapacity, Preprocessor->BodyCount + 1)) {
+            Preprocessor->BoundCount = Parameters;
+            return PreprocessorOutOfMemory(Preprocessor);
+        }
+
+        Preprocessor->Bodies[Preprocessor->BodyCount++] = Body;
+        ++Macro.Count;
+    }
+
+    Preprocessor->BoundCount = Parameters;
+
+    preprocessor_macro_token* Bodies = Preprocessor->Bodies + Macro.First;
+
+    for (int b = 0; b < Macro.Count; ++b) {
+        Bodies[b].Expand = Bodies[b].Parameter >= 0 && !Bodies[b].Stringize && !Bodies[b].Paste &&
+                           !(b > 0 && Bodies[b - 1].Paste);
+    }
+
+    // A redefinition gets a new slot: the old one may still be disabled by an expansion in progress.
+    if (!TkReserve(&Preprocessor->Macros, &Preprocessor->MacroCapacity, Preprocessor->MacroCount + 1) ||
+        !ReserveAtoms(Preprocessor)) {
+        return PreprocessorOutOfMemory(Preprocessor);
+    }
+
+    Preprocessor->AtomMacros[Name] = Preprocessor->MacroCount;
+    Preprocessor->Macros[Preprocessor->MacroCount++] = Macro;
+    return true;
+}
+
+// Evaluates the #if expression in Stack[At, End).
+struct tk_condition {
+    tokenizer_preprocessor* Preprocessor;
+    preprocessed_token* Tokens;
+    int At;
+    int End;
+    preprocessor_location Where;
+    bool Error;
+};
+
+// A value of a #if expression, which has the type intmax_t or uintmax_t (64 bits here).
+struct tk_condition_value {
+    unsigned long long int Value;
+    bool Unsigned;
+};
+
+static inline tk_condition_value TkConditionValue(unsigned long long int Value, bool Unsigned = false) {
+    tk_condition_value Result = { Value, Unsigned };
+    return Result;
+}
+
+static tk_condition_value EvaluateCondition(tk_condition* Condition, int MinPrecedence, bool Live);
+
+static inline bool TkIsQuestion(tk_condition* Condition) {
+    return Condition->At < Condition->End && TkIsText(&Condition->Tokens[Condition->At].Token, "?");
+}
+
+static tk_condition_value ConditionError(tk_condition* Condition, const char* Message) {
+    if (!Condition->Error) SetPreprocessorError(Condition->Preprocessor, Condition->Where, Message);
+    Condition->Error = true;
+    Condition->At = Condition->End;
+    return TkConditionValue(0);
+}
+
+// The lexer saturates integers to a long long, so #if reads them again from their text. A literal is
+// unsigned with a 'u' suffix or when it's too big for a long long, like for the compiler.
+static tk_condition_value ParseConditionInteger(tk_condition* Condition, token* Token) {
+    const char* c = Token->Text;
+    const char* End = Token->Text + Token->Length;
+    unsigned int Base = 10;
+
+    if (End - c > 2 && c[0] == '0' && (c[1] | 0x20) == 'x') {
+        Base = 16;
+        c += 2;
+    }
+    else if (c[0] == '0') {
+        Base = 8;
+    }
+
+    unsigned long long int Value = 0;
+    bool Overflow = false;
+
+    for (; c < End; ++c) {
+        unsigned int Digit = IS_DIGIT(*c) ? *c - '0' : IS_HEX(*c) ? (*c | 0x20) - 'a' + 10 : Base;
+        if (Digit >= Base) break;
+
+        Overflow |= Value > (~0ull - Digit) / Base;
+        Value = Value * Base + Digit;
+    }
+
+    bool Unsigned = Value > (~0ull >> 1);
+
+    for (; c < End; ++c) {
+        if ((*c | 0x20) == 'u') Unsigned = true;
+        else if ((*c | 0x20) != 'l') return ConditionError(Condition, "Invalid integer in #if expression");
+    }
+
+    if (Overflow) {
+        return ConditionError(Condition, "Integer too large in #if expression");
+    }
+
+    return TkConditionValue(Value, Unsigned);
+}
+
+static tk_condition_value EvaluateOperand(tk_condition* Condition, bool Live) {
+    if (Condition->At >= Condition->End) {
+        return ConditionError(Condition, "Incomplete #if expression");
+    }
+
+    preprocessed_token* Token = &Condition->Tokens[Condition->At++];
+
+    switch (Token->Token.Type) {
+        case TOKEN_INTEGER:     return ParseConditionInteger(Condition, &Token->Token);
+        case TOKEN_CHAR:        return TkConditionValue((unsigned long long int)Token->Token.Int);
+
+        case TOKEN_IDENT:
+        case TOKEN_KEYWORD:
+        {
+            // Identifiers left after expansion are 0, and so are calls like __has_builtin(x) that only
+            // the compiler can answer.
+            if (Condition->At < Condition->End && Condition->Tokens[Condition->At].Token.Type == TOKEN_OPEN_PAREN) {
+                int Nesting = 0;
+
+                for (; Condition->At < Condition->End; ++Condition->At) {
+                    token_type Type = Condition->Tokens[Condition->At].Token.Type;
+                    if (Type == TOKEN_OPEN_PAREN) ++Nesting;
+                    else if (Type == TOKEN_CLOSE_PAREN && --Nesting == 0) break;
+                }
+
+                if (Condition->At == Condition->End) return ConditionError(Condition, "Missing ')' in #if expression");
+                Condition->At++;
+                return TkConditionValue(0);
+            }
+
+            return TkConditionValue(TkIsText(&Token->Token, "true"));
+        }
+
+        case TOKEN_PLUS:        return EvaluateOperand(Condition, Live);
+        case TOKEN_NOT:         return TkConditionValue(!EvaluateOperand(Condition, Live).Value);
+
+        case TOKEN_MINUS:
+        case TOKEN_LOGIC_NOT:
+        {
+            tk_condition_value Value = EvaluateOperand(Condition, Live);
+            Value.Value = Token->Token.Type == TOKEN_MINUS ? 0 - Value.Value : ~Value.Value;
+            return Value;
+        }
+
+        case TOKEN_OPEN_PAREN:
+        {
+            tk_condition_value Value = EvaluateCondition(Condition, 0, Live);
+
+            if (Condition->At >= Condition->End || Condition->Tokens[Condition->At].Token.Type != TOKEN_CLOSE_PAREN) {
+                return ConditionError(Condition, "Missing ')' in #if expression");
+            }
+
+            Condition->At++;
+            return Value;
+        }
+
+        default: return ConditionError(Condition, "Invalid token in #if expression");
+    }
+}
+
+static int GetPrecedence(token_type Type) {
+    switch (Type) {
+        case TOKEN_ASTERISK: case TOKEN_FORWARD_SLASH: case TOKEN_MOD:                         return 10;
+        case TOKEN_PLUS: case TOKEN_MINUS:                                                      return 9;
+        case TOKEN_LEFT_SHIFT: case TOKEN_RIGHT_SHIFT:                                          return 8;
+        case TOKEN_OPEN_ANG_BRACKET: case TOKEN_CLOSE_ANG_BRACKET:
+        case TOKEN_LESS_EQUAL: case TOKEN_GREATER_EQUAL:                                        return 7;
+        case TOKEN_EQUAL_EQUAL: case TOKEN_NOT_EQUAL:                                           return 6;
+        case TOKEN_AND:                                                                         return 5;
+        case TOKEN_XOR:                                                                         return 4;
+        case TOKEN_OR:                                                                          return 3;
+        case TOKEN_AND_AND:                                                                     return 2;
+        case TOKEN_OR_OR:                                                                       return 1;
+        default:                                                                                return -1;
+    }
+}
+
+// Precedence climbing. 'Live' is false in the branches that are not taken, which don't fail on a
+// division by zero. Operands are converted like in C: if either one is unsigned, both are.
+static tk_condition_value EvaluateCondition(tk_condition* Condition, int MinPrecedence, bool Live) {
+    tk_condition_value Left = EvaluateOperand(Condition, Live);
+
+    for (;;) {
+        if (TkIsQuestion(Condition) && MinPrecedence == 0) {
+            Condition->At++;
+            tk_condition_value Then = EvaluateCondition(Condition, 0, Live && Left.Value);
+
+            if (Condition->At >= Condition->End || Condition->Tokens[Condition->At].Token.Type != TOKEN_COLON) {
+                return ConditionError(Condition, "Missing ':' in #if expression");
+            }
+
+            Condition->At++;
+            tk_condition_value Else = EvaluateCondition(Condition, 0, Live && !Left.Value);
+            Left = TkConditionValue(Left.Value ? Then.Value : Else.Value, Then.Unsigned || Else.Unsigned);
+            continue;
+        }
+
+        if (Condition->At >= Condition->End) return Left;
+
+        token_type Operator = Condition->Tokens[Condition->At].Token.Type;
+        int Precedence = GetPrecedence(Operator);
+        if (Precedence < MinPrecedence || Precedence < 0) return Left;
+
+        Condition->At++;
+
+        bool RightLive = Live && (Operator == TOKEN_AND_AND ? Left.Value != 0 : Operator == TOKEN_OR_OR ? Left.Value == 0 : true);
+        tk_condition_value Right = EvaluateCondition(Condition, Precedence + 1, RightLive);
+
+        bool Unsigned = Left.Unsigned || Right.Unsigned;
+        unsigned long long int L = Left.Value, R = Right.Value;
+        long long int SignedL = (long long int)L, SignedR = (long long int)R;
+
+        switch (Operator) {
+            case TOKEN_ASTERISK:            Left = TkConditionValue(L * R, Unsigned); break;
+            case TOKEN_FORWARD_SLASH:
+            case TOKEN_MOD:
+            {
+                if (R == 0) {
+                    if (Live) return ConditionError(Condition, "Division by zero in #if expression");
+                    Left = TkConditionValue(0, Unsigned);
+                }
+                else if (Unsigned) {
+                    Left = TkConditionValue(Operator == TOKEN_MOD ? L % R : L / R, true);
+                }
+                else if (SignedR == -1) {
+                    // Wraps like the other operators for LLONG_MIN / -1.
+                    Left = TkConditionValue(Operator == TOKEN_MOD ? 0 : 0 - L);
+                }
+                else {
+                    Left = TkConditionValue((unsigned long long int)(Operator == TOKEN_MOD ? SignedL % SignedR : SignedL / SignedR));
+                }
+            } break;
+            case TOKEN_PLUS:                Left = TkConditionValue(L + R, Unsigned); break;
+            case TOKEN_MINUS:               Left = TkConditionValue(L - R, Unsigned); break;
+
+            // A shift has the type of its left operand.
+            case TOKEN_LEFT_SHIFT:          Left.Value = R < 64 ? L << R : 0; break;
+            case TOKEN_RIGHT_SHIFT:
+            {
+                if (Left.Unsigned) Left.Value = R < 64 ? L >> R : 0;
+                else Left.Value = (unsigned long long int)(R < 64 ? SignedL >> R : (SignedL < 0 ? -1 : 0));
+            } break;
+
+            case TOKEN_OPEN_ANG_BRACKET:    Left = TkConditionValue(Unsigned ? L < R : SignedL < SignedR); break;
+            case TOKEN_CLOSE_ANG_BRACKET:   Left = TkConditionValue(Unsigned ? L > R : SignedL > SignedR); break;
+            case TOKEN_LESS_EQUAL:          Left = TkConditionValue(Unsigned ? L <= R : SignedL <= SignedR); break;
+            case TOKEN_GREATER_EQUAL:       Left = TkConditionValue(Unsigned ? L >= R : SignedL >= SignedR); break;
+            case TOKEN_EQUAL_EQUAL:         Left = TkConditionValue(L == R); break;
+            case TOKEN_NOT_EQUAL:           Left = TkConditionValue(L != R); break;
+            case TOKEN_AND:                 Left = TkConditionValue(L & R, Unsigned); break;
+            case TOKEN_XOR:                 Left = TkConditionValue(L ^ R, Unsigned); break;
+            case TOKEN_OR:                  Left = TkConditionValue(L | R, Unsigned); break;
+            case TOKEN_AND_AND:             Left = TkConditionValue(L && R); break;
+            case TOKEN_OR_OR:               Left = TkConditionValue(L || R); break;
+            default: break;
+        }
+    }
+}
+
+// Expands the tokens in Stack[Start, StackCount) in place.
+static bool ExpandStack(tokenizer_preprocessor* Preprocessor, int Start) {
+    if (!PushStackContext(Preprocessor, Start)) return false;
+
+    int Floor = Preprocessor->Depth - 1;
+    preprocessed_token Token;
+
+    while (ExpandToken(Preprocessor, Floor, &Token)) {
+        if (!PushStack(Preprocessor, &Token)) break;
+    }
+
+    if (Preprocessor->Error) return false;
+
+    PopContext(Preprocessor);
+    return true;
+}
+
+// Finds the file named by the tokens in Stack[Start, StackCount), "file" or <file>, and pops them.
+// #include_next ('Next') only looks in the include paths after the one of the current file.
+// Returns -1 if there is no such file, -2 if the tokens don't name a file.
+static int FindIncludedFile(tokenizer_preprocessor* Preprocessor, int SourceIndex, int Start, bool Next, int* FoundPath) {
+    *FoundPath = -1;
+
+    // #include MACRO
+    if (Start < Preprocessor->StackCount && Preprocessor->Stack[Start].Token.Type != TOKEN_STRING &&
+        Preprocessor->Stack[Start].Token.Type != TOKEN_OPEN_ANG_BRACKET && !ExpandStack(Preprocessor, Start)) {
+        Preprocessor->StackCount = Start;
+        return -1;
+    }
+
+    preprocessed_token* Tokens = Preprocessor->Stack + Start;
+    int Count = Preprocessor->StackCount - Start;
+
+    const char* Name = 0;
+    int Length = 0;
+    bool Angled = Count && Tokens[0].Token.Type == TOKEN_OPEN_ANG_BRACKET;
+
+    if (Count == 1 && Tokens[0].Token.Type == TOKEN_STRING && Tokens[0].Token.Length >= 2) {
+        Name = Tokens[0].Token.Text + 1;
+        Length = Tokens[0].Token.Length - 2;
+    }
+    else if (Angled && Tokens[Count - 1].Token.Type == TOKEN_CLOSE_ANG_BRACKET) {
+        for (int i = 1; i < Count - 1; ++i) Length += Tokens[i].Token.Length + 1;
+
+        char* Text = ReserveText(Preprocessor, Length);
+
+        if (!Text) {
+            Preprocessor->StackCount = Start;
+            return -1;
+        }
+
+        Length = 0;
+        for (int i = 1; i < Count - 1; ++i) {
+            if (i > 1 && Tokens[i].Space) Text[Length++] = ' ';
+            memcpy(Text + Length, Tokens[i].Token.Text, Tokens[i].Token.Length);
+            Length += Tokens[i].Token.Length;
+        }
+
+        // FindSource builds the path in the same scratch text.
+        unsigned int Atom = Intern(&Preprocessor->Interner, Text, Length);
+
+        if (!Atom) {
+            Preprocessor->StackCount = Start;
+            PreprocessorOutOfMemory(Preprocessor);
+            return -1;
+        }
+
+        Name = Preprocessor->Interner.Atoms[Atom].Text;
+    }
+
+    Preprocessor->StackCount = Start;
+
+    if (!Name) {
+        return -2;
+    }
+
+    int Found = -1;
+    bool Absolute = Name[0] == '/' || Name[0] == '\\' || (Length > 1 && Name[1] == ':');
+
+    if (Absolute) {
+        Found = FindSource(Preprocessor, "", 0, Name, Length);
+    }
+    else if (!Angled && !Next) {
+        const char* Path = Preprocessor->Sources[SourceIndex].Path;
+        int Directory = (int)strlen(Path);
+        while (Directory > 0 && Path[Directory - 1] != '/' && Path[Directory - 1] != '\\') --Directory;
+
+        Found = FindSource(Preprocessor, Path, Directory, Name, Length);
+    }
+
+    int First = Next ? Preprocessor->Files[Preprocessor->FileCount - 1].IncludePath + 1 : 0;
+
+    for (int i = First; Found < 0 && !Absolute && !Preprocessor->Error && i < Preprocessor->IncludePathCount; ++i) {
+        const char* Path = Preprocessor->IncludePaths[i];
+        Found = FindSource(Preprocessor, Path, (int)strlen(Path), Name, Length);
+        *FoundPath = i;
+    }
+
+    return Found >= 0 ? Found : -1;
+}
+
+// Like IsDefined, for #ifdef and defined: __has_include counts as a macro.
+static bool IsNameDefined(tokenizer_preprocessor* Preprocessor, token* Name, unsigned int Atom) {
+    return IsDefined(Preprocessor, Atom) || TkIsText(Name, "__has_include") || TkIsText(Name, "__has_include_next");
+}
+
+// Whether the condition of an #if, #ifdef, #ifndef or #elif holds.
+static bool IsConditionTrue(tokenizer_preprocessor* Preprocessor, int SourceIndex, preprocessor_directive* Directive) {
+    token_buffer* Tokens = &Preprocessor->Sources[SourceIndex].Tokens;
+    preprocessor_location Where = { SourceIndex, Tokens->Lines[Directive->Token] };
+
+    if (Directive->Kind == TK_DIRECTIVE_IFDEF || Directive->Kind == TK_DIRECTIVE_IFNDEF) {
+        token Name = Directive->End > Directive->Token + 2 ? GetBufferToken(Tokens, Directive->Token + 2) : token();
+        unsigned int Atom = GetNameAtom(Preprocessor, &Name);
+
+        if (!Atom) {
+            SetPreprocessorError(Preprocessor, Where, "Macro name missing");
+            return false;
+        }
+
+        return IsNameDefined(Preprocessor, &Name, Atom) == (Directive->Kind == TK_DIRECTIVE_IFDEF);
+    }
+
+    int Start = Preprocessor->StackCount;
+
+    // 'defined X', 'defined(X)' and '__has_include(...)' are replaced before anything is expanded.
+    for (int i = Directive->Token + 2; i < Directive->End; ++i) {
+        preprocessed_token Token = GetSourceToken(Preprocessor, SourceIndex, i);
+
+        if (Token.Token.Type == TOKEN_BACKSLASH) continue;
+
+        bool HasIncludeNext = TkIsText(&Token.Token, "__has_include_next");
+
+        if (HasIncludeNext || TkIsText(&Token.Token, "__has_include")) {
+            int Close = i + 2;
+            while (Close < Directive->End && Tokens->Types[Close] != TOKEN_CLOSE_PAREN) ++Close;
+
+            int Arguments = Preprocessor->StackCount;
+            int FoundPath;
+            int Found = -2;
+
+            if (Close < Directive->End && Tokens->Types[i + 1] == TOKEN_OPEN_PAREN &&
+                PushDirectiveLine(Preprocessor, SourceIndex, i + 2, Close)) {
+                Found = FindIncludedFile(Preprocessor, SourceIndex, Arguments, HasIncludeNext, &FoundPath);
+                Tokens = &Preprocessor->Sources[SourceIndex].Tokens;
+            }
+
+            if (Found == -2 || Preprocessor->Error) {
+                Preprocessor->StackCount = Start;
+                SetPreprocessorError(Preprocessor, Where, "Invalid use of __has_include");
+                return false;
+            }
+
+            MakeToken(Preprocessor, Found >= 0 ? "1" : "0", 1, &Token.Token);
+            i = Close;
+        }
+
+        if (TkIsText(&Token.Token, "defined")) {
+            bool Paren = i + 1 < Directive->End && Tokens->Types[i + 1] == TOKEN_OPEN_PAREN;
+            int NameIndex = i + 1 + Paren;
+
+            token Name = NameIndex < Directive->End ? GetBufferToken(Tokens, NameIndex) : token();
+            unsigned int Atom = GetNameAtom(Preprocessor, &Name);
+
+            if (!Atom || (Paren && (NameIndex + 1 >= Directive->End || Tokens->Types[NameIndex + 1] != TOKEN_CLOSE_PAREN))) {
+                Preprocessor->StackCount = Start;
+                SetPreprocessorError(Preprocessor, Where, "Invalid use of defined");
+                return false;
+            }
+
+            MakeToken(Preprocessor, IsNameDefined(Preprocessor, &Name, Atom) ? "1" : "0", 1, &Token.Token);
+            i = NameIndex + Paren;
+        }
+
+        if (!PushStack(Preprocessor, &Token)) return false;
+    }
+
+    if (!ExpandStack(Preprocessor, Start)) {
+        Preprocessor->StackCount = Start;
+        return false;
+    }
+
+    tk_condition Condition = { Preprocessor, Preprocessor->Stack, Start, Preprocessor->StackCount, Where, false };
+    tk_condition_value Value = Start < Preprocessor->StackCount ? EvaluateCondition(&Condition, 0, true) : ConditionError(&Condition, "Empty #if expression");
+
+    if (Condition.At < Condition.End) {
+        ConditionError(&Condition, "Invalid #if expression");
+    }
+
+    Preprocessor->StackCount = Start;
+    return !Condition.Error && Value.Value != 0;
+}
+
+static void IncludeFile(tokenizer_preprocessor* Preprocessor, int SourceIndex, preprocessor_directive* Directive,
+                        preprocessor_location Where, bool Next) {
+    int Start = Preprocessor->StackCount;
+    if (!PushDirectiveLine(Preprocessor, SourceIndex, Directive->Token + 2, Directive->End)) return;
+
+    int FoundPath;
+    int Found = FindIncludedFile(Preprocessor, SourceIndex, Start, Next, &FoundPath);
+
+    if (Preprocessor->Error) return;
+
+    if (Found == -2) {
+        SetPreprocessorError(Preprocessor, Where, "Invalid #include");
+        return;
+    }
+
+    if (Found < 0) {
+        SetPreprocessorError(Preprocessor, Where, "Included file not found");
+        return;
+    }
+
+    preprocessor_source* Source = &Preprocessor->Sources[Found];
+
+    // Nothing would come out of it.
+    if ((Source->Once && Source->Entered) || (Source->Guard && IsDefined(Preprocessor, Source->Guard))) {
+        return;
+    }
+
+    if (Preprocessor->FileCount == TK_MAX_INCLUDE_DEPTH) {
+        SetPreprocessorError(Preprocessor, Where, "#include nested too deeply");
+        return;
+    }
+
+    if (!TkReserve(&Preprocessor->Files, &Preprocessor->FileCapacity, Preprocessor->FileCount + 1)) {
+        PreprocessorOutOfMemory(Preprocessor);
+        return;
+    }
+
+    preprocessor_file File = { Found, 0, 0, FoundPath };
+    Preprocessor->Files[Preprocessor->FileCount++] = File;
+    Source->Entered = true;
+}
+
+// Handles the directive the top file is at.
+static void HandleDirective(tokenizer_preprocessor* Preprocessor) {
+    preprocessor_file* File = &Preprocessor->Files[Preprocessor->FileCount - 1];
+    int SourceIndex = File->Source;
+
+    preprocessor_source* Source = &Preprocessor->Sources[SourceIndex];
+    preprocessor_directive Directive = Source->Directives[File->Directive];
+    preprocessor_location Where = { SourceIndex, Source->Tokens.Lines[Directive.Token] };
+
+    File->At = Directive.End;
+    File->Directive++;
+
+    switch (Directive.Kind) {
+        case TK_DIRECTIVE_IF:
+        case TK_DIRECTIVE_IFDEF:
+        case TK_DIRECTIVE_IFNDEF:
+        {
+            if (IsConditionTrue(Preprocessor, SourceIndex, &Directive) || Preprocessor->Error) break;
+
+            // Jump from branch to branch until one is taken, or the #endif.
+            int Next = Directive.Next;
+            Source = &Preprocessor->Sources[SourceIndex];
+
+            while (Source->Directives[Next].Kind == TK_DIRECTIVE_ELIF &&
+                   !IsConditionTrue(Preprocessor, SourceIndex, &Source->Directives[Next]) && !Preprocessor->Error) {
+                Next = Source->Directives[Next].Next;
+                Source = &Preprocessor->Sources[SourceIndex];
+            }
+
+            File = &Preprocessor->Files[Preprocessor->FileCount - 1];
+            File->At = Source->Directives[Next].End;
+            File->Directive = Next + 1;
+        } break;
+
+        case TK_DIRECTIVE_ELIF:
+        case TK_DIRECTIVE_ELSE:
+        {
+            // The end of a branch that was taken.
+            int Next = Directive.Next;
+            while (Source->Directives[Next].Kind != TK_DIRECTIVE_ENDIF) Next = Source->Directives[Next].Next;
+
+            File->At = Source->Directives[Next].End;
+            File->Directive = Next + 1;
+        } break;
+
+        case TK_DIRECTIVE_DEFINE:
+        {
+            int Start = Preprocessor->StackCount;
+
+            if (PushDirectiveLine(Preprocessor, SourceIndex, Directive.Token + 2, Directive.End)) {
+                DefineMacroTokens(Preprocessor, Preprocessor->Stack + Start, Preprocessor->StackCount - Start, Where);
+            }
+
+            Preprocessor->StackCount = Start;
+        } break;
+
+        case TK_DIRECTIVE_UNDEF:
+        {
+            token Name = Directive.End > Directive.Token + 2 ? GetBufferToken(&Source->Tokens, Directive.Token + 2) : token();
+            unsigned int Atom = GetNameAtom(Preprocessor, &Name);
+
+            if (!Atom) SetPreprocessorError(Preprocessor, Where, "Macro name missing");
+            else if ((int)Atom < Preprocessor->AtomCapacity) Preprocessor->AtomMacros[Atom] = -1;
+        } break;
+
+        case TK_DIRECTIVE_INCLUDE:      IncludeFile(Preprocessor, SourceIndex, &Directive, Where, false); break;
+        case TK_DIRECTIVE_INCLUDE_NEXT: IncludeFile(Preprocessor, SourceIndex, &Directive, Where, true); break;
+
+        case TK_DIRECTIVE_PRAGMA:
+        {
+            token Name = Directive.End > Directive.Token + 2 ? GetBufferToken(&Source->Tokens, Directive.Token + 2) : token();
+            if (TkIsText(&Name, "once")) Source->Once = true;
+        } break;
+
+        case TK_DIRECTIVE_ERROR:    SetPreprocessorError(Preprocessor, Where, "#error"); break;
+        case TK_DIRECTIVE_UNKNOWN:  SetPreprocessorError(Preprocessor, Where, "Unknown directive"); break;
+
+        default: break;
+    }
+}
+
+static bool DefineBuiltins(tokenizer_preprocessor* Preprocessor) {
+    static const char* Names[] = { "__LINE__", "__FILE__" };
+
+    for (int i = 0; i < 2; ++i) {
+        unsigned int Atom = Intern(&Preprocessor->Interner, Names[i], 8);
+
+        if (!Atom || !ReserveAtoms(Preprocessor) ||
+            !TkReserve(&Preprocessor->Macros, &Preprocessor->MacroCapacity, Preprocessor->MacroCount + 1)) {
+            return PreprocessorOutOfMemory(Preprocessor);
+        }
+
+        preprocessor_macro Macro = { Atom, -1, false, false, TK_BUILTIN_LINE + i, 0, 0 };
+        Preprocessor->AtomMacros[Atom] = Preprocessor->MacroCount;
+        Preprocessor->Macros[Preprocessor->MacroCount++] = Macro;
+    }
+
+    return true;
+}
+
+TOKENIZER_DEF void InitPreprocessor(tokenizer_preprocessor* Preprocessor) {
+    *Preprocessor = tokenizer_preprocessor();
+    InitInterner(&Preprocessor->Interner, 0);
+    DefineBuiltins(Preprocessor);
+}
+
+TOKENIZER_DEF void FreePreprocessor(tokenizer_preprocessor* Preprocessor) {
+    for (int i = 0; i < Preprocessor->SourceCount; ++i) {
+        preprocessor_source* Source = &Preprocessor->Sources[i];
+        FreeTokenizer(&Source->Tokenizer);
+        FreeTokenBuffer(&Source->Tokens);
+        TOKENIZER_FREE(Source->Directives);
+    }
+
+    for (int i = 0; i < Preprocessor->ContextCapacity; ++i) {
+        TOKENIZER_FREE(Preprocessor->Contexts[i].Tokens);
+    }
+
+    TOKENIZER_FREE(Preprocessor->Sources);
+    TOKENIZER_FREE(Preprocessor->IncludePaths);
+    TOKENIZER_FREE(Preprocessor->Macros);
+    TOKENIZER_FREE(Preprocessor->Bodies);
+    TOKENIZER_FREE(Preprocessor->AtomMacros);
+    TOKENIZER_FREE(Preprocessor->AtomSources);
+    TOKENIZER_FREE(Preprocessor->KeywordAtoms);
+    TOKENIZER_FREE(Preprocessor->Files);
+    TOKENIZER_FREE(Preprocessor->Contexts);
+    TOKENIZER_FREE(Preprocessor->Stack);
+    TOKENIZER_FREE(Preprocessor->Bounds);
+    TOKENIZER_FREE(Preprocessor->Text);
+
+    FreeInterner(&Preprocessor->Interner);
+    *Preprocessor = tokenizer_preprocessor();
+}
+
+TOKENIZER_DEF bool AddIncludePath(tokenizer_preprocessor* Preprocessor, const char* Path) {
+    unsigned int Atom = Intern(&Preprocessor->Interner, Path, (int)strlen(Path));
+
+    if (!Atom || !TkReserve(&Preprocessor->IncludePaths, &Preprocessor->IncludePathCapacity, Preprocessor->IncludePathCount + 1)) {
+        return PreprocessorOutOfMemory(Preprocessor);
+    }
+
+    Preprocessor->IncludePaths[Preprocessor->IncludePathCount++] = Preprocessor->Interner.Atoms[Atom].Text;
+    return true;
+}
+
+TOKENIZER_DEF bool AddPreprocessorFile(tokenizer_preprocessor* Preprocessor, const char* Path, char* Data) {
+    unsigned int Atom = Intern(&Preprocessor->Interner, Path, (int)strlen(Path));
+    if (!Atom) return PreprocessorOutOfMemory(Preprocessor);
+    if (!ReserveAtoms(Preprocessor)) return false;
+
+    if (Preprocessor->AtomSources[Atom] >= 0) {
+        return false;
+    }
+
+    return LoadSource(Preprocessor, Atom, Data) >= 0;
+}
+
+TOKENIZER_DEF bool DefineMacro(tokenizer_preprocessor* Preprocessor, const char* Definition) {
+    unsigned int Atom = Intern(&Preprocessor->Interner, Definition, (int)strlen(Definition));
+    if (!Atom) return PreprocessorOutOfMemory(Preprocessor);
+
+    tokenizer Tokenizer;
+    InitTokenizer(&Tokenizer, Preprocessor->Interner.Atoms[Atom].Text, 0);
+    Tokenizer.Interner = &Preprocessor->Interner;
+    Tokenizer.Operators = Preprocessor->Operators;
+
+    int Start = Preprocessor->StackCount;
+    char* Previous = Tokenizer.At;
+
+    for (;;) {
+        preprocessed_token Token;
+        Token.Token = GetToken(&Tokenizer);
+        if (Token.Token.Type == TOKEN_EOS) break;
+
+        Token.Location.Source = -1;
+        Token.Location.Line = 1;
+        Token.Expansion = Token.Location;
+        Token.Space = Token.Token.Text != Previous;
+        Token.NoExpand = false;
+        Previous = Token.Token.Text + Token.Token.Length;
+
+        if (!PushStack(Preprocessor, &Token)) return false;
+    }
+
+    preprocessor_location Where = { -1, 1 };
+    bool Result = DefineMacroTokens(Preprocessor, Preprocessor->Stack + Start, Preprocessor->StackCount - Start, Where);
+
+    Preprocessor->StackCount = Start;
+    return Result;
+}
+
+TOKENIZER_DEF void UndefineMacro(tokenizer_preprocessor* Preprocessor, const char* Name) {
+    unsigned int Atom = Intern(&Preprocessor->Interner, Name, (int)strlen(Name));
+
+    if (Atom && (int)Atom < Preprocessor->AtomCapacity) {
+        Preprocessor->AtomMacros[Atom] = -1;
+    }
+}
+
+TOKENIZER_DEF void ClearMacros(tokenizer_preprocessor* Preprocessor) {
+    for (int i = 0; i < Preprocessor->AtomCapacity; ++i) {
+        Preprocessor->AtomMacros[i] = -1;
+    }
+
+    Preprocessor->MacroCount = 0;
+    Preprocessor->BodyCount = 0;
+    Preprocessor->Depth = 0;
+    DefineBuiltins(Preprocessor);
+}
+
+TOKENIZER_DEF bool PreprocessFile(tokenizer_preprocessor* Preprocessor, const char* Path) {
+    while (Preprocessor->Depth) PopContext(Preprocessor);
+
+    Preprocessor->FileCount = 0;
+    Preprocessor->StackCount = 0;
+    Preprocessor->BoundCount = 0;
+    Preprocessor->Error = false;
+
+    for (int i = 0; i < Preprocessor->SourceCount; ++i) {
+        Preprocessor->Sources[i].Entered = false;
+    }
+
+    unsigned int Atom = Intern(&Preprocessor->Interner, Path, (int)strlen(Path));
+    if (!Atom) return PreprocessorOutOfMemory(Preprocessor);
+    if (!ReserveAtoms(Preprocessor)) return false;
+
+    int Source = Preprocessor->AtomSources[Atom];
+    if (Source < 0) Source = LoadSource(Preprocessor, Atom, 0);
+
+    if (Source < 0 || !TkReserve(&Preprocessor->Files, &Preprocessor->FileCapacity, 1)) {
+        Preprocessor->Error = true;
+        return false;
+    }
+
+    preprocessor_file File = { Source, 0, 0, -1 };
+    Preprocessor->Files[Preprocessor->FileCount++] = File;
+    Preprocessor->Sources[Source].Entered = true;
+    return true;
+}
+
+TOKENIZER_DEF preprocessed_token GetPreprocessedToken(tokenizer_preprocessor* Preprocessor) {
+    preprocessed_token Token;
+    ExpandToken(Preprocessor, -1, &Token);
+    return Token;
+}
+
+#endif // TOKENIZER_PREPROCESSOR
+
+#ifdef TOKENIZER_BENCHMARK
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define TK_HAS_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TK_HAS_RDTSC 1
+#else
+#define TK_HAS_RDTSC 0
+#endif
+
+static const char* TkCorpusNames[CORPUS_COUNT] = { "ident", "number", "comment", "string", "operator" };
+
+// Relative weights of identifiers, numbers, comments, strings and operators in each corpus.
+static const int TkCorpusWeights[CORPUS_COUNT][5] = {
+    { 60, 10,  5,  5, 20 },     // ident
+    { 15, 60,  5,  0, 20 },     // number
+    { 15,  5, 60,  5, 15 },     // comment
+    { 15,  5,  5, 60, 15 },     // string
+    { 20, 10,  0,  5, 65 },     // operator
+};
+
+static const char* TkCorpusWords[] = {
+    "int", "char", "void", "const", "static", "return", "if", "else", "for", "while",
+    "i", "x", "Count", "Size", "Buffer", "Tokenizer", "Result", "size_t", "Next", "Data"
+};
+
+static const char* TkCorpusOperators[] = {
+    "(", ")", ":", "::", ";", ",", "*", "*=", "#", "&", "&&", "&=", "|", "||", "|=", "^", "^=",
+    "[", "]", "{", "}", "<", ">", ">>", ">>=", "<<", "<<=", ">=", "<=", "+", "-", "=", "==",
+    "++", "+=", "--", "-=", "->", "/", "/=", "%", "%=", "!", "!=", "~", "~=", "$"
+};
+
+#define TK_ARRAY_COUNT(Array) (int)(sizeof(Array) / sizeof(Array[0]))
+
+// SplitMix64
+static unsigned long long TkCorpusRandom(unsigned long long* State) {
+    unsigned long long Z = (*State += 0x9E3779B97F4A7C15ull);
+    Z = (Z ^ (Z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    Z = (Z ^ (Z >> 27)) * 0x94D049BB133111EBull;
+    return Z ^ (Z >> 31);
+}
+
+static int TkCorpusWord(char* Out, unsigned long long* State) {
+    unsigned long long Random = TkCorpusRandom(State);
+
+    if (Random & 1) {
+        const char* Word = TkCorpusWords[(Random >> 1) % TK_ARRAY_COUNT(TkCorpusWords)];
+        int Length = (int)strlen(Word);
+        memcpy(Out, Word, Length);
+        return Length;
+    }
+
+    static const char Chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
+
+    int Length = 1 + (int)((Random >> 8) % 16);
+    Out[0] = Chars[(Random >> 16) % 53];
+
+    for (int i = 1; i < Length; ++i) {
+        Out[i] = Chars[TkCorpusRandom(State) % 63];
+    }
+
+    return Length;
+}
+
+static int TkCorpusNumber(char* Out, unsigned long long* State) {
+    unsigned long long Random = TkCorpusRandom(State);
+    unsigned long long Value = TkCorpusRandom(State);
+
+    switch (Random % 5) {
+        case 0:  return sprintf(Out, "%llu", Value % 1000);
+        case 1:  return sprintf(Out, "%llu", Value >> (Random >> 8) % 64);
+        case 2:  return sprintf(Out, "0x%llX", Value >> (Random >> 8) % 64);
+        case 3:  return sprintf(Out, "%llu.%llu", Value % 10000, (Value >> 20) % 1000000);
+        default: return sprintf(Out, "%llu.%llue%s%d", Value % 10, (Value >> 8) % 1000, Random & 256 ? "-" : "", (int)((Value >> 30) % 300));
+    }
+}
+
+// A line or block comment, or a string literal with a few escapes.
+static int TkCorpusText(char* Out, unsigned long long* State, int Part) {
+    unsigned long long Random = TkCorpusRandom(State);
+    int WordCount = 1 + (int)(Random % 12);
+    int Length = 0;
+
+    bool Line = (Random >> 8) & 1;
+    const char* Open = Part == 2 ? (Line ? "// " : "/* ") : "\"";
+    const char* Close = Part == 2 ? (Line ? "\n" : " */") : "\"";
+
+    Length += sprintf(Out, "%s", Open);
+
+    for (int i = 0; i < WordCount; ++i) {
+        if (i) Out[Length++] = ' ';
+        Length += TkCorpusWord(Out + Length, State);
+
+        if (Part == 3 && (TkCorpusRandom(State) & 7) == 0) {
+            static const char* Escapes[] = { "\\n", "\\t", "\\\"", "\\\\" };
+            Length += sprintf(Out + Length, "%s", Escapes[TkCorpusRandom(State) & 3]);
+        }
+    }
+
+    Length += sprintf(Out + Length, "%s", Close);
+    return Length;
+}
+
+TOKENIZER_DEF void GenerateCorpus(char* Data, size_t Size, tokenizer_corpus Kind, unsigned long long Seed) {
+    if (!Size) {
+        return;
+    }
+
+    unsigned long long State = Seed * 0x2545F4914F6CDD1Dull + Kind;
+    const int* Weights = TkCorpusWeights[Kind];
+    int Total = Weights[0] + Weights[1] + Weights[2] + Weights[3] + Weights[4];
+
+    // Comments and strings are never cut, the tail is padded with spaces.
+    char Fragment[512];
+    size_t At = 0;
+    size_t Last = Size - 1;
+
+    while (At < Last) {
+        int Pick = (int)(TkCorpusRandom(&State) % Total);
+        int Part = 0;
+        while (Pick >= Weights[Part]) Pick -= Weights[Part++];
+
+        int Length = 0;
+        switch (Part) {
+            case 0:  Length = TkCorpusWord(Fragment, &State); break;
+            case 1:  Length = TkCorpusNumber(Fragment, &State); break;
+            case 4:  Length = sprintf(Fragment, "%s", TkCorpusOperators[TkCorpusRandom(&State) % TK_ARRAY_COUNT(TkCorpusOperators)]); break;
+            default: Length = TkCorpusText(Fragment, &State, Part); break;
+        }
+
+        Fragment[Length++] = TkCorpusRandom(&State) % 10 ? ' ' : '\n';
+
+        if (At + Length > Last) {
+            break;
+        }
+
+        memcpy(Data + At, Fragment, Length);
+        At += Length;
+    }
+
+    memset(Data + At, ' ', Last - At);
+    Data[Last] = 0;
+}
+
+typedef long long tk_benchmark_func(tokenizer* Tokenizer);
+
+static long long TkBenchmarkGet(tokenizer* Tokenizer) {
+    long long Count = 0;
+    while (GetToken(Tokenizer).Type != TOKEN_EOS) ++Count;
+    return Count;
+}
+
+// Look at the next token, sometimes the one after, then consume it.
+static long long TkBenchmarkPeekGet(tokenizer* Tokenizer) {
+    long long Count = 0;
+
+    for (;;) {
+        token Token = PeekToken(Tokenizer);
+        if (Token.Type == TOKEN_EOS) break;
+
+        if (Token.Type == TOKEN_IDENT) {
+            PeekToken(Tokenizer, 1);
+        }
+
+        GetToken(Tokenizer);
+        ++Count;
+    }
+
+    return Count;
+}
+
+// Try a few punctuators, otherwise require whatever comes next.
+static long long TkBenchmarkOptionalRequire(tokenizer* Tokenizer) {
+    long long Count = 0;
+
+    for (;;) {
+        if (OptionalToken(Tokenizer, TOKEN_SEMICOLON, 0) || OptionalToken(Tokenizer, TOKEN_COMMA, 0) ||
+            OptionalToken(Tokenizer, TOKEN_OPEN_PAREN, 0) || OptionalToken(Tokenizer, TOKEN_CLOSE_PAREN, 0)) {
+            ++Count;
+            continue;
+        }
+
+        token Token = PeekToken(Tokenizer);
+        if (Token.Type == TOKEN_EOS || !RequireToken(Tokenizer, Token.Type, 0)) break;
+        ++Count;
+    }
+
+    return Count;
+}
+
+// The 'get' loop, with the lexer compiled for another policy.
+template <typename Policy>
+static long long TkBenchmarkPolicy(tokenizer* Tokenizer) {
+    basic_tokenizer<Policy> Lexer;
+    static_cast<tokenizer&>(Lexer) = *Tokenizer;
+
+    long long Count = 0;
+    while (Lexer.GetToken().Type != TOKEN_EOS) ++Count;
+
+    *Tokenizer = Lexer;
+    return Count;
+}
+
+struct tk_no_lines_policy : tokenizer_policy {
+    static constexpr bool CountLines = false;
+};
+
+struct tk_no_comments_policy : tokenizer_policy {
+    static constexpr bool LineComments = false;
+    static constexpr bool BlockComments = false;
+};
+
+struct tk_no_numbers_policy : tokenizer_policy {
+    static constexpr bool ConvertNumbers = false;
+};
+
+struct tk_no_escapes_policy : tokenizer_policy {
+    static constexpr bool Escapes = false;
+};
+
+struct tk_lean_policy : tokenizer_policy {
+    static constexpr bool CountLines = false;
+    static constexpr bool LineComments = false;
+    static constexpr bool BlockComments = false;
+    static constexpr bool ConvertNumbers = false;
+    static constexpr bool Escapes = false;
+    static constexpr bool Utf8 = false;
+    static int FindKeyword(const char*, int) { return -1; }
+};
+
+#ifdef TOKENIZER_RANGES
+// The 'get' loop over TokenRange, which should compile to the same loop.
+static long long TkBenchmarkRange(tokenizer* Tokenizer) {
+    long long Count = 0;
+    for (const token_view& Token : TokenRange(Tokenizer)) {
+        (void)Token;
+        ++Count;
+    }
+    return Count;
+}
+#endif
+
+static const char* TkBenchmarkNames[] = { "get", "peek_get", "optional_require", "get_no_lines", "get_no_comments",
+                                          "get_no_numbers", "get_no_escapes", "get_lean",
+#ifdef TOKENIZER_RANGES
+                                          "range",
+#endif
+                                        };
+static tk_benchmark_func* TkBenchmarkFuncs[] = { TkBenchmarkGet, TkBenchmarkPeekGet, TkBenchmarkOptionalRequire,
+                                                 TkBenchmarkPolicy<tk_no_lines_policy>, TkBenchmarkPolicy<tk_no_comments_policy>,
+                                                 TkBenchmarkPolicy<tk_no_numbers_policy>, TkBenchmarkPolicy<tk_no_escapes_policy>,
+                                                 TkBenchmarkPolicy<tk_lean_policy>,
+#ifdef TOKENIZER_RANGES
+                                                 TkBenchmarkRange,
+#endif
+                                               };
+
+// Bit i is set if Names[i] is in the comma separated 'List'. Returns 0 on unknown names.
+static unsigned TkBenchmarkMask(const char* List, const char* const* Names, int Count) {
+    unsigned Mask = 0;
+
+    while (*List) {
+        size_t Length = strcspn(List, ",");
+        int i = 0;
+
+        while (i < Count && (strlen(Names[i]) != Length || strncmp(List, Names[i], Length))) ++i;
+        if (i == Count) return 0;
+
+        Mask |= 1u << i;
+        List += Length + (List[Length] == ',');
+    }
+
+    return Mask;
+}
+
+TOKENIZER_DEF int RunTokenizerBenchmarks(int ArgCount, char** Args) {
+    size_t Sizes[16] = { 1, 64 };
+    int SizeCount = 2;
+    unsigned Corpora = (1u << CORPUS_COUNT) - 1;
+    unsigned Patterns = (1u << TK_ARRAY_COUNT(TkBenchmarkNames)) - 1;
+    int Repeats = 3;
+    unsigned long long Seed = 1;
+
+    for (int i = 1; i < ArgCount; ++i) {
+        const char* Arg = Args[i];
+        bool Valid = true;
+
+        if (!strncmp(Arg, "--size=", 7)) {
+            SizeCount = 0;
+
+            for (char* At = (char*)Arg + 7; *At && SizeCount < 16; At += *At == ',') {
+                Sizes[SizeCount++] = (size_t)strtoull(At, &At, 10);
+                Valid = Valid && Sizes[SizeCount - 1] > 0 && (*At == ',' || !*At);
+                if (!Valid) break;
+            }
+
+            Valid = Valid && SizeCount > 0;
+        }
+        else if (!strncmp(Arg, "--corpus=", 9)) {
+            Corpora = TkBenchmarkMask(Arg + 9, TkCorpusNames, CORPUS_COUNT);
+            Valid = Corpora != 0;
+        }
+        else if (!strncmp(Arg, "--pattern=", 10)) {
+            Patterns = TkBenchmarkMask(Arg + 10, TkBenchmarkNames, TK_ARRAY_COUNT(TkBenchmarkNames));
+            Valid = Patterns != 0;
+        }
+        else if (!strncmp(Arg, "--repeat=", 9)) {
+            Repeats = atoi(Arg + 9);
+            Valid = Repeats > 0;
+        }
+        else if (!strncmp(Arg, "--seed=", 7)) {
+            Seed = strtoull(Arg + 7, 0, 10);
+        }
+        else {
+            Valid = false;
+        }
+
+        if (!Valid) {
+            fprintf(stderr, "Invalid argument '%s'. Options: --size=MB,... --corpus=ident,number,comment,string,operator "
+                            "--pattern=get,peek_get,optional_require,get_no_lines,get_no_comments,get_no_numbers,"
+                            "get_no_escapes,get_lean,range --repeat=N --seed=N\n", Arg);
+            return 1;
+        }
+    }
+
+    for (int s = 0; s < SizeCount; ++s) {
+        size_t Size = Sizes[s] << 20;
+        char* Data = (char*)TOKENIZER_MALLOC(Size);
+
+        if (!Data) {
+            fprintf(stderr, "Could not allocate %zu MB for the corpus\n", Sizes[s]);
+            return 1;
+        }
+
+        for (int c = 0; c < CORPUS_COUNT; ++c) {
+            if (!(Corpora & (1u << c))) continue;
+
+            GenerateCorpus(Data, Size, (tokenizer_corpus)c, Seed);
+
+            for (int p = 0; p < TK_ARRAY_COUNT(TkBenchmarkNames); ++p) {
+                if (!(Patterns & (1u << p))) continue;
+
+                double Best = 0;
+                unsigned long long BestCycles = 0;
+                long long Count = 0;
+                bool Error = false;
+
+                for (int r = 0; r < Repeats; ++r) {
+                    tokenizer Tokenizer;
+                    InitTokenizer(&Tokenizer, Data, 0);
+
+                    std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+#if TK_HAS_RDTSC
+                    unsigned long long StartCycles = __rdtsc();
+#endif
+                    Count = TkBenchmarkFuncs[p](&Tokenizer);
+#if TK_HAS_RDTSC
+                    unsigned long long Cycles = __rdtsc() - StartCycles;
+#else
+                    unsigned long long Cycles = 0;
+#endif
+                    double Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+
+                    Error = Error || Tokenizer.Error;
+                    FreeTokenizer(&Tokenizer);
+
+                    if (r == 0 || Seconds < Best) {
+                        Best = Seconds;
+                        BestCycles = Cycles;
+                    }
                 }
 
-            } else {
+                Best = Best > 0 ? Best : 1e-9;
+
+                printf("{\"corpus\":\"%s\",\"pattern\":\"%s\",\"seed\":%llu,\"bytes\":%zu,\"tokens\":%lld,\"error\":%s,"
+                       "\"seconds\":%.6f,\"mb_per_s\":%.2f,\"tokens_per_s\":%.0f,",
+                       TkCorpusNames[c], TkBenchmarkNames[p], Seed, Size - 1, Count, Error ? "true" : "false",
+                       Best, (Size - 1) / Best / (1 << 20), Count / Best);
 
-                Token.Type = TOKEN_UNKNOWN;
+                if (TK_HAS_RDTSC) printf("\"cycles_per_byte\":%.3f}\n", (double)BestCycles / (Size - 1));
+                else printf("\"cycles_per_byte\":null}\n");
+
+                fflush(stdout);
             }
-        } break;
+        }
+
+        TOKENIZER_FREE(Data);
     }
 
-    return Token;
+    return 0;
 }
 
-TOKENIZER_DEF token GetToken(tokenizer* Tokenizer) {
-    token Token = NextToken(Tokenizer);
-    Tokenizer->At = Token.Text + Token.Length;
-    return Token;
+#endif
+
+#ifdef TOKENIZER_FUZZ
+
+#include <errno.h>
+
+struct tk_fuzz_token {
+    int Type;
+    long long Offset;
+    int Length;
+    int Line;               // The newlines before the token, plus one
+    long long Value;        // Bits of the number, keyword index, 0 otherwise
+};
+
+struct tk_fuzz_tokens {
+    tk_fuzz_token* Tokens;
+    int Count;
+    int Capacity;
+};
+
+static void AddFuzzToken(tk_fuzz_tokens* List, tk_fuzz_token Token) {
+    if (List->Count == List->Capacity) {
+        List->Capacity = List->Capacity ? List->Capacity * 2 : 256;
+        List->Tokens = (tk_fuzz_token*)TOKENIZER_REALLOC(List->Tokens, List->Capacity * sizeof(tk_fuzz_token));
+        if (!List->Tokens) abort();
+    }
+
+    List->Tokens[List->Count++] = Token;
+}
+
+// The reference lexer. It goes one byte at a time through 'Length' bytes (up to the first '\0'), with
+// nothing shared with the real lexer but the operator list.
+
+static size_t SkipReferenceBlanks(const char* Data, size_t Length, size_t i) {
+    for (;;) {
+        while (i < Length && IS_WHITE(Data[i])) ++i;
+
+        if (i + 1 < Length && Data[i] == '/' && Data[i + 1] == '/') {
+            i += 2;
+            while (i < Length && Data[i] != '\r' && Data[i] != '\n') ++i;
+        }
+        else if (i + 1 < Length && Data[i] == '/' && Data[i + 1] == '*') {
+            i += 2;
+            while (i < Length && !(Data[i] == '*' && i + 1 < Length && Data[i + 1] == '/')) ++i;
+            if (i < Length) i += 2;
+        }
+        else {
+            return i;
+        }
+    }
 }
 
-TOKENIZER_DEF token PeekToken(tokenizer* Tokenizer) {
-    Tokenizer->CountLines = false;
-    token Next = NextToken(Tokenizer);
-    Tokenizer->CountLines = true;
-    return Next;
+static bool IsReferenceDigit(const char* Data, size_t Length, size_t i) {
+    return i < Length && IS_DIGIT(Data[i]);
 }
 
-TOKENIZER_DEF bool OptionalToken(tokenizer* Tokenizer, token_type Type, token* Optional) {
-    token Token = PeekToken(Tokenizer);
+static bool IsReferenceSuffix(const char* Data, size_t Length, size_t i, const char* Suffixes) {
+    return i < Length && Data[i] && strchr(Suffixes, Data[i]);
+}
 
-    if (Token.Type != Type) {
-        return false;
+// Returns the end of the number at 'i', its value goes to 'Token'.
+static size_t LexReferenceNumber(const char* Data, size_t Length, size_t i, tk_fuzz_token* Token) {
+    size_t j = i;
+    size_t Digits;
+    bool Float = Data[i] == '.';
+    int Base = 10;
+
+    if (!Float && Data[j] == '0' && j + 2 < Length && (Data[j + 1] == 'x' || Data[j + 1] == 'X') && IS_HEX(Data[j + 2])) {
+        Base = 16;
+        j += 2;
+        while (j < Length && IS_HEX(Data[j])) ++j;
+        Digits = j;
+        while (IsReferenceSuffix(Data, Length, j, "uUlL")) ++j;
     }
     else {
-        GetToken(Tokenizer); // TODO: redundant but we need the line numbers to show correctly
-        if (Optional) *Optional = Token;
+        if (Float) ++j;
+        while (IsReferenceDigit(Data, Length, j)) ++j;
+
+        if (!Float && j < Length && Data[j] == '.') {
+            Float = true;
+            ++j;
+            while (IsReferenceDigit(Data, Length, j)) ++j;
+        }
+
+        if (IsReferenceSuffix(Data, Length, j, "eE")) {
+            size_t k = j + 1;
+            if (IsReferenceSuffix(Data, Length, k, "+-")) ++k;
+
+            if (IsReferenceDigit(Data, Length, k)) {
+                Float = true;
+                j = k;
+                while (IsReferenceDigit(Data, Length, j)) ++j;
+            }
+        }
+
+        Digits = j;
+
+        if (IsReferenceSuffix(Data, Length, j, "fF")) {
+            Float = true;
+            ++j;
+        }
+        else if (Float) {
+            if (IsReferenceSuffix(Data, Length, j, "lL")) ++j;
+        }
+        else {
+            while (IsReferenceSuffix(Data, Length, j, "uUlL")) ++j;
+        }
+    }
+
+    char* Text = (char*)TOKENIZER_MALLOC(Digits - i + 1);
+    if (!Text) abort();
+    memcpy(Text, Data + i, Digits - i);
+    Text[Digits - i] = 0;
+
+    Token->Type = Float ? TOKEN_FLOAT : TOKEN_INTEGER;
+
+    if (Float) {
+        double Value = strtod(Text, 0);
+        memcpy(&Token->Value, &Value, sizeof(Value));
+    }
+    else {
+        errno = 0;
+        unsigned long long Value = strtoull(Text, 0, Base);
+        const unsigned long long MaxInt = ~0ull >> 1;
+        Token->Value = (errno == ERANGE || Value > MaxInt) ? (long long)MaxInt : (long long)Value;
+    }
+
+    TOKENIZER_FREE(Text);
+    return j;
+}
+
+// The value of the first character in the 'Length' bytes of a char literal.
+static long long DecodeReferenceChar(const char* Text, size_t Length) {
+    if (!Length) return 0;
+    if (Text[0] != '\\' || Length == 1) return (unsigned char)Text[0];
+
+    // Pairs of an escape letter and its value.
+    static const char Escapes[] = "n\nt\tr\ra\ab\bf\fv\v";
+    const char* Simple = Text[1] ? strchr(Escapes, Text[1]) : 0;
+    if (Simple && (Simple - Escapes) % 2 == 0) return Simple[1];
+
+    char Digits[16] = {};
+    size_t Count = 0;
+
+    if (Text[1] == 'x' || Text[1] == 'u' || Text[1] == 'U') {
+        size_t Max = Text[1] == 'u' ? 4 : Text[1] == 'U' ? 8 : Length;
+        while (Count < Max && 2 + Count < Length && IS_HEX(Text[2 + Count])) ++Count;
+        if (!Count) return Text[1];
+
+        // Only the last two digits of \x count.
+        size_t First = (Text[1] == 'x' && Count > 2) ? Count - 2 : 0;
+        memcpy(Digits, Text + 2 + First, Count - First);
+        return (long long)strtoull(Digits, 0, 16);
+    }
+
+    if (Text[1] >= '0' && Text[1] <= '7') {
+        while (Count < 3 && 1 + Count < Length && Text[1 + Count] >= '0' && Text[1 + Count] <= '7') ++Count;
+        memcpy(Digits, Text + 1, Count);
+        return (long long)(strtoull(Digits, 0, 8) & 0xFF);
+    }
+
+    return (unsigned char)Text[1];
+}
+
+// Length of the well-formed UTF-8 sequence at 'i', from the table of byte ranges of the Unicode
+// standard, 0 if there is none.
+static int ReferenceUtf8Length(const char* Data, size_t Length, size_t i, unsigned int* CodePoint) {
+    static const unsigned char Ranges[][8] = {
+        { 0xC2, 0xDF, 0x80, 0xBF },
+        { 0xE0, 0xE0, 0xA0, 0xBF, 0x80, 0xBF },
+        { 0xE1, 0xEC, 0x80, 0xBF, 0x80, 0xBF },
+        { 0xED, 0xED, 0x80, 0x9F, 0x80, 0xBF },
+        { 0xEE, 0xEF, 0x80, 0xBF, 0x80, 0xBF },
+        { 0xF0, 0xF0, 0x90, 0xBF, 0x80, 0xBF, 0x80, 0xBF },
+        { 0xF1, 0xF3, 0x80, 0xBF, 0x80, 0xBF, 0x80, 0xBF },
+        { 0xF4, 0xF4, 0x80, 0x8F, 0x80, 0xBF, 0x80, 0xBF },
+    };
+
+    unsigned char Lead = (unsigned char)Data[i];
+
+    for (int r = 0; r < 8; ++r) {
+        if (Lead < Ranges[r][0] || Lead > Ranges[r][1]) continue;
+
+        int Sequence = r == 0 ? 2 : r < 5 ? 3 : 4;
+        if (i + Sequence > Length) return 0;
+
+        *CodePoint = Lead & (0xFF >> (Sequence + 1));
+
+        for (int k = 1; k < Sequence; ++k) {
+            unsigned char Ch = (unsigned char)Data[i + k];
+            if (Ch < Ranges[r][2 * k] || Ch > Ranges[r][2 * k + 1]) return 0;
+            *CodePoint = (*CodePoint << 6) | (Ch & 0x3F);
+        }
+
+        return Sequence;
     }
 
+    return 0;
+}
+
+static bool IsReferenceUtf8(const char* Data, size_t Length) {
+    for (size_t i = 0; i < Length;) {
+        unsigned int CodePoint;
+        int Sequence = (unsigned char)Data[i] < 0x80 ? 1 : ReferenceUtf8Length(Data, Length, i, &CodePoint);
+        if (!Sequence) return false;
+        i += Sequence;
+    }
     return true;
 }
 
-TOKENIZER_DEF bool RequireToken(tokenizer* Tokenizer, token_type Type, token* Required) {
-    token Token = PeekToken(Tokenizer);
+// Length of the identifier character at 'i', 0 if there is none. 'Start' for the first one.
+static int ReferenceIdentChar(const char* Data, size_t Length, size_t i, bool Start) {
+    if (i >= Length) return 0;
 
-    if (Token.Type != Type) {
-        Tokenizer->Error = true;
-#ifdef TOKENIZER_LOG_ERRORS
-        fprintf(stderr, "Token type mismatch at line %d: required token type is %s but current token type is %s.\n", Tokenizer->Line, TokenTypes[Type], TokenTypes[Token.Type]);
+    char Ch = Data[i];
+    if (IS_LETTER(Ch) || Ch == '_' || (!Start && IS_DIGIT(Ch))) return 1;
+
+    unsigned int CodePoint;
+    int Sequence = ReferenceUtf8Length(Data, Length, i, &CodePoint);
+    int Class = Sequence ? TkXidClass(CodePoint) : 0;
+
+    return (Start ? Class == TK_XID_START : Class != 0) ? Sequence : 0;
+}
+
+static void LexReference(const char* Data, size_t Length, const tokenizer_operator* Extra, int ExtraCount, tk_fuzz_tokens* Out) {
+    size_t At = 0;
+
+    for (;;) {
+        size_t i = SkipReferenceBlanks(Data, Length, At);
+
+        tk_fuzz_token Token = { TOKEN_UNKNOWN, (long long)i, 1, 1, 0 };
+        for (size_t k = 0; k < i; ++k) Token.Line += Data[k] == '\n';
+
+        if (i == Length) {
+            Token.Type = TOKEN_EOS;
+            AddFuzzToken(Out, Token);
+            return;
+        }
+
+        char Ch = Data[i];
+        size_t End = i + 1;
+        int Operator = 0;
+
+        for (int k = 0; k < (int)TOKENIZER_OPERATOR_COUNT; ++k) {
+            int OperatorLength = (int)strlen(TkOperators[k].Text);
+
+            if (OperatorLength > Operator && i + OperatorLength <= Length && !memcmp(Data + i, TkOperators[k].Text, OperatorLength)) {
+                Operator = OperatorLength;
+                Token.Type = TkOperators[k].Type;
+            }
+        }
+
+        // Extra operators win ties. Numbers starting with a '.' win over all of them.
+        for (int k = 0; k < ExtraCount && !(Ch == '.' && IsReferenceDigit(Data, Length, i + 1)); ++k) {
+            int OperatorLength = (int)strlen(Extra[k].Text);
+
+            if (OperatorLength >= Operator && i + OperatorLength <= Length && !memcmp(Data + i, Extra[k].Text, OperatorLength)) {
+                Operator = OperatorLength;
+                Token.Type = TOKEN_OPERATOR;
+                Token.Value = Extra[k].Id;
+            }
+        }
+
+        if (Operator) {
+            End = i + Operator;
+        }
+        else if (Ch == '"' || Ch == '\'') {
+            while (End < Length && Data[End] != Ch) {
+                if (Data[End] == '\\' && End + 1 < Length) ++End;
+                ++End;
+            }
+
+            Token.Type = Ch == '"' ? TOKEN_STRING : TOKEN_CHAR;
+            if (Ch == '\'') Token.Value = DecodeReferenceChar(Data + i + 1, End - i - 1);
+
+            if (End < Length) ++End;
+        }
+        else if (IS_DIGIT(Ch) || (Ch == '.' && IsReferenceDigit(Data, Length, i + 1))) {
+            End = LexReferenceNumber(Data, Length, i, &Token);
+        }
+        else if (ReferenceIdentChar(Data, Length, i, true) || (Ch == '.' && ReferenceIdentChar(Data, Length, i + 1, true))) {
+            // A '.' right before an identifier is part of it.
+            End = Ch == '.' ? i + 1 : i;
+            while (int Next = ReferenceIdentChar(Data, Length, End, false)) End += Next;
+            Token.Type = TOKEN_IDENT;
+
+#ifdef TOKENIZER_KEYWORDS
+            for (int k = 0; k < TkKeywordCount; ++k) {
+                if (strlen(TkKeywords[k]) == End - i && !memcmp(TkKeywords[k], Data + i, End - i)) {
+                    Token.Type = TOKEN_KEYWORD;
+                    Token.Value = k;
+                }
+            }
 #endif
-        return false;
+        }
+        else {
+            // Other characters are unknown, a whole UTF-8 sequence at a time.
+            unsigned int CodePoint;
+            int Sequence = ReferenceUtf8Length(Data, Length, i, &CodePoint);
+            if (Sequence) End = i + Sequence;
+        }
+
+        Token.Length = (int)(End - i);
+        AddFuzzToken(Out, Token);
+        At = End;
     }
-    else {
-        GetToken(Tokenizer); // TODO: redundant but we need the line numbers to show correctly
-        if (Required) *Required = Token;
+}
+
+static tk_fuzz_token GetFuzzToken(const char* Base, token* Token, int Line) {
+    tk_fuzz_token Result = { Token->Type, (long long)(Token->Text - Base), Token->Length, Line, 0 };
+    if (Token->Type == TOKEN_INTEGER || Token->Type == TOKEN_FLOAT || Token->Type == TOKEN_CHAR) Result.Value = Token->Int;
+    if (Token->Type == TOKEN_KEYWORD) Result.Value = Token->Keyword;
+    if (Token->Type == TOKEN_OPERATOR) Result.Value = Token->Operator;
+    return Result;
+}
+
+// Without 'Lines', the lines aren't compared.
+static bool CompareFuzzTokens(const char* Backend, tk_fuzz_tokens* Expected, tk_fuzz_tokens* Got, bool Lines) {
+    for (int i = 0; i < Expected->Count || i < Got->Count; ++i) {
+
+        if (i == Expected->Count || i == Got->Count) {
+            fprintf(stderr, "%s: %d tokens instead of %d\n", Backend, Got->Count, Expected->Count);
+            return false;
+        }
+
+        tk_fuzz_token* E = &Expected->Tokens[i];
+        tk_fuzz_token* G = &Got->Tokens[i];
+
+        if (E->Type != G->Type || E->Offset != G->Offset || E->Length != G->Length || E->Value != G->Value || (Lines && E->Line != G->Line)) {
+            fprintf(stderr, "%s: token %d is type %d, offset %lld, length %d, line %d, value %llx instead of "
+                            "type %d, offset %lld, length %d, line %d, value %llx\n", Backend, i,
+                    G->Type, G->Offset, G->Length, G->Line, (unsigned long long)G->Value,
+                    E->Type, E->Offset, E->Length, E->Line, (unsigned long long)E->Value);
+            return false;
+        }
     }
 
     return true;
 }
 
-TOKENIZER_DEF void SetError(tokenizer *Tokenizer, const char* Message) {
-    Tokenizer->Error = true;
-#ifdef TOKENIZER_LOG_ERRORS
-    fprintf(stderr, "Error at line %d: %s.\n", Tokenizer->Line, Message);
+// Runs one engine directly, without going through GetToken.
+template <bool Bounded, bool Dfa>
+static void LexFuzzEngine(char* Data, char* End, int Max, tk_fuzz_tokens* Out) {
+    char* At = Data;
+    int Line = 1;
+
+    for (int i = 0; i < Max; ++i) {
+        char* c = SkipBlanks<Bounded, true>(At, End, &Line);
+
+        token Token;
+        Token.Type = TOKEN_UNKNOWN;
+        Token.Length = 1;
+        Token.Text = c;
+        Token.Int = 0;
+
+        unsigned int Hash = 0;
+        if (Dfa) LexTokenDfa<Bounded, false>(&Token, c, End, &Hash);
+        else LexTokenSwitch<Bounded, false>(&Token, c, End, &Hash);
+
+        AddFuzzToken(Out, GetFuzzToken(Data, &Token, Line));
+        if (Token.Type == TOKEN_EOS) break;
+
+        Line += CountTokenNewLines(&Token);
+        At = c + Token.Length;
+    }
+}
+
+static bool CheckFuzzBuffer(const char* Backend, token_buffer* Buffer, tk_fuzz_tokens* Expected, tk_fuzz_tokens* Got) {
+    for (int i = 0; i < Buffer->Count; ++i) {
+        token Token = GetBufferToken(Buffer, i);
+        AddFuzzToken(Got, GetFuzzToken(Buffer->Base, &Token, GetBufferLine(Buffer, i)));
+    }
+
+    bool Same = CompareFuzzTokens(Backend, Expected, Got, true);
+    Got->Count = 0;
+    return Same;
+}
+
+struct tk_fuzz_reader {
+    const char* Data;
+    size_t Length;
+    size_t At;
+    int Step;
+};
+
+static int ReadFuzzData(void* User, char* Buffer, int Size) {
+    tk_fuzz_reader* Reader = (tk_fuzz_reader*)User;
+
+    // Short reads, to land on every kind of window boundary.
+    int Count = (int)(Reader->Length - Reader->At);
+    if (Count > Size) Count = Size;
+    if (Count > Reader->Step) Count = Reader->Step;
+
+    memcpy(Buffer, Reader->Data + Reader->At, Count);
+    Reader->At += Count;
+    return Count;
+}
+
+// 'Data' is '\0'-terminated after 'Size' bytes, 'Exact' has the same bytes without the terminator.
+// 'Operators' is built from the 'ExtraCount' operators of 'Extra', or 0.
+static bool CheckFuzzText(char* Data, char* Exact, size_t Size, const unsigned char* Seed, size_t SeedSize,
+                          tokenizer_operators* Operators, const tokenizer_operator* Extra, int ExtraCount) {
+    size_t Length = strlen(Data);
+
+    tk_fuzz_tokens Expected = {};
+    tk_fuzz_tokens Got = {};
+    LexReference(Data, Length, Extra, ExtraCount, &Expected);
+
+    bool Ok = true;
+    int Max = Expected.Count + 1;
+
+#define TK_FUZZ_CHECK(Backend, Lines) \
+    if (Ok && !CompareFuzzTokens(Backend, &Expected, &Got, Lines)) Ok = false; \
+    Got.Count = 0;
+
+    // The engines alone don't know about extra operators.
+    if (!Operators) {
+        LexFuzzEngine<false, false>(Data, 0, Max, &Got);               TK_FUZZ_CHECK("switch", true);
+        LexFuzzEngine<true, false>(Exact, Exact + Size, Max, &Got);    TK_FUZZ_CHECK("switch, bounded", true);
+        LexFuzzEngine<false, true>(Data, 0, Max, &Got);                TK_FUZZ_CHECK("dfa", true);
+        LexFuzzEngine<true, true>(Exact, Exact + Size, Max, &Got);     TK_FUZZ_CHECK("dfa, bounded", true);
+    }
+
+    // GetToken in every mode. Past the end it must keep returning TOKEN_EOS at the same place.
+    static const char* Modes[] = { "GetToken", "GetToken, bounded", "GetToken, interned", "GetToken, bounded, interned" };
+
+    for (int Mode = 0; Mode < 8 && Ok; ++Mode) {
+        bool Bounded = Mode & 1, Interned = (Mode & 2) != 0, CountLines = (Mode & 4) != 0;
+        char* Base = Bounded ? Exact : Data;
+
+        tokenizer_interner Interner;
+        InitInterner(&Interner, 0);
+
+        tokenizer Tokenizer;
+        InitTokenizer(&Tokenizer, Base, 0);
+        Tokenizer.Operators = Operators;
+        if (Bounded) Tokenizer.End = Exact + Size;
+        if (Interned) Tokenizer.Interner = &Interner;
+        Tokenizer.CountLines = CountLines;
+
+#ifdef TOKENIZER_STATS
+        // Counting must not change the tokens, and every byte is whitespace, comment or token.
+        tokenizer_stats Stats;
+        if (CountLines) Tokenizer.Stats = &Stats;
+#endif
+
+        for (int i = 0; i < Max; ++i) {
+            token Token = GetToken(&Tokenizer);
+            int Line = CountLines ? Tokenizer.Line : GetTokenLocation(&Tokenizer, Token).Line;
+            AddFuzzToken(&Got, GetFuzzToken(Base, &Token, Line));
+
+            // Unescaping takes at most the length of the token, and agrees with the value of chars.
+            if (Token.Type == TOKEN_STRING || Token.Type == TOKEN_CHAR) {
+                char Memory[256];
+                tokenizer_arena Arena;
+                InitArena(&Arena, Memory, sizeof(Memory));
+
+                int UnescapedLength = 0;
+                char* Unescaped = UnescapeString(Token, &Arena, &UnescapedLength);
+
+                if (Token.Length <= (int)sizeof(Memory) && (!Unescaped || UnescapedLength >= Token.Length || Arena.Used > (size_t)Token.Length ||
+                    (Token.Type == TOKEN_CHAR && UnescapedLength && Token.Int < 0x80 && (unsigned char)Unescaped[0] != Token.Int))) {
+                    fprintf(stderr, "%s: UnescapeString failed on token %d\n", Modes[Mode & 3], i);
+                    Ok = false;
+                }
+
+                if (IsValidUtf8(Token.Text, Token.Length) != IsReferenceUtf8(Token.Text, Token.Length)) {
+                    fprintf(stderr, "%s: IsValidUtf8 failed on token %d\n", Modes[Mode & 3], i);
+                    Ok = false;
+                }
+            }
+
+            if (Interned && Token.Type == TOKEN_IDENT) {
+                int AtomLength = 0;
+                const char* Text = GetAtomText(&Interner, Token.Atom, &AtomLength);
+
+                if (!Text || AtomLength != Token.Length || memcmp(Text, Token.Text, AtomLength)) {
+                    fprintf(stderr, "%s: wrong atom for token %d\n", Modes[Mode & 3], i);
+                    Ok = false;
+                }
+            }
+
+            if (Token.Type == TOKEN_EOS) {
+                token After = GetToken(&Tokenizer);
+                if (After.Type != TOKEN_EOS || After.Text != Token.Text || Parsing(&Tokenizer)) {
+                    fprintf(stderr, "%s: GetToken went past TOKEN_EOS\n", Modes[Mode & 3]);
+                    Ok = false;
+                }
+
+#ifdef TOKENIZER_STATS
+                if (CountLines && Stats.WhitespaceBytes + Stats.CommentBytes + Stats.TokenBytes != Token.Text - Base) {
+                    fprintf(stderr, "%s: the stats don't add up to the input\n", Modes[Mode & 3]);
+                    Ok = false;
+                }
+#endif
+                break;
+            }
+        }
+
+        TK_FUZZ_CHECK(Modes[Mode & 3], true);
+        FreeTokenizer(&Tokenizer);
+        FreeInterner(&Interner);
+    }
+
+    // PeekToken ahead by amounts taken from the seed, then GetToken.
+    {
+        tokenizer Tokenizer;
+        InitTokenizer(&Tokenizer, Data, 0);
+        Tokenizer.Operators = Operators;
+
+        for (int i = 0; i < Max && Ok; ++i) {
+            int Ahead = SeedSize ? Seed[i % SeedSize] % TOKENIZER_LOOKAHEAD : 0;
+            token Peeked = PeekToken(&Tokenizer, Ahead);
+            tk_fuzz_token* Expect = &Expected.Tokens[i + Ahead < Expected.Count ? i + Ahead : Expected.Count - 1];
+
+            if (Peeked.Type != Expect->Type || Peeked.Text - Data != Expect->Offset) {
+                fprintf(stderr, "PeekToken: token %d + %d is type %d at %lld instead of type %d at %lld\n",
+                        i, Ahead, Peeked.Type, (long long)(Peeked.Text - Data), Expect->Type, Expect->Offset);
+                Ok = false;
+            }
+
+            token Token = GetToken(&Tokenizer);
+            AddFuzzToken(&Got, GetFuzzToken(Data, &Token, Tokenizer.Line));
+            if (Token.Type == TOKEN_EOS) break;
+        }
+
+        TK_FUZZ_CHECK("PeekToken", true);
+    }
+
+    // Whole buffers
+    {
+        token_buffer Buffer;
+        InitTokenBuffer(&Buffer, 0);
+
+        tokenizer Tokenizer;
+        InitTokenizer(&Tokenizer, Exact, 0);
+        Tokenizer.Operators = Operators;
+        Tokenizer.End = Exact + Size;
+        Ok = Ok && TokenizeAll(&Tokenizer, &Buffer) && CheckFuzzBuffer("TokenizeAll", &Buffer, &Expected, &Got);
+
+#ifdef TOKENIZER_PARALLEL
+        tokenizer Parallel;
+        InitTokenizer(&Parallel, Data, 0);
+        Parallel.Operators = Operators;
+        Ok = Ok && TokenizeAllParallel(&Parallel, &Buffer, 3, 16) && CheckFuzzBuffer("TokenizeAllParallel", &Buffer, &Expected, &Got);
 #endif
+
+        // Tokenize the text with two pieces cut out, then put them back with TokenizeEdit, the second
+        // piece first, so that the tokens between them go to the tail and come back.
+        size_t Offset = SeedSize ? (Seed[0] * 7919u + Seed[SeedSize - 1]) % (Length + 1) : 0;
+        size_t Cut = SeedSize > 1 ? Seed[1] % 16 : 0;
+        if (Cut > Length - Offset) Cut = Length - Offset;
+
+        size_t FirstOffset = SeedSize > 2 ? Seed[2] % (Offset + 1) : 0;
+        size_t FirstCut = SeedSize > 3 ? Seed[3] % 8 : 0;
+        if (FirstCut > Offset - FirstOffset) FirstCut = Offset - FirstOffset;
+
+        char* Before = (char*)TOKENIZER_MALLOC(Length - Cut - FirstCut + 1);
+        char* Middle = (char*)TOKENIZER_MALLOC(Length - FirstCut + 1);
+        if (!Before || !Middle) abort();
+        memcpy(Middle, Data, FirstOffset);
+        memcpy(Middle + FirstOffset, Data + FirstOffset + FirstCut, Length - FirstOffset - FirstCut + 1);
+        memcpy(Before, Middle, Offset - FirstCut);
+        memcpy(Before + Offset - FirstCut, Middle + Offset - FirstCut + Cut, Length - Offset - Cut + 1);
+
+        tokenizer Original;
+        InitTokenizer(&Original, Before, 0);
+        Original.Operators = Operators;
+        Ok = Ok && TokenizeAll(&Original, &Buffer);
+
+        tokenizer Edited;
+        InitTokenizer(&Edited, Middle, 0);
+        Edited.Operators = Operators;
+        Ok = Ok && TokenizeEdit(&Edited, &Buffer, (int)(Offset - FirstCut), 0, (int)Cut);
+
+        tokenizer Reedited;
+        InitTokenizer(&Reedited, Data, 0);
+        Reedited.Operators = Operators;
+        Ok = Ok && TokenizeEdit(&Reedited, &Buffer, (int)FirstOffset, 0, (int)FirstCut) && CheckFuzzBuffer("TokenizeEdit", &Buffer, &Expected, &Got);
+
+        FlushTokenEdits(&Buffer);
+        Ok = Ok && CheckFuzzBuffer("FlushTokenEdits", &Buffer, &Expected, &Got);
+
+        TOKENIZER_FREE(Before);
+        TOKENIZER_FREE(Middle);
+        FreeTokenBuffer(&Buffer);
+
+        packed_token_buffer Packed;
+        InitPackedTokenBuffer(&Packed, 0);
+
+        tokenizer ForPacking;
+        InitTokenizer(&ForPacking, Data, 0);
+        ForPacking.Operators = Operators;
+
+        if (Ok && TokenizeAllPacked(&ForPacking, &Packed)) {
+            for (int i = 0; i < Packed.Count; ++i) {
+                token Token = UnpackToken(&Packed, i);
+                AddFuzzToken(&Got, GetFuzzToken(Data, &Token, 0));
+            }
+            TK_FUZZ_CHECK("TokenizeAllPacked", false);
+        }
+
+        FreePackedTokenBuffer(&Packed);
+    }
+
+    // The stream, with a small window and short reads. Tokens longer than the window are an error.
+    if (Ok) {
+        tk_fuzz_reader Reader = { Data, Length, 0, SeedSize ? 1 + Seed[0] % 32 : 32 };
+        tokenizer_stream Stream;
+        InitTokenizerStream(&Stream, ReadFuzzData, &Reader, 64);
+        Stream.Tokenizer.Operators = Operators;
+
+        for (int i = 0; i < Max; ++i) {
+            token Token = GetStreamToken(&Stream);
+            if (Stream.Tokenizer.Error) break;
+
+            // The offset is relative to the input.
+            tk_fuzz_token Got1 = GetFuzzToken(Stream.Window, &Token, Stream.Tokenizer.Line);
+            Got1.Offset += Stream.Base;
+            AddFuzzToken(&Got, Got1);
+            if (Token.Type == TOKEN_EOS) break;
+        }
+
+        if (!Stream.Tokenizer.Error) {
+            TK_FUZZ_CHECK("stream", true);
+        }
+
+        Got.Count = 0;
+        FreeTokenizerStream(&Stream);
+    }
+
+#undef TK_FUZZ_CHECK
+
+    TOKENIZER_FREE(Expected.Tokens);
+    TOKENIZER_FREE(Got.Tokens);
+    return Ok;
 }
 
-TOKENIZER_DEF bool Parsing(tokenizer *Tokenizer) {
-    return (*Tokenizer->At && !Tokenizer->Error);
+// Pieces of C that tend to hit the corner cases, for the structured half of the fuzzing.
+static const char* TkFuzzPieces[] = {
+    " ", "\n", "\t", "\r\n", "\f", "//", "/*", "*/", "*", "/", "\"", "\\", "\\\"", "'", "#", "$",
+    "(", ")", ":", "::", "=", "==", ">", ">>", ">>=", "<", "<<=", "-", "->", "--", "+", "++", "&&", "|=",
+    "!", "~=", "%", "^", "0", "1", "9", "42", "0x", "0X1f", "0xFFFFFFFFFFFFFFFFF", "123456789012345678901234",
+    ".", "..", ".5", "1.", "1.5", "e", "E", "e+", "e-", "1e5", "1e400", "2.5e-3", "f", "F", "u", "L", "ul",
+    "_", "a", "Z", "abc", "x1", "if", "while", "return", "\x80", "\xff", "\x01", "\"str\"", "/* c */", "// c\n",
+    "...", "=>", "**", "?", "@", "<=>", "!!", "$$", "<<<",
+    "'a'", "'\\n'", "'\\''", "\\x41", "\\x", "\\u00e9", "\\U0001F600", "\\101", "\\0", "\\8",
+};
+
+// Extra operators: new characters, longer versions of built-in ones, a replaced one, and prefixes that
+// aren't operators ("!!", "<<<<").
+static const tokenizer_operator TkFuzzOperators[] = {
+    { "...", 1 }, { "=>", 2 }, { "**", 3 }, { "?", 4 }, { "@", 5 }, { ".", 6 }, { "<=>", 7 },
+    { "->", 8 }, { "!!!!", 9 }, { "$$$", 10 }, { "<<<<<<", 11 },
+};
+
+// Checks the text without, then with the extra operators.
+static bool CheckFuzzDialects(char* Data, char* Exact, size_t Size, const unsigned char* Seed, size_t SeedSize) {
+    const int Count = (int)(sizeof(TkFuzzOperators) / sizeof(TkFuzzOperators[0]));
+
+    static tokenizer_operators Operators;
+    static bool Ready = InitOperators(&Operators, TkFuzzOperators, Count);
+    if (!Ready) abort();
+
+    return CheckFuzzText(Data, Exact, Size, Seed, SeedSize, 0, 0, 0) &&
+           CheckFuzzText(Data, Exact, Size, Seed, SeedSize, &Operators, TkFuzzOperators, Count);
+}
+
+TOKENIZER_DEF bool FuzzTokenizer(const unsigned char* Data, size_t Size) {
+
+    // The raw bytes, once '\0'-terminated and once exactly 'Size' long, so sanitizers catch any read
+    // past the end in bounded mode.
+    char* Text = (char*)TOKENIZER_MALLOC(Size + 1);
+    char* Exact = (char*)TOKENIZER_MALLOC(Size ? Size : 1);
+    if (!Text || !Exact) abort();
+
+    memcpy(Text, Data, Size);
+    memcpy(Exact, Data, Size);
+    Text[Size] = 0;
+
+    bool Ok = CheckFuzzDialects(Text, Exact, Size, Data, Size);
+
+    TOKENIZER_FREE(Text);
+    TOKENIZER_FREE(Exact);
+
+    // Every byte picks a piece.
+    const int PieceCount = (int)(sizeof(TkFuzzPieces) / sizeof(TkFuzzPieces[0]));
+    size_t Length = 0;
+
+    for (size_t i = 0; i < Size; ++i) {
+        Length += strlen(TkFuzzPieces[Data[i] % PieceCount]);
+    }
+
+    Text = (char*)TOKENIZER_MALLOC(Length + 1);
+    Exact = (char*)TOKENIZER_MALLOC(Length ? Length : 1);
+    if (!Text || !Exact) abort();
+
+    Length = 0;
+    for (size_t i = 0; i < Size; ++i) {
+        const char* Piece = TkFuzzPieces[Data[i] % PieceCount];
+        size_t PieceLength = strlen(Piece);
+        memcpy(Text + Length, Piece, PieceLength);
+        Length += PieceLength;
+    }
+
+    Text[Length] = 0;
+    memcpy(Exact, Text, Length);
+
+    Ok = Ok && CheckFuzzDialects(Text, Exact, Length, Data, Size);
+
+    TOKENIZER_FREE(Text);
+    TOKENIZER_FREE(Exact);
+    return Ok;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char* Data, size_t Size) {
+    if (!FuzzTokenizer(Data, Size)) {
+        abort();
+    }
+    return 0;
 }
 
 #endif
+
+#endif